@@ -9,6 +9,23 @@ namespace args {
 
 bool verbose = false;
 bool help = false;
+string_t prompt = "GPT2 is a model developed by OpenAI";
+int max_new_tokens = 32;
+string_t quant = "fp32";
+float temperature = 0.0f;
+int top_k = 0;
+float top_p = 1.0f;
+float min_p = 0.0f;
+float repetition_penalty = 1.0f;
+uint64_t seed = 0;
+string_t draft = "none";
+int draft_tokens = 4;
+int draft_layers = 2;
+string_t convert_weights = "";
+int stream_layers_mb = 0;
+string_t tokenize_file = "";
+string_t tokens_out = "";
+string_t compile_tokenizer = "";
 }  // namespace args
 
 // Helper function for regular options
@@ -36,6 +53,23 @@ argument_parser_t::argument_parser_t() : opt_desc("Allowed options")
 
     add_option(opt_desc, "help,h", args::help, "produce help message");
     add_option(opt_desc, "verbose,v", args::verbose, "verbose (optional)");
+    add_option(opt_desc, "prompt,p", args::prompt, "text to generate from (optional)");
+    add_option(opt_desc, "max_new_tokens,n", args::max_new_tokens, "maximum number of tokens to generate (optional)");
+    add_option(opt_desc, "quant,q", args::quant, "weight precision, fp32 or int8 (optional)");
+    add_option(opt_desc, "temperature,t", args::temperature, "sampling temperature, 0 for greedy decoding (optional)");
+    add_option(opt_desc, "top_k", args::top_k, "sample from the k most likely tokens only, 0 for no limit (optional)");
+    add_option(opt_desc, "top_p", args::top_p, "nucleus sampling probability mass (optional)");
+    add_option(opt_desc, "min_p", args::min_p, "minimum probability relative to the most likely token (optional)");
+    add_option(opt_desc, "repetition_penalty", args::repetition_penalty, "penalty for tokens already in the context, 1 for none (optional)");
+    add_option(opt_desc, "seed", args::seed, "random seed for sampling (optional)");
+    add_option(opt_desc, "draft", args::draft, "speculative decoding draft, none, ngram or truncated (optional)");
+    add_option(opt_desc, "draft_tokens", args::draft_tokens, "tokens proposed by the draft per pass of the full model (optional)");
+    add_option(opt_desc, "draft_layers", args::draft_layers, "layers run by the truncated draft (optional)");
+    add_option(opt_desc, "convert_weights", args::convert_weights, "convert gpt2/tf_model.h5 to the native weight format at this path and exit (optional)");
+    add_option(opt_desc, "stream_layers_mb", args::stream_layers_mb, "stream the layers from the native weights within this many MB, 0 keeps them all resident (optional)");
+    add_option(opt_desc, "tokenize_file", args::tokenize_file, "tokenize this text file into uint16 token ids and exit (optional)");
+    add_option(opt_desc, "tokens_out", args::tokens_out, "where --tokenize_file writes the tokens, defaults to the input path with .tokens added (optional)");
+    add_option(opt_desc, "compile_tokenizer", args::compile_tokenizer, "compile gpt2/vocab.json and gpt2/merges.txt into a tokenizer file at this path and exit (optional)");
 }
 
 bool argument_parser_t::parse(int argc, char* argv[])
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <boost/program_options.hpp>
+#include <cstdint>
 #include "logger.h"
 #include "types/basic_types.h"
 
@@ -9,6 +10,23 @@ namespace args {
 
 extern bool verbose;
 extern bool help;
+extern string_t prompt;
+extern int max_new_tokens;
+extern string_t quant;
+extern float temperature;
+extern int top_k;
+extern float top_p;
+extern float min_p;
+extern float repetition_penalty;
+extern uint64_t seed;
+extern string_t draft;
+extern int draft_tokens;
+extern int draft_layers;
+extern string_t convert_weights;
+extern int stream_layers_mb;
+extern string_t tokenize_file;
+extern string_t tokens_out;
+extern string_t compile_tokenizer;
 }  // namespace args
 
 class argument_parser_t {
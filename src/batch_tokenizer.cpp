@@ -0,0 +1,160 @@
+#include "batch_tokenizer.h"
+#include <omp.h>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include "pre_tokenizer.h"
+#include "utils.h"
+
+namespace {
+
+bool is_ascii_non_space(char c)
+{
+    return static_cast<unsigned char>(c) < 0x80 && c != ' ' && !(c >= '\t' && c <= '\r');
+}
+
+// how far past the end of a chunk that isn't whitespace the pre-tokenizer can look when deciding where it ends, the
+// character after it is all it needs
+constexpr size_t chunk_lookahead = 4;
+
+}  // namespace
+
+batch_tokenizer_t::batch_tokenizer_t(const tokenizer_t& tokenizer, size_t segment_bytes, int num_threads)
+    : tokenizer(tokenizer), segment_bytes(segment_bytes), num_threads(num_threads)
+{
+    if (tokenizer.get_vocab_size() > std::numeric_limits<uint16_t>::max() + 1) {
+        die("A vocabulary of " + std::to_string(tokenizer.get_vocab_size()) + " tokens doesn't fit in uint16 token ids");
+    }
+    if (segment_bytes == 0) {
+        die("Batch tokenizer segments can't be empty");
+    }
+}
+
+size_t batch_tokenizer_t::find_split(std::string_view text, size_t from)
+{
+    for (size_t i = std::max<size_t>(from, 1); i + 1 < text.size(); ++i) {
+        if (text[i] == ' ' && is_ascii_non_space(text[i - 1]) && is_ascii_non_space(text[i + 1])) {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+size_t batch_tokenizer_t::find_chunk_split(std::string_view text, size_t from)
+{
+    pre_tokenizer_t pre_tokenizer(text);
+    std::string_view chunk;
+    while (pre_tokenizer.next(chunk)) {
+        size_t end = chunk.data() + chunk.size() - text.data();
+        if (end + chunk_lookahead > text.size()) {
+            break;
+        }
+        if (end >= from && !pre_tokenizer.is_whitespace_run()) {
+            return end;
+        }
+    }
+    return std::string_view::npos;
+}
+
+batch_tokenization_stats_t batch_tokenizer_t::tokenize(std::istream& input, std::ostream& output) const
+{
+    auto start = std::chrono::steady_clock::now();
+    int threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+    size_t block_bytes = segment_bytes * threads;
+
+    batch_tokenization_stats_t stats;
+    // text read in but not tokenized yet, the tail of one block is carried over to the next until a split is found
+    string_t block;
+    std::vector<std::string_view> segments;
+    std::vector<std::vector<int>> segment_tokens;
+    std::vector<uint16_t> encoded;
+    // find_split has already looked at everything in the block before this without finding a split
+    size_t search_from = 0;
+    // once this much text is waiting for a split it's cut at chunk ends instead, doubled every time that fails too so
+    // a huge chunk isn't rescanned for every block
+    size_t fallback_bytes = 2 * segment_bytes;
+
+    bool at_end = false;
+    while (!at_end) {
+        size_t carried = block.size();
+        block.resize(carried + block_bytes);
+        input.read(block.data() + carried, block_bytes);
+        block.resize(carried + input.gcount());
+        stats.bytes += input.gcount();
+        at_end = !input;
+
+        // cut the block into segments, whatever is after the last split waits for the next block unless this is the end
+        segments.clear();
+        size_t begin = 0;
+        while (begin < block.size()) {
+            size_t split = std::string_view::npos;
+            if (begin + segment_bytes < block.size()) {
+                split = find_split(block, std::max(begin + segment_bytes, search_from));
+                if (split == std::string_view::npos) {
+                    // the last byte can't be checked until what follows it has been read
+                    search_from = block.size() - 1;
+                }
+                if (split == std::string_view::npos && block.size() - begin >= fallback_bytes) {
+                    split = find_chunk_split(std::string_view(block).substr(begin), segment_bytes);
+                    fallback_bytes = split == std::string_view::npos ? 2 * (block.size() - begin) : 2 * segment_bytes;
+                    if (split != std::string_view::npos) {
+                        split += begin;
+                    }
+                }
+            }
+            if (split == std::string_view::npos) {
+                if (!at_end) {
+                    break;
+                }
+                split = block.size();
+            }
+            segments.push_back(std::string_view(block).substr(begin, split - begin));
+            begin = split;
+        }
+
+        if (segment_tokens.size() < segments.size()) {
+            segment_tokens.resize(segments.size());
+        }
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+        for (size_t s = 0; s < segments.size(); ++s) {
+            segment_tokens[s].clear();
+            tokenizer.tokenize(segments[s], segment_tokens[s]);
+        }
+
+        for (size_t s = 0; s < segments.size(); ++s) {
+            encoded.assign(segment_tokens[s].begin(), segment_tokens[s].end());
+            output.write(reinterpret_cast<const char*>(encoded.data()), encoded.size() * sizeof(uint16_t));
+            stats.tokens += encoded.size();
+        }
+
+        block.erase(0, begin);
+        search_from = search_from > begin ? search_from - begin : 0;
+    }
+
+    if (!output) {
+        die("Failed to write the tokens");
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+batch_tokenization_stats_t batch_tokenizer_t::tokenize_file(const string_t& input_path, const string_t& output_path) const
+{
+    std::ifstream input(input_path, std::ios::binary);
+    if (!input) {
+        die("Cannot open " + input_path);
+    }
+    std::ofstream output(output_path, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        die("Cannot open " + output_path + " for writing");
+    }
+
+    batch_tokenization_stats_t stats = tokenize(input, output);
+    output.close();
+    if (!output) {
+        die("Failed to write " + output_path);
+    }
+    return stats;
+}
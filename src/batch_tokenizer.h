@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <string_view>
+#include "tokenizer.h"
+#include "types/basic_types.h"
+
+struct batch_tokenization_stats_t {
+    size_t bytes = 0;
+    size_t tokens = 0;
+    double seconds = 0;
+
+    double megabytes_per_second() const { return seconds > 0 ? bytes / 1e6 / seconds : 0.0; }
+};
+
+// Tokenizes inputs far bigger than memory, e.g. a training corpus, streaming them through a block at a time
+// Each block is cut into segments at safe points (see find_split) and the segments are tokenized in parallel, all
+// sharing the one tokenizer and its BPE cache. The tokens are written out in input order as uint16 values, which is
+// enough for the GPT-2 vocabulary and half the size of an int. Text without those split points, e.g. CJK or minified
+// data, is cut at pre-tokenizer chunk ends instead once more than two segments' worth has piled up, so memory stays
+// at the current block plus that, unless a single chunk is longer still (it can't be cut without changing its tokens).
+class batch_tokenizer_t {
+private:
+
+    const tokenizer_t& tokenizer;
+    size_t segment_bytes;
+    int num_threads;
+
+public:
+
+    // segment_bytes is roughly how much text each task gets, a block is that times the number of threads
+    // num_threads 0 uses as many as OpenMP would
+    explicit batch_tokenizer_t(const tokenizer_t& tokenizer, size_t segment_bytes = 1 << 20, int num_threads = 0);
+
+    // tokenize everything left in input, writing the tokens to output as native (little-endian on x86) uint16 values
+    // the tokens are the same as tokenizing the whole input in one go
+    batch_tokenization_stats_t tokenize(std::istream& input, std::ostream& output) const;
+
+    // same, from one file to another
+    batch_tokenization_stats_t tokenize_file(const string_t& input_path, const string_t& output_path) const;
+
+    // the first position at or after from where text can be cut in two, with the halves tokenizing to the same tokens as
+    // the whole, or npos if there isn't one
+    // A safe cut is just before a space that sits between two ASCII characters which aren't whitespace, e.g. between
+    // "the" and " cat": the pre-tokenizer always ends a chunk there, and nothing before it looks past the space.
+    static size_t find_split(std::string_view text, size_t from);
+
+    // the first pre-tokenizer chunk end at or after from where text can be cut in two, or npos if there isn't one
+    // Slower than find_split since it has to scan the text from the start, which must itself be a chunk boundary, but
+    // there's one after most chunks. The scan only ever looks forward from where a chunk starts, and any chunk but a
+    // run of whitespace ends where it does because of the one character after it, so the end of such a chunk is safe
+    // as long as that character is there. Whitespace runs look further ahead and are never cut after.
+    static size_t find_chunk_split(std::string_view text, size_t from);
+};
@@ -0,0 +1,87 @@
+#include "bpe_cache.h"
+#include <functional>
+
+bpe_cache_t::bpe_cache_t(size_t capacity) : shards(new shard_t[num_shards]), capacity(capacity)
+{
+    // the shards split the capacity between them, the first few taking the remainder
+    for (size_t s = 0; s < num_shards; ++s) {
+        shards[s].capacity = capacity / num_shards + (s < capacity % num_shards ? 1 : 0);
+    }
+}
+
+bpe_cache_t::shard_t& bpe_cache_t::shard_for(std::string_view chunk) const
+{
+    return shards[std::hash<std::string_view>()(chunk) % num_shards];
+}
+
+bool bpe_cache_t::lookup(std::string_view chunk, std::vector<int>& output)
+{
+    if (capacity == 0 || chunk.size() > max_chunk_bytes) {
+        return false;
+    }
+
+    shard_t& shard = shard_for(chunk);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(chunk);
+    if (it == shard.index.end()) {
+        ++shard.stats.misses;
+        return false;
+    }
+
+    ++shard.stats.hits;
+    // move it to the front of the LRU list, the iterators (and the key pointing into the chunk) stay valid
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    const std::vector<int>& tokens = it->second->tokens;
+    output.insert(output.end(), tokens.begin(), tokens.end());
+    return true;
+}
+
+void bpe_cache_t::insert(std::string_view chunk, const int* tokens, size_t count)
+{
+    if (chunk.size() > max_chunk_bytes) {
+        return;
+    }
+
+    shard_t& shard = shard_for(chunk);
+    if (shard.capacity == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // another thread may have got there first
+    if (shard.index.count(chunk)) {
+        return;
+    }
+
+    if (shard.entries.size() >= shard.capacity) {
+        shard.index.erase(shard.entries.back().chunk);
+        shard.entries.pop_back();
+        ++shard.stats.evictions;
+    }
+
+    shard.entries.push_front({string_t(chunk), std::vector<int>(tokens, tokens + count)});
+    shard.index.emplace(shard.entries.front().chunk, shard.entries.begin());
+}
+
+void bpe_cache_t::clear()
+{
+    for (size_t s = 0; s < num_shards; ++s) {
+        std::lock_guard<std::mutex> lock(shards[s].mutex);
+        shards[s].index.clear();
+        shards[s].entries.clear();
+    }
+}
+
+bpe_cache_stats_t bpe_cache_t::get_stats() const
+{
+    bpe_cache_stats_t total;
+    for (size_t s = 0; s < num_shards; ++s) {
+        std::lock_guard<std::mutex> lock(shards[s].mutex);
+        total.hits += shards[s].stats.hits;
+        total.misses += shards[s].stats.misses;
+        total.evictions += shards[s].stats.evictions;
+        total.entries += shards[s].entries.size();
+    }
+    return total;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "types/basic_types.h"
+
+struct bpe_cache_stats_t {
+    long hits = 0;
+    long misses = 0;
+    long evictions = 0;
+    // chunks currently held
+    long entries = 0;
+
+    double hit_rate() const { return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses); }
+};
+
+// Cache of BPE results for pre-tokenized chunks of text
+// Natural text keeps repeating the same words, so most chunks have been through BPE before. The cache maps a chunk's
+// raw bytes (which map one to one onto its byte-encoded form) to the tokens BPE produced for it.
+// It's bounded to capacity chunks, evicting the least recently used, and chunks longer than max_chunk_bytes aren't
+// cached at all since they rarely repeat. The entries are split over shards by hash, each with its own lock and LRU
+// list, so threads tokenizing side by side rarely wait on each other.
+class bpe_cache_t {
+private:
+
+    struct entry_t {
+        string_t chunk;
+        std::vector<int> tokens;
+    };
+
+    struct shard_t {
+        std::mutex mutex;
+        // most recently used first
+        std::list<entry_t> entries;
+        // keys point into the chunks held by the entries
+        std::unordered_map<std::string_view, std::list<entry_t>::iterator> index;
+        size_t capacity = 0;
+        bpe_cache_stats_t stats;
+    };
+
+    std::unique_ptr<shard_t[]> shards;
+    size_t capacity;
+
+    shard_t& shard_for(std::string_view chunk) const;
+
+public:
+
+    static constexpr size_t num_shards = 16;
+    static constexpr size_t max_chunk_bytes = 64;
+
+    // room for capacity chunks in total, 0 turns the cache off
+    explicit bpe_cache_t(size_t capacity);
+
+    bpe_cache_t(const bpe_cache_t&) = delete;
+    bpe_cache_t& operator=(const bpe_cache_t&) = delete;
+
+    // appends the cached tokens for chunk to output and returns true, or returns false if it isn't cached
+    bool lookup(std::string_view chunk, std::vector<int>& output);
+
+    // remember the count tokens BPE produced for chunk
+    void insert(std::string_view chunk, const int* tokens, size_t count);
+
+    // drop every entry, keeping the statistics
+    void clear();
+
+    size_t get_capacity() const { return capacity; }
+
+    // summed over the shards
+    bpe_cache_stats_t get_stats() const;
+};
@@ -1,4 +1,9 @@
 #include <Eigen/Dense>
 
 using Eigen::MatrixXf;
-using Eigen::VectorXf;
\ No newline at end of file
+using Eigen::VectorXf;
+
+// Activations (and the keys and values cached from them) are row-major, shape: [tokens, features]
+// Nearly everything done to them works a token at a time: the embedding lookup, layer norm, bias adds, the softmax
+// and slicing out a head's columns, so each token's features are kept contiguous. Weights stay column-major.
+using activation_matrix_t = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
@@ -1,7 +1,58 @@
 #include "gpt2.h"
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
 #include "load_h5.h"
+#include "weight_file.h"
 
-gpt2_weights_t load_gpt2_weights(const string_t& h5_file_path)
+namespace {
+
+// name of one of a layer's tensors in the native weight file
+string_t layer_tensor(int layer, const string_t& name)
+{
+    return "h." + std::to_string(layer) + "." + name;
+}
+
+// call f(name, handle) for every tensor of layer i, with the names used by the native weight file
+template <typename F>
+void for_each_layer_tensor(gpt2_layer_t& layer, int i, F f)
+{
+    f(layer_tensor(i, "attn.c_attn.weight"), layer.attn_c_attn_weight);
+    f(layer_tensor(i, "attn.c_attn.bias"), layer.attn_c_attn_bias);
+    f(layer_tensor(i, "attn.c_proj.weight"), layer.attn_c_proj_weight);
+    f(layer_tensor(i, "attn.c_proj.bias"), layer.attn_c_proj_bias);
+    f(layer_tensor(i, "mlp.c_fc.weight"), layer.mlp_c_fc_weight);
+    f(layer_tensor(i, "mlp.c_fc.bias"), layer.mlp_c_fc_bias);
+    f(layer_tensor(i, "mlp.c_proj.weight"), layer.mlp_c_proj_weight);
+    f(layer_tensor(i, "mlp.c_proj.bias"), layer.mlp_c_proj_bias);
+    f(layer_tensor(i, "ln_1.weight"), layer.ln_1_weight);
+    f(layer_tensor(i, "ln_1.bias"), layer.ln_1_bias);
+    f(layer_tensor(i, "ln_2.weight"), layer.ln_2_weight);
+    f(layer_tensor(i, "ln_2.bias"), layer.ln_2_bias);
+}
+
+// call f(name, handle) for every tensor of the model
+template <typename F>
+void for_each_tensor(gpt2_weights_t& weights, F f)
+{
+    f("wte", weights.token_embedding);
+    f("wpe", weights.position_embedding);
+
+    for (size_t i = 0; i < weights.layers.size(); ++i) {
+        for_each_layer_tensor(weights.layers[i], i, f);
+    }
+
+    f("ln_f.weight", weights.ln_f_weight);
+    f("ln_f.bias", weights.ln_f_bias);
+}
+
+decoder_layer_weights_t decoder_layer_weights(const gpt2_layer_t& layer)
+{
+    return {layer.attn_c_attn_weight, layer.attn_c_attn_bias, layer.attn_c_proj_weight, layer.attn_c_proj_bias, layer.ln_1_weight, layer.ln_1_bias,
+            layer.mlp_c_fc_weight,    layer.mlp_c_fc_bias,    layer.mlp_c_proj_weight,  layer.mlp_c_proj_bias,  layer.ln_2_weight, layer.ln_2_bias};
+}
+
+gpt2_weights_t load_gpt2_weights_h5(const string_t& h5_file_path)
 {
     gpt2_weights_t weights;
     H5::H5File file(h5_file_path, H5F_ACC_RDONLY);
@@ -31,10 +82,10 @@ gpt2_weights_t load_gpt2_weights(const string_t& h5_file_path)
         // print_vector_info(layer.attn_c_attn_bias, "Attention Bias");
         // print_vector_info(layer.attn_c_proj_bias, "Attention Projection Bias");
 
-        // MLP weights
-        layer.mlp_c_fc_weight = read_matrix_from_h5(file, layer_path + "mlp/c_fc/weight:0");
+        // MLP weights, transposed into the layout feed_forward_t uses
+        layer.mlp_c_fc_weight = read_matrix_from_h5(file, layer_path + "mlp/c_fc/weight:0").transpose();
         layer.mlp_c_fc_bias = read_vector_from_h5(file, layer_path + "mlp/c_fc/bias:0");
-        layer.mlp_c_proj_weight = read_matrix_from_h5(file, layer_path + "mlp/c_proj/weight:0");
+        layer.mlp_c_proj_weight = read_matrix_from_h5(file, layer_path + "mlp/c_proj/weight:0").transpose();
         layer.mlp_c_proj_bias = read_vector_from_h5(file, layer_path + "mlp/c_proj/bias:0");
 
         // Layer normalization weights
@@ -53,76 +104,405 @@ gpt2_weights_t load_gpt2_weights(const string_t& h5_file_path)
     return weights;
 }
 
+gpt2_weights_t load_gpt2_weights_native(const string_t& weights_path)
+{
+    // every handle keeps the mapping alive, it's unmapped once the last of them goes
+    auto file = std::make_shared<const weight_file_t>(weights_path);
+
+    gpt2_weights_t weights;
+    weights.layers.resize(12);
+    for_each_tensor(weights, [&file](const string_t& name, auto& tensor) {
+        weight_matrix_view_t view = file->matrix(name);
+        tensor = std::decay_t<decltype(tensor)>(file, view.data(), view.rows(), view.cols());
+    });
+
+    return weights;
+}
+
+}  // namespace
+
+gpt2_weights_t load_gpt2_weights(const string_t& weights_path)
+{
+    if (weight_file_t::is_weight_file(weights_path)) {
+        return load_gpt2_weights_native(weights_path);
+    }
+    return load_gpt2_weights_h5(weights_path);
+}
+
+void convert_gpt2_weights(const string_t& h5_file_path, const string_t& output_path)
+{
+    gpt2_weights_t weights = load_gpt2_weights_h5(h5_file_path);
+
+    weight_file_writer_t writer(output_path);
+    for_each_tensor(weights, [&writer](const string_t& name, const auto& tensor) { writer.add(name, *tensor); });
+    writer.finish();
+}
+
+tokenizer_t load_gpt2_tokenizer()
+{
+    if (tokenizer_file_t::is_tokenizer_file(gpt2_t::compiled_tokenizer_path)) {
+        return tokenizer_t(gpt2_t::compiled_tokenizer_path);
+    }
+    return tokenizer_t(gpt2_t::vocab_path, gpt2_t::merges_path);
+}
+
 void gpt2_t::init()
 {
-    weights = load_gpt2_weights("gpt2/tf_model.h5");
+    // the native format is mapped in place rather than parsed, so use it whenever it has been converted
+    init(weight_file_t::is_weight_file(native_weights_path) ? native_weights_path : h5_weights_path);
+}
 
-    for (int i = 0; i < num_layers; ++i) {
+void gpt2_t::init(const string_t& weights_path)
+{
+    weights = load_gpt2_weights(weights_path);
+    this->weights_path = weights_path;
+    check_weight_shapes(weights, weights_path);
 
-        // Set weights and biases
-        transformer.set_layer_weights(i, weights.layers[i].attn_c_attn_weight, weights.layers[i].attn_c_attn_bias,
-                                      weights.layers[i].attn_c_proj_weight, weights.layers[i].attn_c_proj_bias, weights.layers[i].ln_1_weight,
-                                      weights.layers[i].ln_1_bias, weights.layers[i].mlp_c_fc_weight.transpose(), weights.layers[i].mlp_c_fc_bias,
-                                      weights.layers[i].mlp_c_proj_weight.transpose(), weights.layers[i].mlp_c_proj_bias,
-                                      weights.layers[i].ln_2_weight, weights.layers[i].ln_2_bias);
+    // the layers are built around the loaded tensors, sharing them with weights rather than copying
+    std::vector<decoder_layer_weights_t> layer_weights;
+    for (const gpt2_layer_t& layer : weights.layers) {
+        layer_weights.push_back(decoder_layer_weights(layer));
+    }
+    if (static_cast<int>(layer_weights.size()) != num_layers) {
+        die("Expected weights for " + std::to_string(num_layers) + " layers, got " + std::to_string(layer_weights.size()));
     }
+    transformer = transformer_t(num_heads, layer_weights);
 
-    final_norm_layer.setGammaBeta(weights.ln_f_weight, weights.ln_f_bias);
+    final_norm_layer = norm_layer_t(weights.ln_f_weight, weights.ln_f_bias, 1e-5);
+    lm_head.set_weights(weights.token_embedding);
+}
+
+void gpt2_t::check_weight_shapes(gpt2_weights_t& weights, const string_t& source)
+{
+    // rows and cols of each tensor in the layout the model uses, by its name in the native weight file
+    std::unordered_map<string_t, std::pair<Eigen::Index, Eigen::Index>> shapes = {
+        {"wte", {vocab_size, d_model}},
+        {"wpe", {max_seq_len, d_model}},
+        {"attn.c_attn.weight", {d_model, 3 * d_model}},
+        {"attn.c_attn.bias", {3 * d_model, 1}},
+        {"attn.c_proj.weight", {d_model, d_model}},
+        {"attn.c_proj.bias", {d_model, 1}},
+        {"mlp.c_fc.weight", {d_ff, d_model}},
+        {"mlp.c_fc.bias", {d_ff, 1}},
+        {"mlp.c_proj.weight", {d_model, d_ff}},
+        {"mlp.c_proj.bias", {d_model, 1}},
+        {"ln_1.weight", {d_model, 1}},
+        {"ln_1.bias", {d_model, 1}},
+        {"ln_2.weight", {d_model, 1}},
+        {"ln_2.bias", {d_model, 1}},
+        {"ln_f.weight", {d_model, 1}},
+        {"ln_f.bias", {d_model, 1}},
+    };
+
+    for_each_tensor(weights, [&](const string_t& name, const auto& tensor) {
+        // a layer's tensors are all named h.<layer>.<tensor>
+        string_t key = name.rfind("h.", 0) == 0 ? name.substr(name.find('.', 2) + 1) : name;
+        auto [rows, cols] = shapes.at(key);
+        if (tensor.rows() != rows || tensor.cols() != cols) {
+            die(source + ": " + name + " is " + std::to_string(tensor.rows()) + " x " + std::to_string(tensor.cols()) + ", GPT-2 needs " +
+                std::to_string(rows) + " x " + std::to_string(cols));
+        }
+    });
+}
+
+void gpt2_t::enable_layer_streaming(size_t memory_budget)
+{
+    if (!weight_file_t::is_weight_file(weights_path)) {
+        die("Layer streaming needs a native weight file, convert the checkpoint with --convert_weights");
+    }
+    if (quantization != quantization_t::none) {
+        die("Layer streaming only works with fp32 weights");
+    }
+
+    // a mapping of its own, whose pages are handed back as soon as each layer has been copied out of them
+    auto file = std::make_shared<const weight_file_t>(weights_path);
+
+    layer_source_t source;
+    source.load = [file](int i) {
+        gpt2_layer_t layer;
+        for_each_layer_tensor(layer, i, [&file](const string_t& name, auto& tensor) {
+            // an owned copy, so the layer's memory is really freed when it's evicted
+            tensor = std::decay_t<decltype(tensor)>(file->matrix(name));
+            file->release(name);
+        });
+        return decoder_layer_weights(layer);
+    };
+    source.bytes = [file](int i) {
+        gpt2_layer_t layer;
+        size_t bytes = 0;
+        for_each_layer_tensor(layer, i, [&file, &bytes](const string_t& name, auto&) { bytes += file->matrix(name).size() * sizeof(float); });
+        return bytes;
+    };
+
+    transformer.enable_streaming(num_heads, memory_budget, std::move(source));
+
+    // only the embeddings and the final norm are kept resident, the handles on the layers were all that kept them alive
+    for (gpt2_layer_t& layer : weights.layers) {
+        layer = gpt2_layer_t();
+    }
+}
+
+void gpt2_t::quantize(quantization_t mode)
+{
+    if (mode == quantization) {
+        return;
+    }
+    if (quantization != quantization_t::none) {
+        die("The model is already quantized");
+    }
+
+    transformer.quantize_int8();
+    // the token embeddings are still needed in fp32 for the embedding lookup
+    lm_head.quantize_int8();
+    quantization = mode;
 }
 
 Eigen::MatrixXf gpt2_t::forward(string_t input_string)
 {
     // get the token ids for this string from the tokenizer
-    std::vector<int> tokens = tokenizer.tokenize(input_string);
+    return forward(tokenizer.tokenize(input_string));
+}
+
+Eigen::MatrixXf gpt2_t::forward(const std::vector<int>& tokens)
+{
+    return forward_batch({tokens});
+}
+
+Eigen::MatrixXf gpt2_t::forward_step(const std::vector<int>& tokens, gpt2_session_t& session)
+{
+    return forward_batch({tokens}, {&session});
+}
+
+Eigen::MatrixXf gpt2_t::forward_batch(const std::vector<std::vector<int>>& tokens, const std::vector<gpt2_session_t*>& sessions)
+{
+    return logits(hidden_states(tokens, sessions));
+}
+
+Eigen::MatrixXf gpt2_t::forward_last(const std::vector<std::vector<int>>& tokens, const std::vector<gpt2_session_t*>& sessions)
+{
+    return lm_head.forward_transposed(last_hidden_states(hidden_states(tokens, sessions), tokens));
+}
+
+std::vector<std::vector<token_logit_t>> gpt2_t::forward_top_k(const std::vector<std::vector<int>>& tokens,
+                                                              const std::vector<gpt2_session_t*>& sessions, int k)
+{
+    return lm_head.top_k(last_hidden_states(hidden_states(tokens, sessions), tokens), k);
+}
+
+Eigen::MatrixXf gpt2_t::forward_draft(const std::vector<int>& tokens, gpt2_session_t& session, int draft_layers)
+{
+    return lm_head.forward_transposed(last_hidden_states(hidden_states({tokens}, {&session}, draft_layers), {tokens}));
+}
 
+scratch_buffer_t::matrix_map_t gpt2_t::hidden_states(const std::vector<std::vector<int>>& tokens, const std::vector<gpt2_session_t*>& sessions,
+                                                     int layers_to_run)
+{
+    if (!sessions.empty() && sessions.size() != tokens.size()) {
+        die("Batched forward needs one session per sequence");
+    }
+
+    std::vector<int> lengths;
+    for (const std::vector<int>& seq_tokens : tokens) {
+        lengths.push_back(seq_tokens.size());
+    }
+    sequence_batch_t batch(lengths);
+
+    // the embeddings go straight into the workspace, and the transformer then works on them in place
+    workspace_t& workspace = sessions.size() == 1 ? sessions[0]->workspace : batch_workspace;
+    auto hidden = workspace.matrix(workspace_t::hidden, batch.total_rows(), d_model);
+
+    // embed every sequence into its rows of the packed matrix, continuing on from the session if there is one
+    std::vector<kv_cache_t*> caches;
+    for (int s = 0; s < batch.size(); ++s) {
+        int position_offset = sessions.empty() ? 0 : sessions[s]->size();
+        embed(tokens[s], position_offset, hidden.middleRows(batch.offset(s), batch.length(s)));
+
+        if (!sessions.empty()) {
+            caches.push_back(&sessions[s]->cache);
+        }
+    }
+
+    // the token embedding matrix is now ready to be passed to the transformer
+    transformer.forward_in_place(hidden, batch, caches, layers_to_run, workspace);
+
+    for (size_t s = 0; s < sessions.size(); ++s) {
+        sessions[s]->tokens.insert(sessions[s]->tokens.end(), tokens[s].begin(), tokens[s].end());
+    }
+
+    return hidden;
+}
+
+activation_matrix_t gpt2_t::last_hidden_states(const Eigen::Ref<const activation_matrix_t>& hidden, const std::vector<std::vector<int>>& tokens)
+{
+    activation_matrix_t last_rows(tokens.size(), d_model);
+    int row = 0;
+    for (size_t s = 0; s < tokens.size(); ++s) {
+        row += tokens[s].size();
+        last_rows.row(s) = hidden.row(row - 1);
+    }
+
+    final_norm_layer.forward(last_rows, last_rows);
+    return last_rows;
+}
+
+void gpt2_t::embed(const std::vector<int>& tokens, int position_offset, Eigen::Ref<activation_matrix_t> embedding_matrix)
+{
     // check this doesn't exceed the maximum sequence length (1024 for GPT2)
-    if (tokens.size() > max_seq_len) {
+    if (position_offset + static_cast<int>(tokens.size()) > max_seq_len) {
         die("Input token sequence is too long");
     }
 
-    // Initialise the embedded tokens matrix with the right size for this set of tokens
-    Eigen::MatrixXf embedding_matrix = Eigen::MatrixXf::Zero(tokens.size(), d_model);
-
     for (size_t i = 0; i < tokens.size(); ++i) {
         // Check if the token ID is within the valid range
         if (tokens[i] >= 0 && tokens[i] < weights.token_embedding.rows()) {
             // for token embedding, take the row corresponding to the token ID
-            embedding_matrix.row(i) = weights.token_embedding.row(tokens[i]);
+            embedding_matrix.row(i) = (*weights.token_embedding).row(tokens[i]);
             // for the position embedding, take the row corresponding to the position
             // and add that to the token embedding
-            embedding_matrix.row(i) += weights.position_embedding.row(i);
+            embedding_matrix.row(i) += (*weights.position_embedding).row(position_offset + i);
         } else {
             die("Invalid token ID: " + std::to_string(tokens[i]));
         }
     }
+}
 
-    // the token embedding matrix is now ready to be passed to the transformer
-    Eigen::MatrixXf transformer_output = transformer.forward(embedding_matrix);
-
+Eigen::MatrixXf gpt2_t::logits(const Eigen::Ref<const activation_matrix_t>& transformer_output)
+{
     // pass the transformer output through the final layer normalization
-    MatrixXf norm_final_output = final_norm_layer.forward(transformer_output);
+    activation_matrix_t norm_final_output(transformer_output.rows(), transformer_output.cols());
+    final_norm_layer.forward(transformer_output, norm_final_output);
 
     // get the logits by multiplying the final output by the token embedding matrix
-    MatrixXf logits = norm_final_output * weights.token_embedding.transpose();
+    return lm_head.forward(norm_final_output);
+}
+
+generation_result_t gpt2_t::generate(const std::vector<int>& prompt, const generation_params_t& params, const token_callback_t& on_token)
+{
+    using clock = std::chrono::steady_clock;
+    auto elapsed_ms = [](clock::time_point from) { return std::chrono::duration<double, std::milli>(clock::now() - from).count(); };
+
+    if (prompt.empty()) {
+        die("Cannot generate from an empty prompt");
+    }
+
+    generation_result_t result;
+    generation_stats_t& stats = result.stats;
+    stats.prompt_tokens = prompt.size();
+
+    gpt2_session_t session = create_session();
+    sampler_t sampler(params.sampling, prompt);
+
+    auto start = clock::now();
+    auto token_start = start;
+
+    // skip over any part of the prompt that's already in the prefix cache
+    stats.cached_prompt_tokens = attach_cached_prefix(prompt, session);
+
+    // the first step prefills the rest of the prompt, every step after that only feeds the previous token
+    std::vector<int> next_input(prompt.begin() + stats.cached_prompt_tokens, prompt.end());
+    bool prefilled = false;
+
+    while (static_cast<int>(result.tokens.size()) < params.max_new_tokens && session.size() + static_cast<int>(next_input.size()) <= max_seq_len) {
+        int token;
+        if (params.sampling.is_greedy()) {
+            // greedy decoding, the most likely token is just the one with the largest logit
+            // and only that is needed, so the lm head picks it out without building the logits
+            token = forward_top_k({next_input}, {&session}, 1)[0][0].token;
+        } else {
+            MatrixXf step_logits = forward_last({next_input}, {&session});
+            token = sampler.sample(step_logits.data(), step_logits.rows());
+        }
+        sampler.accept(token);
 
-    return logits;
+        // share the prompt with other requests as soon as it's been prefilled
+        if (!prefilled) {
+            cache_prefix(session);
+            prefilled = true;
+        }
+
+        if (params.is_stop_token(token)) {
+            break;
+        }
+
+        stats.token_latencies_ms.push_back(elapsed_ms(token_start));
+
+        result.tokens.push_back(token);
+        if (on_token) {
+            on_token(token);
+        }
+
+        // start timing the next token after the callback, so slow consumers don't show up as model latency
+        token_start = clock::now();
+
+        next_input = {token};
+    }
+
+    // and the generated tokens too, so a follow up request that extends this conversation can reuse everything
+    cache_prefix(session);
+
+    stats.finish(elapsed_ms(start));
+
+    return result;
 }
 
-string_t gpt2_t::get_next_max_like_token(MatrixXf& logits)
+int gpt2_t::attach_cached_prefix(const std::vector<int>& tokens, gpt2_session_t& session)
 {
-    // we only want to predict the next token after the input sequence
-    // so we take the last row of the logits matrix
-    Eigen::VectorXf last_token_logits = logits.row(logits.rows() - 1);
+    if (!prefix_cache || session.size() != 0) {
+        return 0;
+    }
+
+    int cached_tokens = prefix_cache->lookup(tokens, session.cache);
+    session.tokens.assign(tokens.begin(), tokens.begin() + cached_tokens);
 
-    // convert these logits to probabilities using softmax
-    Eigen::VectorXf probabilities = softmax(last_token_logits);
+    return cached_tokens;
+}
+
+void gpt2_t::cache_prefix(const gpt2_session_t& session)
+{
+    if (prefix_cache) {
+        prefix_cache->insert(session.tokens, session.cache);
+    }
+}
 
-    // in this function we just want to return the token with the highest probability
-    // so we find the index of the maximum probability and return the token corresponding to that index
+int gpt2_t::max_like_token_id(const MatrixXf& logits, int row)
+{
     Eigen::Index max_index;
-    probabilities.maxCoeff(&max_index);
-    // cast the Index type to an integer
-    int max_prob_token_id = static_cast<int>(max_index);
+    logits.row(row).maxCoeff(&max_index);
+    return static_cast<int>(max_index);
+}
+
+bool generation_params_t::is_stop_token(int token) const
+{
+    if (stop_at_eos && token == gpt2_t::eos_token) {
+        return true;
+    }
+    return std::find(stop_tokens.begin(), stop_tokens.end(), token) != stop_tokens.end();
+}
+
+void generation_stats_t::finish(double total_elapsed_ms)
+{
+    generated_tokens = token_latencies_ms.size();
+    total_ms = total_elapsed_ms;
+    if (!token_latencies_ms.empty()) {
+        time_to_first_token_ms = token_latencies_ms.front();
+    }
+
+    // measure throughput over the decode steps only, the first latency also covers the prompt prefill
+    double decode_ms = 0;
+    for (size_t i = 1; i < token_latencies_ms.size(); ++i) {
+        decode_ms += token_latencies_ms[i];
+    }
+    if (decode_ms > 0) {
+        tokens_per_second = (generated_tokens - 1) / (decode_ms / 1000.0);
+    }
+}
+
+string_t gpt2_t::get_next_max_like_token(MatrixXf& logits)
+{
+    // we only want to predict the next token after the input sequence
+    // so we take the last row of the logits matrix
+    // softmax doesn't change the order of the logits, so the most likely token is just the largest logit
+    int max_prob_token_id = max_like_token_id(logits, logits.rows() - 1);
 
     // finally we detokenize the token ID to get the actual token
     string_t token = tokenizer.detokenize(max_prob_token_id);
@@ -1,39 +1,114 @@
 #pragma once
+#include <functional>
+#include <memory>
 #include "eigen_config.h"
 #include "load_h5.h"
+#include "sampler.h"
 #include "tokenizer.h"
+#include "transformer/kv_cache.h"
+#include "transformer/lm_head.h"
 #include "transformer/norm_layer.h"
+#include "transformer/prefix_cache.h"
+#include "transformer/quantized_matrix.h"
+#include "transformer/shared_weight.h"
 #include "transformer/transformer.h"
 
+// The model's tensors, each one stored exactly once
+// These are handles on either loaded matrices or a mapped native weight file, and the layers are given handles too,
+// so copying the struct (or setting up the layers from it) never copies a tensor.
+// The feed-forward weights are kept transposed from how the checkpoint stores them, in the layout feed_forward_t uses.
 struct gpt2_layer_t {
     // Attention weights
-    Eigen::MatrixXf attn_c_attn_weight;
-    Eigen::VectorXf attn_c_attn_bias;
-    Eigen::MatrixXf attn_c_proj_weight;
-    Eigen::VectorXf attn_c_proj_bias;
+    weight_matrix_t attn_c_attn_weight;
+    weight_vector_t attn_c_attn_bias;
+    weight_matrix_t attn_c_proj_weight;
+    weight_vector_t attn_c_proj_bias;
 
     // MLP weights
-    Eigen::MatrixXf mlp_c_fc_weight;
-    Eigen::VectorXf mlp_c_fc_bias;
-    Eigen::MatrixXf mlp_c_proj_weight;
-    Eigen::VectorXf mlp_c_proj_bias;
+    weight_matrix_t mlp_c_fc_weight;
+    weight_vector_t mlp_c_fc_bias;
+    weight_matrix_t mlp_c_proj_weight;
+    weight_vector_t mlp_c_proj_bias;
 
     // Layer normalization weights
-    Eigen::VectorXf ln_1_weight;
-    Eigen::VectorXf ln_1_bias;
-    Eigen::VectorXf ln_2_weight;
-    Eigen::VectorXf ln_2_bias;
+    weight_vector_t ln_1_weight;
+    weight_vector_t ln_1_bias;
+    weight_vector_t ln_2_weight;
+    weight_vector_t ln_2_bias;
 };
 
 struct gpt2_weights_t {
-    Eigen::MatrixXf token_embedding;
-    Eigen::MatrixXf position_embedding;
+    weight_matrix_t token_embedding;
+    weight_matrix_t position_embedding;
 
     std::vector<gpt2_layer_t> layers;
-    Eigen::VectorXf ln_f_weight;
-    Eigen::VectorXf ln_f_bias;
+    weight_vector_t ln_f_weight;
+    weight_vector_t ln_f_bias;
 };
 
+// maps the compiled tokenizer if there is one, otherwise compiles it from vocab.json and merges.txt
+tokenizer_t load_gpt2_tokenizer();
+
+// State for a single sequence being decoded incrementally
+// The session owns the key/value cache, so each new token only needs its own row pushed through the model
+struct gpt2_session_t {
+    kv_cache_t cache;
+    // every token that has been fed through the model so far
+    std::vector<int> tokens;
+    // scratch memory for this session's forward passes, after the first decode step they don't allocate
+    workspace_t workspace;
+
+    gpt2_session_t(kv_block_pool_t& pool) : cache(pool) {}
+
+    // number of positions processed, this is also the position of the next token
+    int size() const { return cache.size(); }
+
+    // forget everything after the first length tokens, e.g. draft tokens that were rejected
+    void truncate(int length)
+    {
+        cache.truncate(length);
+        tokens.resize(length);
+    }
+};
+
+struct generation_params_t {
+    // maximum number of tokens to generate after the prompt
+    int max_new_tokens = 32;
+    // generation stops as soon as any of these tokens is produced, the stop token itself is not emitted
+    std::vector<int> stop_tokens;
+    // also stop on the end of text token
+    bool stop_at_eos = true;
+    // how each token is picked, greedy unless a temperature is set
+    sampling_params_t sampling;
+
+    bool is_stop_token(int token) const;
+};
+
+struct generation_stats_t {
+    int prompt_tokens = 0;
+    // prompt tokens whose keys and values came from the prefix cache rather than being prefilled
+    int cached_prompt_tokens = 0;
+    int generated_tokens = 0;
+    // time from the start of the call until the first new token was available, this includes the prompt prefill
+    double time_to_first_token_ms = 0;
+    // time taken to produce each generated token
+    std::vector<double> token_latencies_ms;
+    double total_ms = 0;
+    // decode throughput, measured over the tokens after the first so the prefill doesn't skew it
+    double tokens_per_second = 0;
+
+    // fill in the summary fields from the recorded token latencies
+    void finish(double total_elapsed_ms);
+};
+
+struct generation_result_t {
+    std::vector<int> tokens;
+    generation_stats_t stats;
+};
+
+// called with each new token as soon as it has been generated
+using token_callback_t = std::function<void(int token)>;
+
 class gpt2_t {
 private:
 
@@ -49,20 +124,151 @@ private:
     norm_layer_t final_norm_layer;
     gpt2_weights_t weights;
 
+    // projection onto the vocabulary, tied to the token embeddings
+    lm_head_t lm_head;
+    quantization_t quantization = quantization_t::none;
+    // where init loaded the weights from
+    string_t weights_path;
+
+    // every session's kv cache is paged out of this pool, so it has to outlive them
+    kv_block_pool_t kv_pool;
+
+    // optional cache of kv blocks for shared prompt prefixes, holds blocks from kv_pool
+    std::unique_ptr<prefix_cache_t> prefix_cache;
+
+    // scratch memory for batches of several sessions (or none), a single session brings its own
+    workspace_t batch_workspace;
+
+    // token + position embeddings for tokens starting at position_offset, written into output
+    void embed(const std::vector<int>& tokens, int position_offset, Eigen::Ref<activation_matrix_t> output);
+
+    // final layer norm followed by the projection back onto the vocabulary
+    Eigen::MatrixXf logits(const Eigen::Ref<const activation_matrix_t>& transformer_output);
+
+    // runs the packed sequences through the embeddings and the transformer, continuing on from the sessions if given
+    // returns the transformer output for every token, before the final layer norm
+    // only the first layers_to_run layers are used, which is less than num_layers when drafting
+    // the result lives in the workspace, so it's only valid until the next forward pass
+    scratch_buffer_t::matrix_map_t hidden_states(const std::vector<std::vector<int>>& tokens, const std::vector<gpt2_session_t*>& sessions,
+                                                 int layers_to_run = num_layers);
+
+    // final layer norm applied to just the last row of each sequence in the packed hidden states
+    activation_matrix_t last_hidden_states(const Eigen::Ref<const activation_matrix_t>& hidden, const std::vector<std::vector<int>>& tokens);
+
+    // dies unless every tensor loaded from source has the shape this model's layers index it with
+    static void check_weight_shapes(gpt2_weights_t& weights, const string_t& source);
+
 public:
 
+    // end of text token, GPT2 uses this to mark the boundary between documents
+    static constexpr int eos_token = 50256;
+
     gpt2_t()
-        : transformer(num_layers, d_model, num_heads, d_ff), tokenizer("gpt2/vocab.json", "gpt2/merges.txt"), final_norm_layer(d_model, 1e-5) {
+        : transformer(num_layers, d_model, num_heads, d_ff), tokenizer(load_gpt2_tokenizer()), final_norm_layer(d_model, 1e-5),
+          kv_pool(num_layers, d_model) {
 
           };
 
+    // where init() looks for the weights, the native file is used if it exists
+    static constexpr const char* h5_weights_path = "gpt2/tf_model.h5";
+    static constexpr const char* native_weights_path = "gpt2/model.weights";
+
+    // the tokenizer's vocabulary and merge rules
+    static constexpr const char* vocab_path = "gpt2/vocab.json";
+    static constexpr const char* merges_path = "gpt2/merges.txt";
+    // the same compiled into one file by --compile_tokenizer, used instead if it exists
+    static constexpr const char* compiled_tokenizer_path = "gpt2/tokenizer.bin";
+
     void init();
 
+    // load the weights from either a tf_model.h5 checkpoint or a native weight file, going by the file's contents
+    void init(const string_t& weights_path);
+
+    // switch the projections, the feed-forward networks and the lm head over to int8 weights
+    // must be called after init, the embeddings and layer norms stay in fp32
+    void quantize(quantization_t mode);
+
+    quantization_t get_quantization() const { return quantization; }
+
+    // stream the layers in from the native weight file as the forward pass reaches them, rather than keeping them all
+    // resident, holding at most memory_budget bytes of layers at a time. Each layer is loaded in the background while
+    // the one before it runs, see layer_streamer_t. Must be called after init (ideally before the first forward pass, so
+    // the resident layers' pages were never read in), and needs a native weight file
+    void enable_layer_streaming(size_t memory_budget);
+
+    // nullptr unless the layers are being streamed
+    const layer_streaming_stats_t* get_layer_streaming_stats() const { return transformer.get_streaming_stats(); }
+
     Eigen::MatrixXf forward(string_t input_string);
+    Eigen::MatrixXf forward(const std::vector<int>& tokens);
+
+    // create an empty session for incremental decoding
+    gpt2_session_t create_session() { return gpt2_session_t(kv_pool); }
+
+    kv_block_pool_t& get_kv_pool() { return kv_pool; }
+
+    // keep the kv blocks of up to max_blocks worth of prompt prefixes around, so later requests starting with the
+    // same tokens only need to prefill what is different
+    void enable_prefix_cache(int max_blocks) { prefix_cache = std::make_unique<prefix_cache_t>(kv_pool, max_blocks); }
+
+    // nullptr if the prefix cache isn't enabled
+    const prefix_cache_t* get_prefix_cache() const { return prefix_cache.get(); }
+
+    // start an empty session off with the longest cached prefix of tokens
+    // returns the number of tokens that are already in the session, only the rest need to be run through the model
+    int attach_cached_prefix(const std::vector<int>& tokens, gpt2_session_t& session);
+
+    // offer the session's keys and values to the prefix cache so later requests can reuse them
+    void cache_prefix(const gpt2_session_t& session);
 
-    gpt2_weights_t get_weights() { return weights; }
+    // incremental decoding: run only the new tokens, attending to everything already in the session's cache
+    // returns the logits for the new tokens, shape: [tokens.size(), vocab_size]
+    Eigen::MatrixXf forward_step(const std::vector<int>& tokens, gpt2_session_t& session);
+
+    // run several sequences of different lengths through the model in a single pass
+    // if sessions is not empty it holds one session per sequence, and each sequence's tokens continue on from that session
+    // returns the logits for every token, packed in the same order as the input, shape: [total tokens, vocab_size]
+    Eigen::MatrixXf forward_batch(const std::vector<std::vector<int>>& tokens, const std::vector<gpt2_session_t*>& sessions = {});
+
+    // same as forward_batch, but the final norm and lm head only run on the last token of each sequence,
+    // which is all that's needed to pick the next tokens
+    // each sequence's logits are a column so that they're contiguous for the sampler, shape: [vocab_size, tokens.size()]
+    Eigen::MatrixXf forward_last(const std::vector<std::vector<int>>& tokens, const std::vector<gpt2_session_t*>& sessions = {});
+
+    // a cheap draft of forward_last for a single sequence: only the first draft_layers layers run before the final norm
+    // and lm head. Those layers' cache entries are identical to the full model's, so the session just needs
+    // truncating back once the draft is done with. shape: [vocab_size, 1]
+    Eigen::MatrixXf forward_draft(const std::vector<int>& tokens, gpt2_session_t& session, int draft_layers);
+
+    // the k most likely next tokens after each sequence, best first
+    // the lm head is fused with the selection, so the vocab wide logits are never built
+    std::vector<std::vector<token_logit_t>> forward_top_k(const std::vector<std::vector<int>>& tokens, const std::vector<gpt2_session_t*>& sessions,
+                                                          int k);
+
+    // autoregressively extend the prompt one token at a time, picked as set by params.sampling, using a kv cache so that
+    // each step only pushes the newest token through the model
+    // on_token is invoked for every generated token so that output can be streamed
+    generation_result_t generate(const std::vector<int>& prompt, const generation_params_t& params, const token_callback_t& on_token = nullptr);
+
+    // index of the largest logit in the given row, i.e. the greedy choice of next token
+    static int max_like_token_id(const MatrixXf& logits, int row);
+
+    int get_max_seq_len() const { return max_seq_len; }
+
+    int get_num_layers() const { return num_layers; }
+
+    std::vector<int> tokenize(const string_t& text) { return tokenizer.tokenize(text); }
+
+    string_t decode(const std::vector<int>& tokens) { return tokenizer.decode(tokens); }
+
+    const gpt2_weights_t& get_weights() const { return weights; }
 
     string_t get_next_max_like_token(MatrixXf& logits);
 };
 
-gpt2_weights_t load_gpt2_weights(const string_t& h5_file_path);
+// loads either a tf_model.h5 checkpoint or a native weight file, going by the file's contents
+// a native file is mapped rather than read, and the weights point straight into the mapping
+gpt2_weights_t load_gpt2_weights(const string_t& weights_path);
+
+// one-time conversion of a tf_model.h5 checkpoint into the native weight format, see weight_file.h
+void convert_gpt2_weights(const string_t& h5_file_path, const string_t& output_path);
@@ -1,7 +1,11 @@
 #include <iostream>
 #include "argument_parser.h"
+#include "batch_tokenizer.h"
 #include "eigen_config.h"
-#include "transformer/transformer.h"
+#include "gpt2.h"
+#include "logger.h"
+#include "speculative.h"
+#include "utils.h"
 
 int main(int argc, char* argv[])
 {
@@ -14,24 +18,95 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    // Hyperparameters
-    int d_model = 512;   // Dimensionality of the model
-    int num_heads = 8;   // Number of attention heads
-    int d_ff = 2048;     // Dimensionality of feed-forward layer
-    int num_layers = 6;  // Number of encoder layers
-    int seq_len = 10;    // Sequence length
+    if (!args::convert_weights.empty()) {
+        convert_gpt2_weights(gpt2_t::h5_weights_path, args::convert_weights);
+        logger::log_info("wrote native weights to " + args::convert_weights + ", init() loads them from " + gpt2_t::native_weights_path);
+        return 0;
+    }
+
+    if (!args::compile_tokenizer.empty()) {
+        tokenizer_t(gpt2_t::vocab_path, gpt2_t::merges_path).save_compiled(args::compile_tokenizer);
+        logger::log_info("wrote the compiled tokenizer to " + args::compile_tokenizer + ", the model loads it from " + gpt2_t::compiled_tokenizer_path);
+        return 0;
+    }
+
+    if (!args::tokenize_file.empty()) {
+        string_t output_path = args::tokens_out.empty() ? args::tokenize_file + ".tokens" : args::tokens_out;
+        tokenizer_t tokenizer = load_gpt2_tokenizer();
+        batch_tokenization_stats_t stats = batch_tokenizer_t(tokenizer).tokenize_file(args::tokenize_file, output_path);
+        logger::log_info("wrote " + std::to_string(stats.tokens) + " tokens to " + output_path + " at " + std::to_string(stats.megabytes_per_second()) +
+                         " MB/s, BPE cache hit rate: " + std::to_string(tokenizer.get_cache_stats().hit_rate()));
+        return 0;
+    }
 
-    // Create transformer
-    transformer_t transformer(num_layers, d_model, num_heads, d_ff);
+    // Load the model
+    gpt2_t gpt2;
+    gpt2.init();
+
+    if (args::stream_layers_mb > 0) {
+        gpt2.enable_layer_streaming(static_cast<size_t>(args::stream_layers_mb) << 20);
+    }
+
+    quantization_t quantization = parse_quantization(args::quant);
+    if (quantization != quantization_t::none) {
+        gpt2.quantize(quantization);
+        logger::log_info("using " + args::quant + " weights, dot product kernel: " + quantized_matrix_t::kernel_name());
+    }
 
-    // Create a simple input (batch_size=1, seq_len=10, d_model=512)
-    // In practice, this would be your tokenized and embedded input sequence
-    MatrixXf input = MatrixXf::Random(seq_len, d_model);
+    std::vector<int> prompt = gpt2.tokenize(args::prompt);
 
-    // Forward pass
-    MatrixXf output = transformer.forward(input);
+    generation_params_t params;
+    params.max_new_tokens = args::max_new_tokens;
+    params.sampling.temperature = args::temperature;
+    params.sampling.top_k = args::top_k;
+    params.sampling.top_p = args::top_p;
+    params.sampling.min_p = args::min_p;
+    params.sampling.repetition_penalty = args::repetition_penalty;
+    params.sampling.seed = args::seed;
 
-    std::cout << "Output shape: " << output.rows() << "x" << output.cols() << std::endl;
+    // stream each token to stdout as soon as it is generated
+    std::cout << args::prompt << std::flush;
+    auto print_token = [&gpt2](int token) { std::cout << gpt2.decode({token}) << std::flush; };
+    generation_result_t result;
+    if (args::draft == "none") {
+        result = gpt2.generate(prompt, params, print_token);
+        std::cout << std::endl;
+    } else {
+        speculative_config_t config;
+        config.draft = parse_draft_mode(args::draft);
+        config.num_draft_tokens = args::draft_tokens;
+        config.draft_layers = args::draft_layers;
+
+        speculative_decoder_t decoder(gpt2, config);
+        result = decoder.generate(prompt, params, print_token);
+        std::cout << std::endl;
+
+        const speculative_stats_t& speculative_stats = decoder.get_stats();
+        logger::log_info("draft acceptance rate: " + std::to_string(speculative_stats.acceptance_rate()) +
+                         ", tokens per pass of the full model: " + std::to_string(speculative_stats.tokens_per_step()));
+        for (size_t i = 0; i < speculative_stats.drafted_at.size(); ++i) {
+            logger::log_debug("draft position " + std::to_string(i) + ": " + std::to_string(speculative_stats.accepted_at[i]) + " of " +
+                              std::to_string(speculative_stats.drafted_at[i]) + " accepted");
+        }
+    }
+
+    const generation_stats_t& stats = result.stats;
+    logger::log_info("prompt tokens: " + std::to_string(stats.prompt_tokens) + ", generated tokens: " + std::to_string(stats.generated_tokens));
+    logger::log_info("time to first token: " + std::to_string(stats.time_to_first_token_ms) + " ms");
+    for (size_t i = 0; i < stats.token_latencies_ms.size(); ++i) {
+        logger::log_debug("token " + std::to_string(i) + " latency: " + std::to_string(stats.token_latencies_ms[i]) + " ms");
+    }
+    if (stats.tokens_per_second > 0) {
+        logger::log_info("mean per token latency: " + std::to_string(1000.0 / stats.tokens_per_second) + " ms");
+        logger::log_info("decode throughput: " + std::to_string(stats.tokens_per_second) + " tokens/s");
+    }
+
+    if (const layer_streaming_stats_t* streaming = gpt2.get_layer_streaming_stats()) {
+        logger::log_info("layer loads: " + std::to_string(streaming->loads) + ", evictions: " + std::to_string(streaming->evictions) +
+                         ", load time hidden behind compute: " + std::to_string(100.0 * streaming->overlap()) + "%");
+        logger::log_info("peak resident layers: " + std::to_string(streaming->peak_resident_bytes >> 20) + " MB");
+    }
+    logger::log_info("peak RSS: " + std::to_string(peak_rss_bytes() >> 20) + " MB");
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,205 @@
+#include "pre_tokenizer.h"
+#include <cstdint>
+#include "unicode_categories.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PRE_TOKENIZER_SSE2
+#endif
+
+namespace {
+
+// the classes the pattern tells apart, other being everything that isn't one of the first three
+enum char_class_t : uint8_t { letter, number, whitespace, other };
+
+struct char_info_t {
+    char_class_t char_class;
+    // bytes taken up by the character
+    int length;
+};
+
+char_class_t ascii_class(uint8_t c)
+{
+    if (static_cast<unsigned>((c | 0x20) - 'a') < 26) {
+        return letter;
+    }
+    if (static_cast<unsigned>(c - '0') < 10) {
+        return number;
+    }
+    if (c == ' ' || static_cast<unsigned>(c - '\t') < 5) {
+        return whitespace;
+    }
+    return other;
+}
+
+char_class_t code_point_class(char32_t c)
+{
+    if (is_whitespace(c)) {
+        return whitespace;
+    }
+    if (is_letter(c)) {
+        return letter;
+    }
+    if (is_number(c)) {
+        return number;
+    }
+    return other;
+}
+
+bool is_continuation(uint8_t c)
+{
+    return (c & 0xC0) == 0x80;
+}
+
+// class and length of the character starting at s[0], there are size bytes left
+// anything that isn't the shortest valid encoding of a code point is one byte of class other
+char_info_t peek(const uint8_t* s, size_t size)
+{
+    uint8_t lead = s[0];
+    if (lead < 0x80) {
+        return {ascii_class(lead), 1};
+    }
+
+    int length;
+    char32_t c;
+    // the range the second byte must be in to rule out overlong encodings, surrogates and code points past U+10FFFF
+    uint8_t second_min = 0x80, second_max = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+        c = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        c = lead & 0x0F;
+        second_min = lead == 0xE0 ? 0xA0 : 0x80;
+        second_max = lead == 0xED ? 0x9F : 0xBF;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        c = lead & 0x07;
+        second_min = lead == 0xF0 ? 0x90 : 0x80;
+        second_max = lead == 0xF4 ? 0x8F : 0xBF;
+    } else {
+        return {other, 1};
+    }
+
+    if (size < static_cast<size_t>(length) || s[1] < second_min || s[1] > second_max) {
+        return {other, 1};
+    }
+    for (int i = 1; i < length; ++i) {
+        if (!is_continuation(s[i])) {
+            return {other, 1};
+        }
+        c = c << 6 | (s[i] & 0x3F);
+    }
+    return {code_point_class(c), length};
+}
+
+#ifdef PRE_TOKENIZER_SSE2
+
+// bit i is set if byte i of the block is an ASCII character of the given class (not whitespace, those runs are short)
+unsigned ascii_class_mask(__m128i bytes, char_class_t char_class)
+{
+    // an unsigned x <= limit, sse2 only compares signed bytes but min works unsigned
+    auto at_most = [](__m128i x, uint8_t limit) { return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(limit)), x); };
+
+    __m128i letters = at_most(_mm_sub_epi8(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), _mm_set1_epi8('a')), 25);
+    if (char_class == letter) {
+        return _mm_movemask_epi8(letters);
+    }
+    __m128i digits = at_most(_mm_sub_epi8(bytes, _mm_set1_epi8('0')), 9);
+    if (char_class == number) {
+        return _mm_movemask_epi8(digits);
+    }
+
+    // other: ASCII, and not a letter, digit or whitespace
+    __m128i spaces = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), at_most(_mm_sub_epi8(bytes, _mm_set1_epi8('\t')), 4));
+    unsigned not_other = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letters, digits), spaces)) | _mm_movemask_epi8(bytes);
+    return ~not_other & 0xFFFF;
+}
+
+#endif
+
+// end of the run of characters of char_class starting at position
+size_t skip_run(const uint8_t* s, size_t size, size_t position, char_class_t char_class)
+{
+    while (position < size) {
+#ifdef PRE_TOKENIZER_SSE2
+        if (size - position >= 16) {
+            unsigned mask = ascii_class_mask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + position)), char_class);
+            if (mask == 0xFFFF) {
+                position += 16;
+                continue;
+            }
+            // the byte after the matching ones is either a different class or the start of a multi byte character
+            position += __builtin_ctz(~mask);
+        }
+#endif
+        char_info_t c = peek(s + position, size - position);
+        if (c.char_class != char_class) {
+            break;
+        }
+        position += c.length;
+    }
+    return position;
+}
+
+}  // namespace
+
+size_t pre_tokenizer_t::scan(size_t start, bool& whitespace_chunk) const
+{
+    whitespace_chunk = false;
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(text.data());
+    size_t size = text.size();
+
+    // 's|'t|'re|'ve|'m|'ll|'d
+    if (s[start] == '\'' && start + 1 < size) {
+        uint8_t a = s[start + 1];
+        if (a == 's' || a == 't' || a == 'm' || a == 'd') {
+            return start + 2;
+        }
+        if (start + 2 < size) {
+            uint8_t b = s[start + 2];
+            if ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') || (a == 'l' && b == 'l')) {
+                return start + 3;
+            }
+        }
+    }
+
+    // ' ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+', a run of one class, optionally with a single space in front
+    if (s[start] == ' ' && start + 1 < size) {
+        char_info_t after = peek(s + start + 1, size - start - 1);
+        if (after.char_class != whitespace) {
+            return skip_run(s, size, start + 1 + after.length, after.char_class);
+        }
+    }
+    char_info_t first = peek(s + start, size - start);
+    if (first.char_class != whitespace) {
+        return skip_run(s, size, start + first.length, first.char_class);
+    }
+
+    whitespace_chunk = true;
+
+    // '\s+(?!\S)|\s+', a run of whitespace leaves its last character to go with whatever follows it, unless that would
+    // leave nothing or there's nothing after it
+    size_t end = start, last = start;
+    while (end < size) {
+        char_info_t c = peek(s + end, size - end);
+        if (c.char_class != whitespace) {
+            break;
+        }
+        last = end;
+        end += c.length;
+    }
+    return end == size || last == start ? end : last;
+}
+
+bool pre_tokenizer_t::next(std::string_view& chunk)
+{
+    if (position >= text.size()) {
+        return false;
+    }
+
+    size_t end = scan(position, whitespace_run);
+    chunk = text.substr(position, end - position);
+    position = end;
+    return true;
+}
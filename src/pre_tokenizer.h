@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// Splits text into the chunks that GPT-2 runs BPE on, one chunk at a time
+// This is a hand written scanner for GPT-2's pre-tokenizer pattern
+//     's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+// using the Unicode letter, number and whitespace classes, so text in any script splits the same as the reference.
+// It makes a single pass over the text decoding UTF-8 as it goes, and the chunks are views into the text, so it never
+// allocates. Runs of ASCII letters, digits or punctuation are classified 16 bytes at a time.
+// Bytes that aren't valid UTF-8 are treated as characters of their own that are neither letters, numbers nor
+// whitespace, so they go in with the punctuation, and the chunks always add up to the whole text.
+class pre_tokenizer_t {
+private:
+
+    std::string_view text;
+    size_t position = 0;
+    bool whitespace_run = false;
+
+    // end of the chunk starting at start, whitespace_chunk is set if it's a run of whitespace
+    size_t scan(size_t start, bool& whitespace_chunk) const;
+
+public:
+
+    explicit pre_tokenizer_t(std::string_view text) : text(text) {}
+
+    // sets chunk to the next chunk of the text, returns false once the text is used up
+    bool next(std::string_view& chunk);
+
+    // true if the last chunk from next() is all whitespace
+    // Only these chunks depend on more than the character after them: a run of whitespace followed by something else
+    // leaves its last character to go with it, so where the run stops depends on how far the whitespace goes.
+    bool is_whitespace_run() const { return whitespace_run; }
+};
@@ -0,0 +1,251 @@
+#include "sampler.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "utils.h"
+
+namespace {
+
+// better candidates first, ties go to the lower token id so the order never depends on how the selection went
+bool is_better(const token_logit_t& a, const token_logit_t& b)
+{
+    return a.logit > b.logit || (a.logit == b.logit && a.token < b.token);
+}
+
+}  // namespace
+
+sampler_t::sampler_t(const sampling_params_t& params, const std::vector<int>& context) : params(params), rng(params.seed.value_or(0))
+{
+    if (params.temperature < 0.0f || params.top_k < 0 || params.top_p <= 0.0f || params.top_p > 1.0f || params.min_p < 0.0f ||
+        params.min_p > 1.0f || params.repetition_penalty <= 0.0f) {
+        die("Invalid sampling parameters");
+    }
+
+    if (params.has_penalties()) {
+        for (int token : context) {
+            accept(token);
+        }
+    }
+}
+
+void sampler_t::accept(int token)
+{
+    if (params.has_penalties()) {
+        token_counts[token]++;
+    }
+}
+
+void sampler_t::apply_penalties(float* logits, int vocab_size) const
+{
+    for (const auto& [token, count] : token_counts) {
+        if (token < 0 || token >= vocab_size) {
+            continue;
+        }
+
+        float& logit = logits[token];
+        logit = logit > 0 ? logit / params.repetition_penalty : logit * params.repetition_penalty;
+        logit -= count * params.frequency_penalty + params.presence_penalty;
+    }
+}
+
+int sampler_t::sample(float* logits, int vocab_size)
+{
+    if (params.has_penalties()) {
+        apply_penalties(logits, vocab_size);
+    }
+
+    if (params.temperature <= 0.0f) {
+        return std::max_element(logits, logits + vocab_size) - logits;
+    }
+
+    bool has_filters = params.top_k > 0 || params.top_p < 1.0f || params.min_p > 0.0f;
+    if (has_filters) {
+        float max_logit = select_candidates(logits, vocab_size);
+        return sample_candidates(max_logit);
+    }
+
+    const float inverse_temperature = 1.0f / params.temperature;
+
+    // one pass for the max and the softmax normaliser together, the running sum is rescaled whenever the max grows
+    float max_logit = -std::numeric_limits<float>::infinity();
+    double total = 0;
+    for (int i = 0; i < vocab_size; ++i) {
+        if (logits[i] > max_logit) {
+            total *= std::exp((max_logit - logits[i]) * inverse_temperature);
+            max_logit = logits[i];
+        }
+        total += std::exp((logits[i] - max_logit) * inverse_temperature);
+    }
+
+    // plain temperature sampling, walk the cumulative distribution until it passes the random draw
+    double target = std::uniform_real_distribution<double>(0.0, total)(rng);
+    double cumulative = 0;
+    for (int i = 0; i < vocab_size; ++i) {
+        cumulative += std::exp((logits[i] - max_logit) * inverse_temperature);
+        if (cumulative >= target) {
+            return i;
+        }
+    }
+    return std::max_element(logits, logits + vocab_size) - logits;
+}
+
+float sampler_t::select_candidates(const float* logits, int vocab_size)
+{
+    const float inverse_temperature = 1.0f / params.temperature;
+
+    // min p is a fixed ratio to the most likely token, which is just an offset in logit space
+    // the one pass over the vocabulary keeps everything within that offset of the max so far, the max only grows so
+    // this keeps a superset of what min p wants and the rest is dropped once the real max is known
+    float offset = params.min_p > 0.0f ? params.temperature * std::log(params.min_p) : -std::numeric_limits<float>::infinity();
+    float max_logit = -std::numeric_limits<float>::infinity();
+    candidates.clear();
+    for (int i = 0; i < vocab_size; ++i) {
+        max_logit = std::max(max_logit, logits[i]);
+        if (logits[i] >= max_logit + offset) {
+            candidates.push_back({i, logits[i]});
+        }
+    }
+    float threshold = max_logit + offset;
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [threshold](const token_logit_t& c) { return c.logit < threshold; }),
+                     candidates.end());
+
+    // top k only needs to know which candidate is the kth best, everything better than it stays where it was
+    if (params.top_k > 0 && params.top_k < static_cast<int>(candidates.size())) {
+        selection.assign(candidates.begin(), candidates.end());
+        std::nth_element(selection.begin(), selection.begin() + params.top_k - 1, selection.end(), is_better);
+        token_logit_t kth = selection[params.top_k - 1];
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&kth](const token_logit_t& c) { return is_better(kth, c); }),
+                         candidates.end());
+    }
+
+    candidate_mass = 0;
+    for (const token_logit_t& candidate : candidates) {
+        candidate_mass += std::exp((candidate.logit - max_logit) * inverse_temperature);
+    }
+
+    if (params.top_p < 1.0f) {
+        double target = params.top_p * candidate_mass;
+
+        // sort the best candidates a chunk at a time until they hold enough of the probability,
+        // for a peaked distribution that's only a handful of tokens out of the whole vocabulary
+        double cumulative = 0;
+        size_t sorted = 0;
+        size_t chunk = 64;
+        size_t keep = candidates.size();
+        while (sorted < candidates.size() && keep == candidates.size()) {
+            size_t chunk_end = std::min(candidates.size(), sorted + chunk);
+            if (chunk_end < candidates.size()) {
+                std::nth_element(candidates.begin() + sorted, candidates.begin() + chunk_end, candidates.end(), is_better);
+            }
+            std::sort(candidates.begin() + sorted, candidates.begin() + chunk_end, is_better);
+
+            for (size_t j = sorted; j < chunk_end; ++j) {
+                cumulative += std::exp((candidates[j].logit - max_logit) * inverse_temperature);
+                if (cumulative >= target) {
+                    keep = j + 1;
+                    break;
+                }
+            }
+
+            sorted = chunk_end;
+            chunk *= 4;
+        }
+        candidates.resize(keep);
+        candidate_mass = cumulative;
+    }
+
+    return max_logit;
+}
+
+void sampler_t::distribution(float* logits, int vocab_size, std::vector<token_prob_t>& probs)
+{
+    probs.clear();
+
+    if (params.has_penalties()) {
+        apply_penalties(logits, vocab_size);
+    }
+
+    if (params.temperature <= 0.0f) {
+        probs.push_back({static_cast<int>(std::max_element(logits, logits + vocab_size) - logits), 1.0f});
+        return;
+    }
+
+    const float inverse_temperature = 1.0f / params.temperature;
+
+    double total = 0;
+    if (params.top_k > 0 || params.top_p < 1.0f || params.min_p > 0.0f) {
+        float max_logit = select_candidates(logits, vocab_size);
+        for (const token_logit_t& candidate : candidates) {
+            float weight = std::exp((candidate.logit - max_logit) * inverse_temperature);
+            probs.push_back({candidate.token, weight});
+            total += weight;
+        }
+    } else {
+        float max_logit = *std::max_element(logits, logits + vocab_size);
+        for (int i = 0; i < vocab_size; ++i) {
+            float weight = std::exp((logits[i] - max_logit) * inverse_temperature);
+            probs.push_back({i, weight});
+            total += weight;
+        }
+    }
+
+    for (token_prob_t& prob : probs) {
+        prob.prob /= total;
+    }
+}
+
+int sampler_t::draw(const std::vector<token_prob_t>& probs)
+{
+    double total = 0;
+    for (const token_prob_t& prob : probs) {
+        total += prob.prob;
+    }
+
+    double target = std::uniform_real_distribution<double>(0.0, total)(rng);
+    double cumulative = 0;
+    for (const token_prob_t& prob : probs) {
+        cumulative += prob.prob;
+        if (cumulative >= target) {
+            return prob.token;
+        }
+    }
+    return probs.back().token;
+}
+
+sampler_t sampler_t::fork(uint64_t stream) const
+{
+    sampler_t forked = *this;
+    forked.rng.seed(derive_seed(params.seed.value_or(0), stream));
+    return forked;
+}
+
+double sampler_t::uniform()
+{
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+int sampler_t::sample_candidates(float max_logit)
+{
+    const float inverse_temperature = 1.0f / params.temperature;
+
+    double target = std::uniform_real_distribution<double>(0.0, candidate_mass)(rng);
+    double cumulative = 0;
+    for (const token_logit_t& candidate : candidates) {
+        cumulative += std::exp((candidate.logit - max_logit) * inverse_temperature);
+        if (cumulative >= target) {
+            return candidate.token;
+        }
+    }
+
+    // rounding can leave the draw just past the end
+    return candidates.back().token;
+}
+
+uint64_t sampler_t::derive_seed(uint64_t seed, uint64_t stream)
+{
+    // splitmix64's finaliser, so neighbouring streams get seeds that have nothing in common
+    uint64_t z = seed + (stream + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
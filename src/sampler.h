@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "transformer/lm_head.h"
+
+struct sampling_params_t {
+    // softmax temperature, 0 means greedy decoding (always take the most likely token)
+    float temperature = 0.0f;
+    // only sample from the k most likely tokens, 0 turns this off
+    int top_k = 0;
+    // only sample from the smallest set of most likely tokens whose probabilities add up to at least top_p
+    float top_p = 1.0f;
+    // drop tokens whose probability is less than min_p times that of the most likely token
+    float min_p = 0.0f;
+
+    // penalties for tokens already in the context, prompt included
+    // repetition_penalty divides positive logits and multiplies negative ones, 1 turns it off
+    float repetition_penalty = 1.0f;
+    // subtracted from the logit once for each time the token has appeared
+    float frequency_penalty = 0.0f;
+    // subtracted from the logit once if the token has appeared at all
+    float presence_penalty = 0.0f;
+
+    // seed for this sequence's random stream, the same seed and inputs always give the same tokens
+    // left unset, the scheduler derives a different seed for each request and everything else uses 0
+    std::optional<uint64_t> seed;
+
+    bool has_penalties() const { return repetition_penalty != 1.0f || frequency_penalty != 0.0f || presence_penalty != 0.0f; }
+
+    // true if the next token is just the largest raw logit, so the logits don't need to be built at all
+    bool is_greedy() const { return temperature <= 0.0f && !has_penalties(); }
+};
+
+// a token and the probability of it being picked
+struct token_prob_t {
+    int token;
+    float prob;
+};
+
+// Picks the next token for one sequence
+// The penalties are applied sparsely to just the tokens seen so far, then a single pass over the vocabulary finds the
+// max along with either the softmax normaliser or, when filtering, the tokens min p keeps. Filters only ever
+// partially order the candidates: top k is a selection, and top p sorts the best candidates in growing chunks until
+// they hold enough probability, so the whole vocabulary is never sorted. Otherwise candidates stay in token order,
+// which keeps the draws independent of how the selection happened to shuffle them.
+// Each sampler has its own random stream so sequences in a batch don't affect each other.
+// The filters are applied in the order min p, top k, top p, each renormalising over what the previous ones kept.
+class sampler_t {
+private:
+
+    sampling_params_t params;
+    std::mt19937_64 rng;
+    // how often each token has appeared in the context, for the penalties
+    std::unordered_map<int, int> token_counts;
+    // scratch space for the candidates, kept between calls so sampling doesn't allocate
+    std::vector<token_logit_t> candidates, selection;
+    // the sum of exp((logit - max_logit) / temperature) over the candidates
+    double candidate_mass = 0;
+
+    void apply_penalties(float* logits, int vocab_size) const;
+
+    // fill candidates with the tokens that survive the filters and work out their mass, returns the max logit
+    float select_candidates(const float* logits, int vocab_size);
+
+    // sample from candidates, taking the probability of each to be exp((logit - max_logit) / temperature)
+    int sample_candidates(float max_logit);
+
+public:
+
+    // context holds the tokens so far (e.g. the prompt) that the penalties should count
+    sampler_t(const sampling_params_t& params, const std::vector<int>& context = {});
+
+    // pick the next token from a sequence's logits
+    // the logits are used as scratch space, so they may have been changed by the time this returns
+    int sample(float* logits, int vocab_size);
+
+    // the distribution that sample() draws from, as the tokens that can be picked with their probabilities
+    // greedy sampling puts all of the probability on one token, like sample() the logits are used as scratch space
+    void distribution(float* logits, int vocab_size, std::vector<token_prob_t>& probs);
+
+    // draw a token from a distribution (which need not be normalised) with this sampler's random stream
+    int draw(const std::vector<token_prob_t>& probs);
+
+    // a draw from [0, 1) on this sampler's random stream
+    double uniform();
+
+    // add a token to the context counted by the penalties
+    void accept(int token);
+
+    // a copy of this sampler, penalties and all, that draws from a random stream of its own, different for each stream
+    sampler_t fork(uint64_t stream) const;
+
+    const sampling_params_t& get_params() const { return params; }
+
+    // a seed for a random stream independent of the one seed gives, and different for every value of stream
+    static uint64_t derive_seed(uint64_t seed, uint64_t stream);
+};
@@ -0,0 +1,221 @@
+#include "scheduler.h"
+#include <algorithm>
+#include "utils.h"
+
+scheduler_t::active_sequence_t::active_sequence_t(generation_request_t request, gpt2_session_t session, clock::time_point submitted)
+    : request(std::move(request)), sampler(this->request.params.sampling, this->request.prompt), session(std::move(session)), submitted(submitted),
+      last_token(submitted)
+{
+    pending = this->request.prompt;
+    result.stats.prompt_tokens = pending.size();
+}
+
+scheduler_t::scheduler_t(gpt2_t& model, const scheduler_config_t& config) : model(model), config(config)
+{
+    if (config.max_batch_size <= 0 || config.max_tokens_per_step < config.max_batch_size) {
+        die("Scheduler needs a positive batch size and a token budget of at least one token per sequence");
+    }
+}
+
+void scheduler_t::submit(generation_request_t request)
+{
+    if (request.prompt.empty()) {
+        die("Cannot generate from an empty prompt");
+    }
+    if (static_cast<int>(request.prompt.size()) > model.get_max_seq_len()) {
+        die("Input token sequence is too long");
+    }
+
+    // without a seed of its own every request would draw the same random numbers, so give each one a different stream
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        uint64_t request_id = submitted_requests++;
+        if (!request.params.sampling.seed) {
+            request.params.sampling.seed = sampler_t::derive_seed(0, request_id);
+        }
+    }
+
+    // nothing to generate, so finish straight away rather than taking up a slot
+    if (request.params.max_new_tokens <= 0) {
+        generation_result_t result;
+        result.stats.prompt_tokens = request.prompt.size();
+        if (request.on_finish) {
+            request.on_finish(result);
+        }
+        return;
+    }
+
+    auto seq = std::make_unique<active_sequence_t>(std::move(request), model.create_session(), clock::now());
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    queue.push_back(std::move(seq));
+}
+
+int scheduler_t::num_queued()
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return queue.size();
+}
+
+void scheduler_t::admit()
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    while (static_cast<int>(active.size()) < config.max_batch_size && !queue.empty()) {
+        active_sequence_t& seq = *queue.front();
+
+        // look the prompt up at admission rather than submission, so it can hit on prefixes that were prefilled while it was queued
+        int cached_tokens = model.attach_cached_prefix(seq.pending, seq.session);
+        seq.pending.erase(seq.pending.begin(), seq.pending.begin() + cached_tokens);
+        seq.result.stats.cached_prompt_tokens = cached_tokens;
+
+        active.push_back(std::move(queue.front()));
+        queue.pop_front();
+    }
+}
+
+bool scheduler_t::step()
+{
+    admit();
+
+    if (active.empty()) {
+        return false;
+    }
+
+    // sequences that are decoding only need one token each, schedule those first so they never stall behind prefills
+    std::vector<active_sequence_t*> order;
+    for (auto& seq : active) {
+        if (seq->pending.size() == 1) {
+            order.push_back(seq.get());
+        }
+    }
+    for (auto& seq : active) {
+        if (seq->pending.size() > 1) {
+            order.push_back(seq.get());
+        }
+    }
+
+    // spend the token budget, prompts that don't fit are prefilled in chunks over several steps
+    int budget = config.max_tokens_per_step;
+    std::vector<active_sequence_t*> scheduled;
+    std::vector<std::vector<int>> inputs;
+    std::vector<gpt2_session_t*> sessions;
+    for (active_sequence_t* seq : order) {
+        if (budget == 0) {
+            break;
+        }
+        int chunk = std::min(budget, static_cast<int>(seq->pending.size()));
+        budget -= chunk;
+
+        scheduled.push_back(seq);
+        inputs.emplace_back(seq->pending.begin(), seq->pending.begin() + chunk);
+        sessions.push_back(&seq->session);
+        seq->pending.erase(seq->pending.begin(), seq->pending.begin() + chunk);
+    }
+
+    // one forward pass for every scheduled sequence, only the next token after each of them is needed
+    std::vector<int> next_tokens(scheduled.size(), -1);
+    bool all_greedy = std::all_of(scheduled.begin(), scheduled.end(),
+                                  [](const active_sequence_t* seq) { return seq->request.params.sampling.is_greedy(); });
+    if (all_greedy) {
+        std::vector<std::vector<token_logit_t>> best = model.forward_top_k(inputs, sessions, 1);
+        for (size_t i = 0; i < scheduled.size(); ++i) {
+            next_tokens[i] = best[i][0].token;
+        }
+    } else {
+        MatrixXf logits = model.forward_last(inputs, sessions);
+
+        // the samplers are independent, each with its own random stream, so they can run side by side
+        // a sequence still part way through its prompt has nothing to sample yet
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < static_cast<int>(scheduled.size()); ++i) {
+            if (scheduled[i]->pending.empty()) {
+                next_tokens[i] = scheduled[i]->sampler.sample(logits.col(i).data(), logits.rows());
+            }
+        }
+    }
+
+    stats.steps++;
+    for (const std::vector<int>& input : inputs) {
+        stats.batched_tokens += input.size();
+    }
+    stats.max_batch_size_seen = std::max(stats.max_batch_size_seen, static_cast<int>(scheduled.size()));
+
+    for (size_t i = 0; i < scheduled.size(); ++i) {
+        active_sequence_t& seq = *scheduled[i];
+
+        // a sequence still part way through its prompt has nothing to sample yet
+        if (!seq.pending.empty()) {
+            continue;
+        }
+
+        // share the prompt with other requests as soon as it's been prefilled
+        if (!seq.prefilled) {
+            model.cache_prefix(seq.session);
+            seq.prefilled = true;
+        }
+
+        int token = next_tokens[i];
+        seq.sampler.accept(token);
+        if (accept_token(seq, token)) {
+            retire(seq);
+        }
+    }
+
+    // drop the retired sequences, freeing their slots for the next step
+    active.erase(std::remove_if(active.begin(), active.end(), [](const std::unique_ptr<active_sequence_t>& seq) { return seq == nullptr; }),
+                 active.end());
+
+    return true;
+}
+
+bool scheduler_t::accept_token(active_sequence_t& seq, int token)
+{
+    if (seq.request.params.is_stop_token(token)) {
+        return true;
+    }
+
+    // last_token starts off as the submission time, so queueing delay shows up in the time to first token
+    auto now = clock::now();
+    seq.result.stats.token_latencies_ms.push_back(std::chrono::duration<double, std::milli>(now - seq.last_token).count());
+    seq.last_token = now;
+
+    seq.result.tokens.push_back(token);
+    if (seq.request.on_token) {
+        seq.request.on_token(token);
+    }
+
+    bool reached_max_tokens = static_cast<int>(seq.result.tokens.size()) >= seq.request.params.max_new_tokens;
+    bool reached_max_len = seq.session.size() + 1 > model.get_max_seq_len();
+    if (reached_max_tokens || reached_max_len) {
+        return true;
+    }
+
+    // the new token is the input for the next step
+    seq.pending = {token};
+    return false;
+}
+
+void scheduler_t::retire(active_sequence_t& seq)
+{
+    model.cache_prefix(seq.session);
+
+    seq.result.stats.finish(std::chrono::duration<double, std::milli>(clock::now() - seq.submitted).count());
+    if (seq.request.on_finish) {
+        seq.request.on_finish(seq.result);
+    }
+
+    stats.completed_requests++;
+
+    // release the slot, the sequence's session (and so its kv cache) goes with it
+    for (auto& active_seq : active) {
+        if (active_seq.get() == &seq) {
+            active_seq.reset();
+        }
+    }
+}
+
+void scheduler_t::run_until_idle()
+{
+    while (step()) {
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "gpt2.h"
+
+struct generation_request_t {
+    std::vector<int> prompt;
+    generation_params_t params;
+    // called for every generated token as soon as it is available
+    token_callback_t on_token;
+    // called once when the request has finished, with all of its tokens and its timings
+    std::function<void(const generation_result_t&)> on_finish;
+};
+
+struct scheduler_config_t {
+    // maximum number of sequences that can be active (and so share a batch) at once
+    int max_batch_size = 8;
+    // maximum number of tokens pushed through the model in a single step, decode tokens are scheduled first
+    // and the rest of the budget is spent prefilling prompts, long prompts are split across several steps
+    int max_tokens_per_step = 512;
+};
+
+struct scheduler_stats_t {
+    int steps = 0;
+    int completed_requests = 0;
+    // total tokens pushed through the model, prompt and generated
+    long batched_tokens = 0;
+    int max_batch_size_seen = 0;
+};
+
+// Continuous batching scheduler
+// Requests are queued by submit() and every call to step() runs one batched forward pass over all the active sequences.
+// New requests are admitted as soon as a slot frees up and finished ones are retired straight away,
+// so short requests never wait for long ones to finish.
+class scheduler_t {
+private:
+
+    using clock = std::chrono::steady_clock;
+
+    struct active_sequence_t {
+        generation_request_t request;
+        // each sequence samples from its own random stream
+        sampler_t sampler;
+        gpt2_session_t session;
+        generation_result_t result;
+        // tokens that still have to be fed through the model, the rest of the prompt or the last generated token
+        std::vector<int> pending;
+        // whether the whole prompt has been through the model yet
+        bool prefilled = false;
+        clock::time_point submitted;
+        clock::time_point last_token;
+
+        active_sequence_t(generation_request_t request, gpt2_session_t session, clock::time_point submitted);
+    };
+
+    gpt2_t& model;
+    scheduler_config_t config;
+    scheduler_stats_t stats;
+
+    // requests waiting for a free slot, guarded by queue_mutex so other threads can submit while step() runs
+    std::mutex queue_mutex;
+    std::deque<std::unique_ptr<active_sequence_t>> queue;
+    // requests submitted so far, which numbers them for the seeds of those that don't set one
+    uint64_t submitted_requests = 0;
+
+    std::vector<std::unique_ptr<active_sequence_t>> active;
+
+    void admit();
+
+    // returns true if the sequence has finished
+    bool accept_token(active_sequence_t& seq, int token);
+
+    void retire(active_sequence_t& seq);
+
+public:
+
+    scheduler_t(gpt2_t& model, const scheduler_config_t& config);
+
+    // queue a request, safe to call from any thread
+    void submit(generation_request_t request);
+
+    // run one batched decode iteration, returns false if there was nothing to do
+    bool step();
+
+    // keep stepping until every submitted request has finished
+    void run_until_idle();
+
+    int num_active() const { return active.size(); }
+
+    int num_queued();
+
+    const scheduler_stats_t& get_stats() const { return stats; }
+};
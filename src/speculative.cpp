@@ -0,0 +1,229 @@
+#include "speculative.h"
+#include <algorithm>
+#include <chrono>
+#include "utils.h"
+
+namespace {
+
+float probability_of(const std::vector<token_prob_t>& dist, int token)
+{
+    for (const token_prob_t& prob : dist) {
+        if (prob.token == token) {
+            return prob.prob;
+        }
+    }
+    return 0.0f;
+}
+
+}  // namespace
+
+draft_mode_t parse_draft_mode(const std::string& name)
+{
+    if (name == "ngram") {
+        return draft_mode_t::ngram;
+    }
+    if (name == "truncated") {
+        return draft_mode_t::truncated;
+    }
+    die("Unknown draft mode: " + name + ", expected ngram or truncated");
+    return draft_mode_t::ngram;
+}
+
+std::vector<int> ngram_draft(const std::vector<int>& context, int max_tokens, int max_ngram)
+{
+    int length = context.size();
+
+    for (int n = std::min(max_ngram, length - 1); n >= 1; --n) {
+        auto suffix = context.end() - n;
+
+        // the most recent earlier occurrence is the most likely to be continued the same way
+        for (int start = length - n - 1; start >= 0; --start) {
+            if (std::equal(suffix, context.end(), context.begin() + start)) {
+                int end = std::min(length, start + n + max_tokens);
+                return std::vector<int>(context.begin() + start + n, context.begin() + end);
+            }
+        }
+    }
+
+    return {};
+}
+
+draft_verdict_t verify_draft(sampler_t& sampler, const std::vector<token_prob_t>& target, const std::vector<token_prob_t>* draft_dist, int draft,
+                             int vocab_size, std::vector<float>& draft_probs, std::vector<token_prob_t>& residual)
+{
+    // the n-gram draft is deterministic, so it proposes its token with probability 1
+    float q = draft_dist ? probability_of(*draft_dist, draft) : 1.0f;
+    float p = probability_of(target, draft);
+
+    if (sampler.uniform() < p / q) {
+        return {true, draft};
+    }
+
+    // rejected, draw the replacement from what the full model wants beyond what the draft already proposed
+    draft_probs.assign(vocab_size, 0.0f);
+    if (draft_dist) {
+        for (const token_prob_t& prob : *draft_dist) {
+            draft_probs[prob.token] = prob.prob;
+        }
+    } else {
+        draft_probs[draft] = 1.0f;
+    }
+    residual.clear();
+    for (const token_prob_t& prob : target) {
+        float excess = prob.prob - draft_probs[prob.token];
+        if (excess > 0) {
+            residual.push_back({prob.token, excess});
+        }
+    }
+    return {false, sampler.draw(residual.empty() ? target : residual)};
+}
+
+speculative_decoder_t::speculative_decoder_t(gpt2_t& model, const speculative_config_t& config) : model(model), config(config)
+{
+    if (config.num_draft_tokens < 1 || config.max_ngram < 1 || config.draft_layers < 1 || config.draft_layers > model.get_num_layers()) {
+        die("Invalid speculative decoding config");
+    }
+
+    stats.drafted_at.assign(config.num_draft_tokens, 0);
+    stats.accepted_at.assign(config.num_draft_tokens, 0);
+}
+
+std::vector<int> speculative_decoder_t::draft_truncated(gpt2_session_t& session, int last_token, int max_tokens, sampler_t draft_sampler,
+                                                        std::vector<std::vector<token_prob_t>>& draft_dists)
+{
+    int length = session.size();
+
+    std::vector<int> drafts;
+    int input = last_token;
+    for (int i = 0; i < max_tokens; ++i) {
+        MatrixXf logits = model.forward_draft({input}, session, config.draft_layers);
+
+        draft_dists.emplace_back();
+        draft_sampler.distribution(logits.data(), logits.rows(), draft_dists.back());
+        input = draft_sampler.draw(draft_dists.back());
+        draft_sampler.accept(input);
+        drafts.push_back(input);
+    }
+
+    // the full model recomputes these positions when verifying, for every layer
+    session.truncate(length);
+
+    return drafts;
+}
+
+generation_result_t speculative_decoder_t::generate(const std::vector<int>& prompt, const generation_params_t& params, const token_callback_t& on_token)
+{
+    using clock = std::chrono::steady_clock;
+    auto elapsed_ms = [](clock::time_point from) { return std::chrono::duration<double, std::milli>(clock::now() - from).count(); };
+
+    if (prompt.empty()) {
+        die("Cannot generate from an empty prompt");
+    }
+
+    generation_result_t result;
+    result.stats.prompt_tokens = prompt.size();
+
+    gpt2_session_t session = model.create_session();
+    sampler_t sampler(params.sampling, prompt);
+
+    auto start = clock::now();
+    auto token_start = start;
+
+    // the session holds everything but the last token, which goes in with the draft tokens that follow it
+    std::vector<int> prefix(prompt.begin(), prompt.end() - 1);
+    result.stats.cached_prompt_tokens = model.attach_cached_prefix(prefix, session);
+    if (result.stats.cached_prompt_tokens < static_cast<int>(prefix.size())) {
+        model.forward_step(std::vector<int>(prefix.begin() + result.stats.cached_prompt_tokens, prefix.end()), session);
+    }
+    model.cache_prefix(session);
+    int last_token = prompt.back();
+
+    bool finished = false;
+    while (!finished && static_cast<int>(result.tokens.size()) < params.max_new_tokens && session.size() < model.get_max_seq_len()) {
+        int length = session.size();
+
+        // every pass makes at least one token on top of the accepted drafts, so don't draft more than can be used
+        int remaining = params.max_new_tokens - result.tokens.size();
+        int max_drafts = std::min({config.num_draft_tokens, remaining - 1, model.get_max_seq_len() - length - 1});
+
+        std::vector<int> drafts;
+        std::vector<std::vector<token_prob_t>> draft_dists;
+        if (max_drafts > 0) {
+            if (config.draft == draft_mode_t::ngram) {
+                std::vector<int> context = session.tokens;
+                context.push_back(last_token);
+                drafts = ngram_draft(context, max_drafts, config.max_ngram);
+            } else {
+                // a stream of its own for every step, each position is only ever drafted from once
+                drafts = draft_truncated(session, last_token, max_drafts, sampler.fork(length), draft_dists);
+            }
+        }
+
+        // verify every draft in one pass of the full model, row i holds the logits for the token after input i
+        std::vector<int> input = {last_token};
+        input.insert(input.end(), drafts.begin(), drafts.end());
+        MatrixXf logits = model.forward_step(input, session).transpose();
+
+        stats.verify_steps++;
+        stats.draft_tokens += drafts.size();
+
+        // walk the drafts in order, taking each one the full model agrees with, until one is rejected
+        int accepted = 0;
+        int next_token = -1;
+        for (size_t i = 0; i <= drafts.size(); ++i) {
+            sampler.distribution(logits.col(i).data(), logits.rows(), target_dist);
+
+            if (i == drafts.size()) {
+                // everything was accepted, so the last row gives a bonus token
+                next_token = sampler.draw(target_dist);
+                break;
+            }
+
+            stats.drafted_at[i]++;
+            const std::vector<token_prob_t>* draft_dist = draft_dists.empty() ? nullptr : &draft_dists[i];
+            draft_verdict_t verdict = verify_draft(sampler, target_dist, draft_dist, drafts[i], logits.rows(), draft_probs, residual);
+            if (verdict.accepted) {
+                stats.accepted_at[i]++;
+                accepted++;
+                sampler.accept(verdict.token);
+                continue;
+            }
+
+            next_token = verdict.token;
+            break;
+        }
+        if (next_token != -1) {
+            sampler.accept(next_token);
+        }
+        stats.accepted_tokens += accepted;
+
+        // only the last token and the accepted drafts stay in the cache
+        session.truncate(length + 1 + accepted);
+
+        std::vector<int> new_tokens(drafts.begin(), drafts.begin() + accepted);
+        new_tokens.push_back(next_token);
+        for (int token : new_tokens) {
+            if (params.is_stop_token(token) || static_cast<int>(result.tokens.size()) >= params.max_new_tokens) {
+                finished = true;
+                break;
+            }
+
+            // the tokens of one pass all arrive together, so all but the first show up with next to no latency
+            result.stats.token_latencies_ms.push_back(elapsed_ms(token_start));
+            result.tokens.push_back(token);
+            stats.generated_tokens++;
+            if (on_token) {
+                on_token(token);
+            }
+            token_start = clock::now();
+        }
+
+        last_token = next_token;
+    }
+
+    model.cache_prefix(session);
+
+    result.stats.finish(elapsed_ms(start));
+
+    return result;
+}
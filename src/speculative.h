@@ -0,0 +1,97 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "gpt2.h"
+#include "sampler.h"
+
+enum class draft_mode_t {
+    // look the last few tokens up earlier in the context and propose whatever followed them last time
+    ngram,
+    // run only the first few layers of the model itself
+    truncated
+};
+
+// parses the value of --draft, "ngram" or "truncated"
+draft_mode_t parse_draft_mode(const std::string& name);
+
+struct speculative_config_t {
+    draft_mode_t draft = draft_mode_t::ngram;
+    // tokens proposed by the draft for each pass of the full model
+    int num_draft_tokens = 4;
+    // layers run by the truncated draft
+    int draft_layers = 2;
+    // longest run of trailing tokens the n-gram draft looks up, shorter runs are tried if it isn't found
+    int max_ngram = 3;
+};
+
+struct speculative_stats_t {
+    // passes of the full model, each one verifies a batch of draft tokens and always produces at least one token
+    long verify_steps = 0;
+    long draft_tokens = 0;
+    long accepted_tokens = 0;
+    long generated_tokens = 0;
+    // per draft position, how often a token was proposed there and how often it was accepted
+    // position i is only reached when every draft token before it was accepted
+    std::vector<long> drafted_at;
+    std::vector<long> accepted_at;
+
+    double acceptance_rate() const { return draft_tokens == 0 ? 0.0 : static_cast<double>(accepted_tokens) / draft_tokens; }
+
+    // tokens generated per pass of the full model, plain decoding gets exactly 1
+    double tokens_per_step() const { return verify_steps == 0 ? 0.0 : static_cast<double>(generated_tokens) / verify_steps; }
+};
+
+// up to max_tokens tokens that followed the most recent earlier occurrence of the last n tokens of context,
+// trying n = max_ngram first and then shorter runs, empty if none of them appear earlier
+std::vector<int> ngram_draft(const std::vector<int>& context, int max_tokens, int max_ngram);
+
+// what verify_draft decided, token is the draft if it was accepted and the replacement if not
+struct draft_verdict_t {
+    bool accepted;
+    int token;
+};
+
+// check a draft token against the full model's distribution target, drawing on the sequence's sampler
+// The draft is accepted with probability min(1, p / q), q being its probability in draft_dist, or 1 if draft_dist is
+// null for a deterministic draft. On a rejection the replacement is drawn from max(0, p - q), so either way the token
+// is distributed exactly as target, as long as the draft was drawn with random numbers independent of the sampler's.
+// draft_probs and residual are scratch space, kept by the caller so rejections don't allocate
+draft_verdict_t verify_draft(sampler_t& sampler, const std::vector<token_prob_t>& target, const std::vector<token_prob_t>* draft_dist, int draft,
+                             int vocab_size, std::vector<float>& draft_probs, std::vector<token_prob_t>& residual);
+
+// Speculative decoding
+// A cheap draft proposes the next few tokens and the full model checks all of them in a single batched pass, so each
+// pass of the full model can produce several tokens instead of one. Draft token x is accepted with probability
+// min(1, p(x) / q(x)), p being the full model's distribution and q the draft's, and on the first rejection a
+// replacement is drawn from max(0, p - q), which leaves the output distributed exactly as if the full model had
+// sampled every token itself (for greedy decoding, exactly the same tokens). The full model's pass also gives the
+// distribution after the last draft token, so when every draft is accepted there's a bonus token on top.
+// The truncated draft shares the session's kv cache: its layers compute exactly what the full model's first layers
+// would, and the session is truncated back before verifying.
+class speculative_decoder_t {
+private:
+
+    gpt2_t& model;
+    speculative_config_t config;
+    speculative_stats_t stats;
+
+    // scratch distributions, kept between steps so they don't need reallocating
+    std::vector<token_prob_t> target_dist, residual;
+    std::vector<float> draft_probs;
+
+    // propose up to max_tokens tokens after last_token with the first layers of the model, filling in the draft's
+    // distribution for each of them. draft_sampler is a fork of the sequence's sampler, so the penalties match but
+    // the draws don't reuse the random numbers the verification will
+    std::vector<int> draft_truncated(gpt2_session_t& session, int last_token, int max_tokens, sampler_t draft_sampler,
+                                     std::vector<std::vector<token_prob_t>>& draft_dists);
+
+public:
+
+    speculative_decoder_t(gpt2_t& model, const speculative_config_t& config);
+
+    // same as gpt2_t::generate, just (hopefully) faster
+    generation_result_t generate(const std::vector<int>& prompt, const generation_params_t& params, const token_callback_t& on_token = nullptr);
+
+    // totals over every call to generate
+    const speculative_stats_t& get_stats() const { return stats; }
+};
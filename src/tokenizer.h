@@ -1,49 +1,30 @@
 #pragma once
-#include <algorithm>
+#include <array>
 #include <codecvt>
-#include <fstream>
-#include <iostream>
-#include <limits>
 #include <locale>
-#include <map>
-#include <nlohmann/json.hpp>
-#include <regex>
-#include <set>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
+#include "bpe_cache.h"
+#include "pre_tokenizer.h"
+#include "tokenizer_file.h"
 #include "types/basic_types.h"
 
-// Use nlohmann::json for JSON parsing
-using json = nlohmann::json;
-
 class tokenizer_t {
 private:
 
-    // Encoder: maps tokens to IDs
-    std::map<string_t, int> encoder;
-    // Decoder: maps IDs back to tokens
-    std::map<int, string_t> decoder;
-    // merge_ranks: stores the priority of merge operations
-    std::vector<std::pair<string_t, string_t>> merge_ranks;
-    // Regex pattern for tokenization - performs initial splitting of input string
-    std::regex regex_splitter;
-    // Byte-to-unicode mapping
-    std::map<uint8_t, char32_t> byte_encoder;
-
-    std::map<uint8_t, char32_t> bytes_to_unicode();
+    // the vocabulary, the token for each byte and the merge rules, see tokenizer_file.h
+    std::unique_ptr<tokenizer_file_t> tables;
+    // BPE results for chunks that have been seen before
+    std::unique_ptr<bpe_cache_t> cache;
+    // the UTF-8 for each byte's character in the byte-level encoding, which is how detokenize spells tokens
+    std::array<string_t, 256> byte_encoder;
 
-    // Function to find the rank of a pair
-    int get_pair_rank(const string_t& first, const string_t& second);
+    explicit tokenizer_t(std::unique_ptr<tokenizer_file_t> tables);
 
-    std::vector<string_t> bpe(const std::u32string& token);
-
-    // UTF-8 to UTF-32 conversion using standard C++
-    std::u32string utf8_to_utf32(const string_t& utf8_string)
-    {
-        std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> converter;
-        return converter.from_bytes(utf8_string);
-    }
+    // byte pair encodes a chunk of raw text, appending its tokens to output
+    void bpe(std::string_view chunk, std::vector<int>& output) const;
 
     string_t utf32_to_utf8(const std::u32string& input)
     {
@@ -53,15 +34,42 @@ private:
 
 public:
 
+    // chunks the BPE cache holds by default, enough for the common words of a large corpus
+    static constexpr size_t default_cache_capacity = 1 << 16;
+
+    // compiles the tables from vocab.json and merges.txt
     tokenizer_t(const string_t& vocab_file, const string_t& merges_file);
 
+    // maps a compiled tokenizer file, which is much faster than parsing vocab.json
+    explicit tokenizer_t(const string_t& compiled_file);
+
+    // write the tables out as a compiled tokenizer file for the constructor above
+    void save_compiled(const string_t& path) const { tables->save(path); }
+
+    // replace the BPE cache with an empty one holding up to capacity chunks, 0 turns caching off
+    void set_cache_capacity(size_t capacity) { cache = std::make_unique<bpe_cache_t>(capacity); }
+
+    bpe_cache_stats_t get_cache_stats() const { return cache->get_stats(); }
+
     // Tokenize input text
-    std::vector<int> tokenize(const string_t& text);
-    std::vector<string_t> detokenize(const std::vector<int>& tokens);
-    string_t detokenize(const int token);
+    std::vector<int> tokenize(const string_t& text) const;
+
+    // appends the tokens for text to output
+    // safe to call from several threads at once, the BPE cache is the only shared state and it has its own locks
+    void tokenize(std::string_view text, std::vector<int>& output) const;
+
+    // tokens as vocab.json spells them, in the byte-level encoding, and empty for ids outside the vocabulary
+    std::vector<string_t> detokenize(const std::vector<int>& tokens) const;
+    string_t detokenize(const int token) const;
+
+    // convert tokens back to the raw text they encode, undoing the byte-level encoding
+    string_t decode(const std::vector<int>& tokens) const;
+
+    // the token that stands for exactly these raw bytes, -1 if there isn't one
+    int token_id(std::string_view bytes) const { return tables->find_token(bytes); }
 
     // helper functions for testing
-    int get_vocab_size() { return encoder.size(); };
+    int get_vocab_size() const { return tables->vocab_size(); };
 
-    int get_mergers_size() { return merge_ranks.size(); };
+    int get_mergers_size() const { return tables->num_merges(); };
 };
@@ -0,0 +1,337 @@
+#include "tokenizer_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <codecvt>
+#include <cstring>
+#include <fstream>
+#include <locale>
+#include <nlohmann/json.hpp>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+#include "utils.h"
+
+using namespace tokenizer_file_format;
+
+namespace {
+
+uint64_t align_up(uint64_t offset)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// append a table to the image, starting on the next 64 byte boundary, and return where it starts
+template <class T>
+uint64_t append_section(string_t& image, const std::vector<T>& table)
+{
+    uint64_t offset = align_up(image.size());
+    image.resize(offset);
+    image.append(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(T));
+    return offset;
+}
+
+}  // namespace
+
+// Function to create byte-to-unicode mapping for GPT-2 tokenization
+std::array<char32_t, 256> bytes_to_unicode()
+{
+    // Purpose: Create a specific bijective mapping between byte values (0-255) and Unicode code points.
+    // This mapping is designed to be consistent with GPT-2's original tokenization scheme.
+
+    std::vector<uint8_t> bs;
+    // Step 1: Add printable ASCII characters (33 to 126, i.e., '!' to '~')
+    // Note: We will handl 0-32 (and the other missing values) later
+    for (int i = 33; i <= 126; ++i)
+        bs.push_back(i);
+    // Step 2: Add extended ASCII characters (161 - '¡' to 172 - '¬' and 174 - '®'to 255 - 'ÿ')
+    for (int i = 161; i <= 172; ++i)
+        bs.push_back(i);
+    for (int i = 174; i <= 255; ++i)
+        bs.push_back(i);
+
+    // Create a copy of bs to store the Unicode mappings
+    std::vector<char32_t> cs(bs.begin(), bs.end());
+    int n = 0;
+    // Step 3: Map remaining byte values (0-32, 127-160, 173) to Unicode points starting at 256
+    // This includes control characters, space, delete, and some extended ASCII characters
+    // Mapping these to 256+ ensures:
+    // 1. Consistency with GPT-2's original tokenization scheme
+    // 2. Clear visual distinction of special characters during debugging
+    // 3. Avoidance of potential issues with the way text editors handle control characters
+
+    for (int b = 0; b < 256; ++b) {
+
+        // if we have already added this byte, skip it
+        if (std::find(bs.begin(), bs.end(), b) != bs.end())
+            continue;
+
+        bs.push_back(b);
+        // Map to Unicode characters starting from 256
+        // Note: we add 256 to avoid conflicts with the ASCII range
+        cs.push_back(256 + n);
+        ++n;
+    }
+
+    // Create the final mapping
+    // Note: We need to use char32_t rather than char to handle Unicode code points over 255
+    std::array<char32_t, 256> result;
+    for (size_t i = 0; i < bs.size(); ++i) {
+        result[bs[i]] = cs[i];
+    }
+    return result;
+}
+
+tokenizer_file_t::tokenizer_file_t(const string_t& vocab_file, const string_t& merges_file)
+{
+    std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> converter;
+    std::array<char32_t, 256> byte_encoder = bytes_to_unicode();
+    std::unordered_map<char32_t, uint8_t> byte_decoder;
+    for (int byte = 0; byte < 256; ++byte) {
+        byte_decoder[byte_encoder[byte]] = byte;
+    }
+
+    // Load vocabulary from JSON file
+    std::ifstream vocab_stream(vocab_file);
+    if (!vocab_stream) {
+        die("Cannot open " + vocab_file);
+    }
+    nlohmann::json vocab_json;
+    vocab_stream >> vocab_json;
+
+    // the ids index the tables, so they have to be exactly 0 to the vocabulary size - 1
+    std::vector<string_t> tokens(vocab_json.size());
+    std::vector<bool> seen(tokens.size());
+    // vocab.json's spelling of each token to its id, for reading the merges
+    std::unordered_map<string_t, int> encoder;
+    for (auto it = vocab_json.begin(); it != vocab_json.end(); ++it) {
+        int id = it.value();
+        if (id < 0 || id >= static_cast<int>(tokens.size()) || seen[id]) {
+            die("Token ids in " + vocab_file + " must run from 0 to the vocabulary size without gaps, got " + std::to_string(id));
+        }
+        seen[id] = true;
+        encoder[it.key()] = id;
+
+        // each byte-level character stands for one raw byte
+        for (char32_t c : converter.from_bytes(it.key())) {
+            auto byte = byte_decoder.find(c);
+            if (byte == byte_decoder.end()) {
+                die("Token " + it.key() + " in " + vocab_file + " isn't spelled with the byte-level characters");
+            }
+            tokens[id] += static_cast<char>(byte->second);
+        }
+    }
+
+    // BPE works on token ids, starting from the token for each byte's character
+    std::vector<int32_t> byte_tokens(256);
+    for (int byte = 0; byte < 256; ++byte) {
+        auto it = encoder.find(converter.to_bytes(std::u32string(1, byte_encoder[byte])));
+        if (it == encoder.end()) {
+            die("The vocabulary has no token for byte " + std::to_string(byte));
+        }
+        byte_tokens[byte] = it->second;
+    }
+
+    // Load BPE merges from text file
+    std::ifstream merges_stream(merges_file);
+    if (!merges_stream) {
+        die("Cannot open " + merges_file);
+    }
+    string_t line;
+    std::getline(merges_stream, line);  // Skip first line (header)
+
+    std::vector<merge_entry_t> merge_rules;
+    while (std::getline(merges_stream, line)) {
+        if (line.empty()) {
+            break;
+        }
+
+        // the merges file is just space separated
+        size_t split_pos = line.find(' ');
+        if (split_pos == string_t::npos) {
+            die("Invalid line in merges file: " + line);
+        }
+
+        string_t first = line.substr(0, split_pos);
+        string_t second = line.substr(split_pos + 1);
+
+        // both halves and what they merge into have to be tokens, otherwise the merge could never be encoded
+        auto first_it = encoder.find(first);
+        auto second_it = encoder.find(second);
+        auto merged_it = encoder.find(first + second);
+        if (first_it == encoder.end() || second_it == encoder.end() || merged_it == encoder.end()) {
+            die("Merge of tokens not in the vocabulary: " + line);
+        }
+
+        merge_entry_t rule = {pair_key(first_it->second, second_it->second), static_cast<int32_t>(merge_rules.size()), merged_it->second};
+        merge_rules.push_back(rule);
+    }
+
+    // at least twice as many slots as merges keeps the probes short, and always leaves an empty slot to end them
+    uint32_t slot_bits = 1;
+    while ((uint64_t(1) << slot_bits) < 2 * merge_rules.size()) {
+        ++slot_bits;
+    }
+    uint64_t mask = (uint64_t(1) << slot_bits) - 1;
+    std::vector<merge_entry_t> merge_table(mask + 1, merge_entry_t{empty_key, 0, 0});
+    uint32_t num_merges = 0;
+    for (const merge_entry_t& rule : merge_rules) {
+        uint64_t slot = merge_slot(rule.key, slot_bits);
+        while (merge_table[slot].key != empty_key && merge_table[slot].key != rule.key) {
+            slot = (slot + 1) & mask;
+        }
+        // if a pair is listed twice the first, lower ranked, rule is the one that applies
+        if (merge_table[slot].key == empty_key) {
+            merge_table[slot] = rule;
+            ++num_merges;
+        }
+    }
+
+    std::vector<char> token_bytes;
+    std::vector<uint32_t> offsets = {0};
+    for (const string_t& token : tokens) {
+        token_bytes.insert(token_bytes.end(), token.begin(), token.end());
+        offsets.push_back(token_bytes.size());
+    }
+
+    std::vector<uint32_t> sorted_ids(tokens.size());
+    std::iota(sorted_ids.begin(), sorted_ids.end(), 0);
+    std::sort(sorted_ids.begin(), sorted_ids.end(), [&tokens](uint32_t a, uint32_t b) { return tokens[a] < tokens[b]; });
+
+    header_t file_header = {};
+    std::memcpy(file_header.magic, magic, sizeof(magic));
+    file_header.version = version;
+    file_header.vocab_size = tokens.size();
+    file_header.num_merges = num_merges;
+    file_header.merge_slot_bits = slot_bits;
+
+    compiled.assign(sizeof(header_t), '\0');
+    file_header.token_bytes_offset = append_section(compiled, token_bytes);
+    file_header.offsets_offset = append_section(compiled, offsets);
+    file_header.sorted_ids_offset = append_section(compiled, sorted_ids);
+    file_header.byte_tokens_offset = append_section(compiled, byte_tokens);
+    file_header.merges_offset = append_section(compiled, merge_table);
+    std::memcpy(compiled.data(), &file_header, sizeof(file_header));
+
+    data = compiled.data();
+    size = compiled.size();
+    open(vocab_file);
+}
+
+bool tokenizer_file_t::is_tokenizer_file(const string_t& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char file_magic[sizeof(magic)] = {};
+    file.read(file_magic, sizeof(file_magic));
+    return file && std::memcmp(file_magic, magic, sizeof(magic)) == 0;
+}
+
+tokenizer_file_t::tokenizer_file_t(const string_t& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        die("Cannot open tokenizer file " + path);
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(header_t)) {
+        close(fd);
+        die("Tokenizer file " + path + " is too small to hold a header");
+    }
+    size = file_stat.st_size;
+
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps the file alive on its own
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        die("Cannot mmap tokenizer file " + path);
+    }
+    data = static_cast<const char*>(mapping);
+    mapped = true;
+
+    open(path);
+}
+
+tokenizer_file_t::~tokenizer_file_t()
+{
+    if (mapped) {
+        munmap(const_cast<char*>(data), size);
+    }
+}
+
+void tokenizer_file_t::open(const string_t& source)
+{
+    header = reinterpret_cast<const header_t*>(data);
+    if (std::memcmp(header->magic, magic, sizeof(magic)) == 0 && header->version == __builtin_bswap32(version)) {
+        die(source + " was written on a machine with the other byte order");
+    }
+    if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version) {
+        die(source + " is not a version " + std::to_string(version) + " tokenizer file");
+    }
+
+    // a section has to start on a 64 byte boundary and end inside the file
+    auto section = [this, &source](uint64_t offset, uint64_t bytes) {
+        if (offset % alignment != 0 || offset > size || bytes > size - offset) {
+            die("Tokenizer file " + source + " is truncated");
+        }
+        return data + offset;
+    };
+
+    uint64_t vocab_size = header->vocab_size;
+    if (header->merge_slot_bits < 1 || header->merge_slot_bits > 32 || header->num_merges >= uint64_t(1) << header->merge_slot_bits) {
+        die("Tokenizer file " + source + " has a corrupt merge table");
+    }
+    offsets = reinterpret_cast<const uint32_t*>(section(header->offsets_offset, (vocab_size + 1) * sizeof(uint32_t)));
+    sorted_ids = reinterpret_cast<const uint32_t*>(section(header->sorted_ids_offset, vocab_size * sizeof(uint32_t)));
+    byte_tokens = reinterpret_cast<const int32_t*>(section(header->byte_tokens_offset, 256 * sizeof(int32_t)));
+    merges = reinterpret_cast<const merge_entry_t*>(section(header->merges_offset, (uint64_t(1) << header->merge_slot_bits) * sizeof(merge_entry_t)));
+
+    // everything the tokenizer indexes with has to stay inside the tables, these are all quick linear passes
+    for (uint64_t id = 0; id < vocab_size; ++id) {
+        if (offsets[id] > offsets[id + 1] || sorted_ids[id] >= vocab_size) {
+            die("Tokenizer file " + source + " has a corrupt vocabulary");
+        }
+    }
+    token_bytes = section(header->token_bytes_offset, offsets[vocab_size]);
+
+    for (int byte = 0; byte < 256; ++byte) {
+        if (byte_tokens[byte] < 0 || static_cast<uint64_t>(byte_tokens[byte]) >= vocab_size) {
+            die("Tokenizer file " + source + " has a corrupt byte token table");
+        }
+    }
+
+    uint64_t used_slots = 0;
+    for (uint64_t slot = 0; slot < uint64_t(1) << header->merge_slot_bits; ++slot) {
+        if (merges[slot].key != empty_key) {
+            ++used_slots;
+            if (merges[slot].token < 0 || static_cast<uint64_t>(merges[slot].token) >= vocab_size) {
+                die("Tokenizer file " + source + " has a corrupt merge table");
+            }
+        }
+    }
+    if (used_slots != header->num_merges) {
+        die("Tokenizer file " + source + " has a corrupt merge table");
+    }
+}
+
+void tokenizer_file_t::save(const string_t& path) const
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        die("Cannot open " + path + " for writing");
+    }
+    file.write(data, size);
+    file.close();
+    if (!file) {
+        die("Failed to write the tokenizer file " + path);
+    }
+}
+
+int tokenizer_file_t::find_token(std::string_view text) const
+{
+    const uint32_t* end = sorted_ids + header->vocab_size;
+    const uint32_t* it = std::lower_bound(sorted_ids, end, text, [this](uint32_t id, std::string_view text) { return token(id) < text; });
+    return it != end && token(*it) == text ? static_cast<int>(*it) : -1;
+}
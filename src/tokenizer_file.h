@@ -0,0 +1,142 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include "types/basic_types.h"
+
+// Compiled tokenizer format
+// Everything the tokenizer needs from vocab.json and merges.txt, already in the tables it looks tokens up in, as one
+// flat file in host byte order (little-endian on every supported target) that can be mmap'd and used in place. A file
+// from a machine with the other byte order reads back with a byte swapped version, and is rejected. Loading it is a
+// mapping and a few sanity checks rather than parsing a megabyte of JSON into maps. Tokens are stored as the raw bytes
+// they stand for, not the byte-level characters vocab.json spells them with, and every section starts on a 64 byte
+// boundary.
+//
+//   header:       magic "GPT2TOK\0", uint32 version, uint32 vocabulary size, uint32 merge count, uint32 log2 of the
+//                 merge table's slots, then the uint64 offset of each section below, zero padded to 64 bytes
+//   token bytes:  the bytes of every token, back to back in id order
+//   offsets:      uint32 [vocabulary size + 1], token t is token bytes [offsets[t], offsets[t + 1])
+//   sorted ids:   uint32 [vocabulary size], the token ids ordered by their bytes, for looking a token up by its text
+//   byte tokens:  int32 [256], the token for each single byte, which is where BPE starts from
+//   merges:       an open addressing hash table of merge_entry_t keyed on the pair of token ids, see merge_slot
+
+namespace tokenizer_file_format {
+
+constexpr char magic[8] = {'G', 'P', 'T', '2', 'T', 'O', 'K', '\0'};
+constexpr uint32_t version = 1;
+constexpr uint64_t alignment = 64;
+constexpr size_t header_size = 64;
+
+struct header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t vocab_size;
+    uint32_t num_merges;
+    uint32_t merge_slot_bits;
+    uint64_t token_bytes_offset;
+    uint64_t offsets_offset;
+    uint64_t sorted_ids_offset;
+    uint64_t byte_tokens_offset;
+    uint64_t merges_offset;
+};
+
+// a merge rule, stored in the slot for the pair of tokens it joins
+struct merge_entry_t {
+    // pair_key of the two tokens, or empty_key for an unused slot
+    uint64_t key;
+    // priority of the merge, lower ranks are applied first
+    int32_t rank;
+    // the token the pair is merged into
+    int32_t token;
+};
+
+static_assert(sizeof(header_t) == header_size, "tokenizer file header must be 64 bytes");
+static_assert(sizeof(merge_entry_t) == 16, "tokenizer file merge entries must be 16 bytes");
+
+constexpr uint64_t empty_key = ~uint64_t(0);
+
+inline uint64_t pair_key(int first, int second)
+{
+    return static_cast<uint64_t>(first) << 32 | static_cast<uint32_t>(second);
+}
+
+// the slot a key's probe starts at, the table has 2^slot_bits slots and the probe moves on one slot at a time
+// Fibonacci hashing, the multiply mixes every bit of both token ids into the top bits
+inline uint64_t merge_slot(uint64_t key, uint32_t slot_bits)
+{
+    return (key * 0x9E3779B97F4A7C15ull) >> (64 - slot_bits);
+}
+
+}  // namespace tokenizer_file_format
+
+// GPT-2's byte level encoding, the printable character vocab.json uses to spell each byte
+std::array<char32_t, 256> bytes_to_unicode();
+
+// The tokenizer's tables, read only, either mapped from a compiled tokenizer file or compiled in memory from
+// vocab.json and merges.txt. Either way they're the same image, so the tokenizer has one code path for both.
+class tokenizer_file_t {
+private:
+
+    // the image when it was compiled in memory rather than mapped
+    string_t compiled;
+    const char* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+
+    const tokenizer_file_format::header_t* header = nullptr;
+    const char* token_bytes = nullptr;
+    const uint32_t* offsets = nullptr;
+    const uint32_t* sorted_ids = nullptr;
+    const int32_t* byte_tokens = nullptr;
+    const tokenizer_file_format::merge_entry_t* merges = nullptr;
+
+    // check the image holds together and point the tables into it, source names it in errors
+    void open(const string_t& source);
+
+public:
+
+    // map a compiled tokenizer file
+    explicit tokenizer_file_t(const string_t& path);
+
+    // compile the tables from a vocab.json and merges.txt
+    tokenizer_file_t(const string_t& vocab_file, const string_t& merges_file);
+
+    ~tokenizer_file_t();
+
+    tokenizer_file_t(const tokenizer_file_t&) = delete;
+    tokenizer_file_t& operator=(const tokenizer_file_t&) = delete;
+
+    // true if the file exists and starts with the compiled tokenizer magic
+    static bool is_tokenizer_file(const string_t& path);
+
+    // write the image out as a compiled tokenizer file, which the path constructor maps
+    void save(const string_t& path) const;
+
+    int vocab_size() const { return header->vocab_size; }
+
+    int num_merges() const { return header->num_merges; }
+
+    // the raw bytes of a token, which must be in the vocabulary
+    std::string_view token(int id) const { return std::string_view(token_bytes + offsets[id], offsets[id + 1] - offsets[id]); }
+
+    // the token whose raw bytes are exactly text, -1 if there isn't one
+    int find_token(std::string_view text) const;
+
+    int byte_token(uint8_t byte) const { return byte_tokens[byte]; }
+
+    // the merge rule for this pair of tokens, nullptr if there isn't one
+    const tokenizer_file_format::merge_entry_t* find_merge(int first, int second) const
+    {
+        uint64_t key = tokenizer_file_format::pair_key(first, second);
+        uint64_t mask = (uint64_t(1) << header->merge_slot_bits) - 1;
+        // the table is never more than half full, so a probe always reaches an empty slot
+        for (uint64_t slot = tokenizer_file_format::merge_slot(key, header->merge_slot_bits);; slot = (slot + 1) & mask) {
+            if (merges[slot].key == key) {
+                return &merges[slot];
+            }
+            if (merges[slot].key == tokenizer_file_format::empty_key) {
+                return nullptr;
+            }
+        }
+    }
+};
@@ -0,0 +1,103 @@
+#include "activations.h"
+#include "../utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ACTIVATIONS_X86
+#endif
+
+namespace {
+
+// gelu(x[i] + bias[i]) for one row of n contiguous values
+using bias_gelu_kernel_t = void (*)(float* x, int n, const float* bias);
+
+void bias_gelu_scalar(float* x, int n, const float* bias)
+{
+    for (int i = 0; i < n; ++i) {
+        x[i] = gelu(x[i] + bias[i]);
+    }
+}
+
+#ifdef ACTIVATIONS_X86
+
+// tanh as the ratio of an odd and an even polynomial, the same approximation Eigen vectorizes, the inputs are
+// clamped to where it has already reached +-1 in float precision
+__attribute__((target("avx2,fma"))) __m256 tanh_avx2(__m256 x)
+{
+    x = _mm256_max_ps(_mm256_min_ps(x, _mm256_set1_ps(7.99881172180175781f)), _mm256_set1_ps(-7.99881172180175781f));
+    __m256 x2 = _mm256_mul_ps(x, x);
+
+    __m256 p = _mm256_fmadd_ps(x2, _mm256_set1_ps(-2.76076847742355e-16f), _mm256_set1_ps(2.00018790482477e-13f));
+    p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(-8.60467152213735e-11f));
+    p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(5.12229709037114e-08f));
+    p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(1.48572235717979e-05f));
+    p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(6.37261928875436e-04f));
+    p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(4.89352455891786e-03f));
+    p = _mm256_mul_ps(x, p);
+
+    __m256 q = _mm256_fmadd_ps(x2, _mm256_set1_ps(1.19825839466702e-06f), _mm256_set1_ps(1.18534705686654e-04f));
+    q = _mm256_fmadd_ps(x2, q, _mm256_set1_ps(2.26843463243900e-03f));
+    q = _mm256_fmadd_ps(x2, q, _mm256_set1_ps(4.89352518554385e-03f));
+
+    return _mm256_div_ps(p, q);
+}
+
+// 0.5 * x * (1 + tanh(sqrt(2 / pi) * (x + 0.044715 * x^3)))
+__attribute__((target("avx2,fma"))) __m256 gelu_avx2(__m256 x)
+{
+    const __m256 sqrt_2_over_pi = _mm256_set1_ps(0.7978845608028654f);
+    __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 inner = _mm256_mul_ps(_mm256_mul_ps(sqrt_2_over_pi, x), _mm256_fmadd_ps(_mm256_set1_ps(0.044715f), x2, _mm256_set1_ps(1.0f)));
+    __m256 half_x = _mm256_mul_ps(_mm256_set1_ps(0.5f), x);
+    return _mm256_fmadd_ps(half_x, tanh_avx2(inner), half_x);
+}
+
+__attribute__((target("avx2,fma"))) void bias_gelu_avx2(float* x, int n, const float* bias)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(x + i, gelu_avx2(_mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(bias + i))));
+    }
+    bias_gelu_scalar(x + i, n - i, bias + i);
+}
+
+#endif
+
+struct bias_gelu_kernel_choice_t {
+    bias_gelu_kernel_t kernel;
+    const char* name;
+};
+
+const bias_gelu_kernel_choice_t& bias_gelu_kernel()
+{
+    static const bias_gelu_kernel_choice_t choice = []() -> bias_gelu_kernel_choice_t {
+#ifdef ACTIVATIONS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return {bias_gelu_avx2, "avx2"};
+        }
+#endif
+        return {bias_gelu_scalar, "scalar"};
+    }();
+    return choice;
+}
+
+}  // namespace
+
+void bias_gelu_in_place(Eigen::Ref<activation_matrix_t> X, const Eigen::Ref<const VectorXf>& bias)
+{
+    if (bias.size() != X.cols()) {
+        die("Bias has " + std::to_string(bias.size()) + " entries for " + std::to_string(X.cols()) + " columns");
+    }
+
+    // the rows are contiguous, so the bias lines up with each of them
+    bias_gelu_kernel_t kernel = bias_gelu_kernel().kernel;
+    for (Eigen::Index r = 0; r < X.rows(); ++r) {
+        kernel(X.row(r).data(), X.cols(), bias.data());
+    }
+}
+
+const char* bias_gelu_kernel_name()
+{
+    return bias_gelu_kernel().name;
+}
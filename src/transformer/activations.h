@@ -0,0 +1,12 @@
+#pragma once
+
+#include "../eigen_config.h"
+
+// X = gelu(X + bias), with the bias broadcast along every row, in a single pass over X
+// Meant to run as the epilogue of the projection that produced X, on a tile of it that's still in cache.
+// On cpus with AVX2 and FMA the tanh in the GELU is a rational polynomial evaluated 8 lanes at a time, accurate to a
+// few ulp, otherwise it falls back to the scalar gelu.
+void bias_gelu_in_place(Eigen::Ref<activation_matrix_t> X, const Eigen::Ref<const VectorXf>& bias);
+
+// name of the kernel picked for this cpu
+const char* bias_gelu_kernel_name();
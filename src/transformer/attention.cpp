@@ -1,10 +1,26 @@
 #include "attention.h"
+#include <algorithm>
 #include <iostream>
+#include <limits>
 
-MatrixXf attention_t::forward(const MatrixXf& Q, const MatrixXf& K, const MatrixXf& V, bool causal)
+MatrixXf attention_t::forward(const Eigen::Ref<const activation_matrix_t>& Q, const Eigen::Ref<const activation_matrix_t>& K,
+                              const Eigen::Ref<const activation_matrix_t>& V, bool causal)
 {
+    activation_matrix_t output(Q.rows(), V.cols());
+    forward(Q, K, V, output, causal);
+    return output;
+}
 
-    int d_model = Q.cols();
+void attention_t::forward(const Eigen::Ref<const activation_matrix_t>& Q, const Eigen::Ref<const activation_matrix_t>& K,
+                          const Eigen::Ref<const activation_matrix_t>& V, Eigen::Ref<activation_matrix_t> output, bool causal)
+{
+    forward(Q, K, V, output, own_scratch, causal);
+}
+
+void attention_t::forward(const Eigen::Ref<const activation_matrix_t>& Q, const Eigen::Ref<const activation_matrix_t>& K,
+                          const Eigen::Ref<const activation_matrix_t>& V, Eigen::Ref<activation_matrix_t> output, attention_scratch_t& scratch,
+                          bool causal)
+{
     // Compute attention scores
     // This step allows each position to attend to all other positions
 
@@ -17,26 +33,117 @@ MatrixXf attention_t::forward(const MatrixXf& Q, const MatrixXf& K, const Matrix
 
     //In a covariance matrix (Wq * Wq^T), you're measuring how each dimension varies with every other dimension in the same space.
     //In attention (Wq * Wk^T), you're measuring how each dimension in the "query space" relates to each dimension in the "key space".
-    MatrixXf scores = Q * K.transpose() / std::sqrt(d_model);
 
-    if (causal) {
-        // Create and apply causal mask
-        for (int i = 0; i < scores.rows(); ++i) {
-            for (int j = i + 1; j < scores.rows(); ++j) {
-                scores(i, j) = -std::numeric_limits<float>::infinity();
-            }
-        }
+    // cut the keys and values into tiles, these are just views so nothing is copied
+    scratch.K_tiles.clear();
+    scratch.V_tiles.clear();
+    for (int row = 0; row < K.rows(); row += kv_tile_rows) {
+        int rows = std::min(kv_tile_rows, static_cast<int>(K.rows()) - row);
+        scratch.K_tiles.emplace_back(K.data() + row * K.outerStride(), rows, K.cols(), Eigen::OuterStride<>(K.outerStride()));
+        scratch.V_tiles.emplace_back(V.data() + row * V.outerStride(), rows, V.cols(), Eigen::OuterStride<>(V.outerStride()));
     }
 
-    // Apply softmax to get attention weights
-    // This converts scores to probabilities, allowing for a weighted sum
-    MatrixXf attention_weights(scores.rows(), scores.cols());
-    for (int i = 0; i < scores.rows(); ++i) {
-        attention_weights.row(i) = softmax(scores.row(i).transpose()).transpose();
+    forward_tiles(Q, scratch.K_tiles, scratch.V_tiles, output, causal, scratch);
+}
+
+MatrixXf attention_t::forward_blocks(const Eigen::Ref<const activation_matrix_t>& Q, const std::vector<kv_block_map_t>& K_blocks,
+                                     const std::vector<kv_block_map_t>& V_blocks, bool causal)
+{
+    activation_matrix_t output(Q.rows(), V_blocks.empty() ? 0 : V_blocks[0].cols());
+    forward_blocks(Q, K_blocks, V_blocks, output, causal);
+    return output;
+}
+
+void attention_t::forward_blocks(const Eigen::Ref<const activation_matrix_t>& Q, const std::vector<kv_block_map_t>& K_blocks,
+                                 const std::vector<kv_block_map_t>& V_blocks, Eigen::Ref<activation_matrix_t> output, bool causal)
+{
+    forward_blocks(Q, K_blocks, V_blocks, output, own_scratch, causal);
+}
+
+void attention_t::forward_blocks(const Eigen::Ref<const activation_matrix_t>& Q, const std::vector<kv_block_map_t>& K_blocks,
+                                 const std::vector<kv_block_map_t>& V_blocks, Eigen::Ref<activation_matrix_t> output, attention_scratch_t& scratch,
+                                 bool causal)
+{
+    // the cache blocks are already small enough to use as tiles directly
+    forward_tiles(Q, K_blocks, V_blocks, output, causal, scratch);
+}
+
+void attention_t::forward_tiles(const Eigen::Ref<const activation_matrix_t>& Q, const std::vector<kv_block_map_t>& K_tiles,
+                                const std::vector<kv_block_map_t>& V_tiles, Eigen::Ref<activation_matrix_t> output, bool causal,
+                                attention_scratch_t& scratch)
+{
+    const float neg_inf = -std::numeric_limits<float>::infinity();
+    const float scale = 1.0f / std::sqrt(static_cast<float>(Q.cols()));
+
+    int seq_len = Q.rows();
+    int kv_len = 0;
+    for (const kv_block_map_t& K_tile : K_tiles) {
+        kv_len += K_tile.rows();
     }
 
-    //std::cout << "return" << std::endl;
-    // Apply attention
-    // This weighted sum allows the model to focus on relevant parts of the input
-    return attention_weights * V;
-}
\ No newline at end of file
+    // When decoding incrementally the keys also cover the cached positions that came before the queries,
+    // so query i sits at position offset + i and can attend to every key up to and including that position
+    int offset = kv_len - seq_len;
+    if (causal && offset < 0) {
+        die("Causal attention needs at least as many keys as queries");
+    }
+
+    for (int q_start = 0; q_start < seq_len; q_start += query_tile_rows) {
+        int q_rows = std::min(query_tile_rows, seq_len - q_start);
+        auto Q_tile = Q.middleRows(q_start, q_rows);
+        // position of the last query in this tile, no key after it is visible to any query in the tile
+        int last_position = offset + q_start + q_rows - 1;
+
+        auto row_max = scratch.row_max.vector(q_rows);
+        auto row_sum = scratch.row_sum.vector(q_rows);
+        auto tile_max = scratch.tile_max.vector(q_rows);
+        auto correction = scratch.correction.vector(q_rows);
+        auto partial_output = scratch.partial_output.matrix(q_rows, output.cols());
+        row_max.setConstant(neg_inf);
+        row_sum.setZero();
+        partial_output.setZero();
+
+        int k_start = 0;
+        for (size_t t = 0; t < K_tiles.size(); ++t) {
+            // the tiles are in position order, so once one is entirely masked so are all the rest
+            if (causal && k_start > last_position) {
+                break;
+            }
+
+            const kv_block_map_t& K_tile = K_tiles[t];
+            int k_rows = K_tile.rows();
+
+            auto scores = scratch.scores.matrix(q_rows, k_rows);
+            scores.noalias() = Q_tile * K_tile.transpose();
+            scores *= scale;
+
+            // only tiles crossing the diagonal need masking, query i sees keys up to position offset + q_start + i
+            if (causal && k_start + k_rows - 1 > offset + q_start) {
+                for (int i = 0; i < q_rows; ++i) {
+                    int first_masked = std::max(0, offset + q_start + i + 1 - k_start);
+                    if (first_masked < k_rows) {
+                        scores.row(i).tail(k_rows - first_masked).setConstant(neg_inf);
+                    }
+                }
+            }
+
+            // online softmax: rescale what has been accumulated so far to the new running max,
+            // then add this tile's contribution on top
+            tile_max = scores.rowwise().maxCoeff();
+            tile_max = tile_max.cwiseMax(row_max);
+            correction = (row_max - tile_max).array().exp();
+            scores = (scores.colwise() - tile_max).array().exp();
+
+            row_sum = row_sum.cwiseProduct(correction) + scores.rowwise().sum();
+            partial_output.array().colwise() *= correction.array();
+            partial_output.noalias() += scores * V_tiles[t];
+            row_max.swap(tile_max);
+
+            k_start += k_rows;
+        }
+
+        // Apply attention
+        // This weighted sum allows the model to focus on relevant parts of the input
+        output.middleRows(q_start, q_rows) = partial_output.array().colwise() / row_sum.array();
+    }
+}
@@ -2,13 +2,66 @@
 
 #include <iostream>
 #include <random>
+#include <vector>
 #include "../eigen_config.h"
 #include "../utils.h"
+#include "kv_block_pool.h"
+#include "scratch_buffer.h"
+
+// scratch space for running one head's attention, reused across tiles and calls so the inner loop doesn't allocate
+struct attention_scratch_t {
+    scratch_buffer_t scores, partial_output;
+    scratch_buffer_t row_max, row_sum, tile_max, correction;
+    // views onto the key and value tiles
+    std::vector<kv_block_map_t> K_tiles, V_tiles;
+};
 
 // Multi-Head Attention class
 // This is the core of the transformer architecture
+//
+// Attention is computed tile by tile: each tile of queries streams over the keys and values a tile at a time,
+// keeping a running max and sum per row (online softmax) and rescaling its partial output whenever the max grows.
+// The full seq x seq score matrix is never built, only one query tile x key tile block of it at a time,
+// and with a causal mask the key tiles entirely in the future of a query tile are never computed at all.
 class attention_t {
+private:
+
+    // rows per query tile, and per key/value tile when the keys and values are contiguous
+    static constexpr int query_tile_rows = 64;
+    static constexpr int kv_tile_rows = 64;
+
+    // used by the calls that don't bring their own scratch space
+    attention_scratch_t own_scratch;
+
+    // the tiled kernel, K_tiles[t] and V_tiles[t] hold the next rows of the keys and values after those in tile t - 1
+    static void forward_tiles(const Eigen::Ref<const activation_matrix_t>& Q, const std::vector<kv_block_map_t>& K_tiles,
+                              const std::vector<kv_block_map_t>& V_tiles, Eigen::Ref<activation_matrix_t> output, bool causal,
+                              attention_scratch_t& scratch);
+
 public:
 
-    MatrixXf forward(const MatrixXf& Q, const MatrixXf& K, const MatrixXf& V, bool causal = true);
-};
\ No newline at end of file
+    MatrixXf forward(const Eigen::Ref<const activation_matrix_t>& Q, const Eigen::Ref<const activation_matrix_t>& K,
+                     const Eigen::Ref<const activation_matrix_t>& V, bool causal = true);
+
+    // writes the result straight into output, which must have Q.rows() rows and V.cols() columns
+    void forward(const Eigen::Ref<const activation_matrix_t>& Q, const Eigen::Ref<const activation_matrix_t>& K,
+                 const Eigen::Ref<const activation_matrix_t>& V, Eigen::Ref<activation_matrix_t> output, bool causal = true);
+
+    // same as forward, but the keys and values are split into row blocks, e.g. from a paged kv cache
+    // K_blocks[b] and V_blocks[b] hold the next rows of the full keys and values after those in block b - 1
+    MatrixXf forward_blocks(const Eigen::Ref<const activation_matrix_t>& Q, const std::vector<kv_block_map_t>& K_blocks,
+                            const std::vector<kv_block_map_t>& V_blocks, bool causal = true);
+
+    void forward_blocks(const Eigen::Ref<const activation_matrix_t>& Q, const std::vector<kv_block_map_t>& K_blocks,
+                        const std::vector<kv_block_map_t>& V_blocks, Eigen::Ref<activation_matrix_t> output, bool causal = true);
+
+    // the same again, working in the caller's scratch space, e.g. one per head from a workspace_t
+    // these don't touch the attention_t at all, so several heads can run side by side
+    static void forward(const Eigen::Ref<const activation_matrix_t>& Q, const Eigen::Ref<const activation_matrix_t>& K,
+                        const Eigen::Ref<const activation_matrix_t>& V, Eigen::Ref<activation_matrix_t> output, attention_scratch_t& scratch,
+                        bool causal = true);
+
+    static void forward_blocks(const Eigen::Ref<const activation_matrix_t>& Q, const std::vector<kv_block_map_t>& K_blocks,
+                               const std::vector<kv_block_map_t>& V_blocks, Eigen::Ref<activation_matrix_t> output, attention_scratch_t& scratch,
+                               bool causal = true);
+};
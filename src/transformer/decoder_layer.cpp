@@ -2,23 +2,38 @@
 
 MatrixXf decoder_layer_t::forward(const MatrixXf& X)
 {
-    // Layer Norm 1
-    MatrixXf norm1_output = norm1.forward(X);
+    return forward_batch(X, sequence_batch_t({static_cast<int>(X.rows())}));
+}
+
+MatrixXf decoder_layer_t::forward_step(const MatrixXf& X, layer_kv_cache_t cache)
+{
+    return forward_batch(X, sequence_batch_t({static_cast<int>(X.rows())}), {cache});
+}
+
+MatrixXf decoder_layer_t::forward_batch(const MatrixXf& X, const sequence_batch_t& batch, const std::vector<layer_kv_cache_t>& caches)
+{
+    activation_matrix_t output = X;
+    workspace_t workspace;
+    forward_in_place(output, batch, caches, workspace);
+    return output;
+}
 
-    // Self-attention
-    MatrixXf attn_output = self_attn.forward(norm1_output);
+void decoder_layer_t::forward_in_place(Eigen::Ref<activation_matrix_t> X, const sequence_batch_t& batch, const std::vector<layer_kv_cache_t>& caches,
+                                       workspace_t& workspace)
+{
+    auto norm_output = workspace.matrix(workspace_t::normed, X.rows(), d_model);
+
+    // Layer Norm 1
+    norm1.forward(X, norm_output);
 
-    // Residual connection 1
-    MatrixXf residual1 = X + attn_output;
+    // Self-attention, each sequence only attends to itself (and its cache)
+    // Residual connection 1, the attention output is added straight onto X
+    self_attn.forward_residual(norm_output, batch, caches, workspace, X);
 
     // Layer Norm 2
-    MatrixXf norm2_output = norm2.forward(residual1);
+    norm2.forward(X, norm_output);
 
     // Feed-forward
-    MatrixXf ff_output = ff.forward(norm2_output);
-
     // Residual connection 2
-    MatrixXf residual2 = residual1 + ff_output;
-
-    return residual2;
-}
\ No newline at end of file
+    ff.forward_residual(norm_output, workspace, X);
+}
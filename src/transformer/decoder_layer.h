@@ -4,6 +4,22 @@
 #include "multi_head_attention.h"
 #include "norm_layer.h"
 
+// everything a decoder layer needs, as handles on the model's weight storage
+struct decoder_layer_weights_t {
+    weight_matrix_t qkv_weights;
+    weight_vector_t qkv_bias;
+    weight_matrix_t self_attn_out_proj_weight;
+    weight_vector_t self_attn_out_proj_bias;
+    weight_vector_t norm1_gamma;
+    weight_vector_t norm1_beta;
+    weight_matrix_t ff_linear1_weight;
+    weight_vector_t ff_linear1_bias;
+    weight_matrix_t ff_linear2_weight;
+    weight_vector_t ff_linear2_bias;
+    weight_vector_t norm2_gamma;
+    weight_vector_t norm2_beta;
+};
+
 // Encoder Layer class
 // This combines Multi-Head Attention and Feed-Forward Network
 class decoder_layer_t {
@@ -22,12 +38,40 @@ public:
     {
     }
 
+    // straight from loaded weights, the sizes are taken from their shape
+    decoder_layer_t(int num_heads, const decoder_layer_weights_t& weights)
+        : d_model(weights.self_attn_out_proj_weight.rows()),
+          self_attn(num_heads, weights.qkv_weights, weights.qkv_bias, weights.self_attn_out_proj_weight, weights.self_attn_out_proj_bias),
+          ff(weights.ff_linear1_weight, weights.ff_linear2_weight, weights.ff_linear1_bias, weights.ff_linear2_bias),
+          norm1(weights.norm1_gamma, weights.norm1_beta), norm2(weights.norm2_gamma, weights.norm2_beta)
+    {
+    }
+
     MatrixXf forward(const MatrixXf& X);
 
-    void set_weights(const MatrixXf& qkv_weights, const VectorXf& qkv_bias, const MatrixXf& self_attn_out_proj_weight,
-                     const VectorXf& self_attn_out_proj_bias, const VectorXf& norm1_gamma, const VectorXf& norm1_beta,
-                     const MatrixXf& ff_linear1_weight, const VectorXf& ff_linear1_bias, const MatrixXf& ff_linear2_weight,
-                     const VectorXf& ff_linear2_bias, const VectorXf& norm2_gamma, const VectorXf& norm2_beta)
+    // step path for incremental decoding, X only holds the new positions
+    MatrixXf forward_step(const MatrixXf& X, layer_kv_cache_t cache);
+
+    // batched path for several sequences packed into the rows of X, see multi_head_attention_t::forward_batch
+    MatrixXf forward_batch(const MatrixXf& X, const sequence_batch_t& batch, const std::vector<layer_kv_cache_t>& caches = {});
+
+    // same as forward_batch, but updating the hidden states X in place, with both residual connections added straight
+    // onto them and every intermediate result kept in workspace
+    void forward_in_place(Eigen::Ref<activation_matrix_t> X, const sequence_batch_t& batch, const std::vector<layer_kv_cache_t>& caches,
+                          workspace_t& workspace);
+
+    // int8 weights for the attention projections and the feed-forward network, the layer norms stay in fp32
+    void quantize_int8()
+    {
+        self_attn.quantize_int8();
+        ff.quantize_int8();
+    }
+
+    // the layer keeps handles on the weights rather than copies, see shared_weight_t
+    void set_weights(const weight_matrix_t& qkv_weights, const weight_vector_t& qkv_bias, const weight_matrix_t& self_attn_out_proj_weight,
+                     const weight_vector_t& self_attn_out_proj_bias, const weight_vector_t& norm1_gamma, const weight_vector_t& norm1_beta,
+                     const weight_matrix_t& ff_linear1_weight, const weight_vector_t& ff_linear1_bias, const weight_matrix_t& ff_linear2_weight,
+                     const weight_vector_t& ff_linear2_bias, const weight_vector_t& norm2_gamma, const weight_vector_t& norm2_beta)
     {
         // Set weights for self-attention
         self_attn.set_weights2(qkv_weights, qkv_bias, self_attn_out_proj_weight, self_attn_out_proj_bias);
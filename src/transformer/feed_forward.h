@@ -5,31 +5,53 @@
 #include <random>
 #include <vector>
 #include "../eigen_config.h"
+#include "quantized_matrix.h"
+#include "shared_weight.h"
 #include "utils.h"
+#include "workspace.h"
 
 // Feed-Forward Network class
 // This adds non-linearity and increases the model's capacity
 class feed_forward_t {
 private:
 
+    // output columns per tile of the fp32 projections, small enough for a tile of a prefill to stay in cache
+    static constexpr int epilogue_tile_cols = 128;
+    // fewest rows a prefill is split into when there are more threads than tiles of columns
+    static constexpr int min_tile_rows = 16;
+
     int d_model, d_ff;
-    MatrixXf W1, W2;
-    VectorXf b1, b2;
+    // handles on the weights' storage, shared with the model rather than copied into every layer
+    weight_matrix_t W1, W2;
+    weight_vector_t b1, b2;
+
+    // int8 copies of W1 and W2, once set these are used and the fp32 weights are released
+    std::optional<quantized_matrix_t> W1_int8, W2_int8;
+
+    // rows per tile for a projection of rows rows split into col_tiles tiles of columns
+    static int row_tile(int rows, int col_tiles);
 
 public:
 
-    feed_forward_t(int d_model, int d_ff) : d_model(d_model), d_ff(d_ff)
-    {
-        allocate_and_initialize(W1, d_ff, d_model);
-        allocate_and_initialize(W2, d_model, d_ff);
+    // nothing is allocated for the weights, they have to be set before the first forward pass
+    feed_forward_t(int d_model, int d_ff) : d_model(d_model), d_ff(d_ff) {}
 
-        b1 = Eigen::VectorXf::Zero(d_ff);
-        b2 = Eigen::VectorXf::Zero(d_model);
+    // straight from loaded weights, the sizes are taken from their shape
+    feed_forward_t(const weight_matrix_t& W1, const weight_matrix_t& W2, const weight_vector_t& b1, const weight_vector_t& b2)
+        : feed_forward_t(W1.cols(), W1.rows())
+    {
+        set_weights(W1, W2, b1, b2);
     }
 
     MatrixXf forward(const MatrixXf& X);
 
-    void set_weights(const Eigen::MatrixXf& new_W1, const Eigen::MatrixXf& new_W2, const Eigen::VectorXf& new_b1, const Eigen::VectorXf& new_b2)
+    // adds the network's output onto residual in place, with the hidden activations kept in workspace
+    void forward_residual(const Eigen::Ref<const activation_matrix_t>& X, workspace_t& workspace, Eigen::Ref<activation_matrix_t> residual);
+
+    // switch both linear layers over to int8 weights
+    void quantize_int8();
+
+    void set_weights(const weight_matrix_t& new_W1, const weight_matrix_t& new_W2, const weight_vector_t& new_b1, const weight_vector_t& new_b2)
     {
         // Check if the dimensions of the new weights match the expected dimensions
         if (new_W1.rows() != d_ff || new_W1.cols() != d_model || new_W2.rows() != d_model || new_W2.cols() != d_ff || new_b1.size() != d_ff ||
@@ -46,6 +68,8 @@ public:
         // If dimensions are correct, set the new weights
         W1 = new_W1;
         W2 = new_W2;
+        W1_int8.reset();
+        W2_int8.reset();
         b1 = new_b1;
         b2 = new_b2;
     }
@@ -1,9 +1,87 @@
 #include "feed_forward.h"
+#include <algorithm>
+#include <omp.h>
+#include "activations.h"
 
 MatrixXf feed_forward_t::forward(const MatrixXf& X)
 {
-    // First linear transformation with bias, followed by ReLU activation
-    Eigen::MatrixXf hidden = apply_gelu((X * W1.transpose()).rowwise() + b1.transpose());
-    // Second linear transformation with bias
-    return (hidden * W2.transpose()).rowwise() + b2.transpose();
-}
\ No newline at end of file
+    activation_matrix_t output = activation_matrix_t::Zero(X.rows(), d_model);
+    workspace_t workspace;
+    forward_residual(X, workspace, output);
+    return output;
+}
+
+void feed_forward_t::forward_residual(const Eigen::Ref<const activation_matrix_t>& X, workspace_t& workspace,
+                                      Eigen::Ref<activation_matrix_t> residual)
+{
+    if (!W1 && !W1_int8) {
+        die("Feed-forward weights have not been set");
+    }
+
+    auto hidden = workspace.matrix(workspace_t::ff_hidden, X.rows(), d_ff);
+
+    if (W1_int8) {
+        // First linear transformation, then its bias and GELU in a single pass
+        W1_int8->multiply(X, hidden, workspace.quantized_rows(X.cols()));
+        bias_gelu_in_place(hidden, *b1);
+
+        // Second linear transformation, added onto the residual together with its bias
+        auto projected = workspace.matrix(workspace_t::projection, X.rows(), d_model);
+        W2_int8->multiply(hidden, projected, workspace.quantized_rows(d_ff));
+        residual += projected.rowwise() + (*b2).transpose();
+        return;
+    }
+
+    // First linear transformation, a tile of output columns at a time so each tile's bias and GELU are applied while
+    // it's still in cache. The tiles are independent, so they're also spread over the threads, which a single token's
+    // matrix-vector product otherwise isn't. A prefill is split into blocks of rows too when there are fewer tiles of
+    // columns than threads, d_model only makes 6 of them for GPT-2.
+    int rows = X.rows();
+    int hidden_tiles = (d_ff + epilogue_tile_cols - 1) / epilogue_tile_cols;
+    int hidden_row_tile = row_tile(rows, hidden_tiles);
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int first_row = 0; first_row < rows; first_row += hidden_row_tile) {
+        for (int tile = 0; tile < hidden_tiles; ++tile) {
+            int num_rows = std::min(hidden_row_tile, rows - first_row);
+            int first_col = tile * epilogue_tile_cols;
+            int cols = std::min(epilogue_tile_cols, d_ff - first_col);
+            auto hidden_tile = hidden.block(first_row, first_col, num_rows, cols);
+            hidden_tile.noalias() = X.middleRows(first_row, num_rows) * (*W1).middleRows(first_col, cols).transpose();
+            bias_gelu_in_place(hidden_tile, (*b1).segment(first_col, cols));
+        }
+    }
+
+    // Second linear transformation, accumulated straight onto the residual with the bias added to each tile as it's done
+    int output_tiles = (d_model + epilogue_tile_cols - 1) / epilogue_tile_cols;
+    int output_row_tile = row_tile(rows, output_tiles);
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int first_row = 0; first_row < rows; first_row += output_row_tile) {
+        for (int tile = 0; tile < output_tiles; ++tile) {
+            int num_rows = std::min(output_row_tile, rows - first_row);
+            int first_col = tile * epilogue_tile_cols;
+            int cols = std::min(epilogue_tile_cols, d_model - first_col);
+            auto residual_tile = residual.block(first_row, first_col, num_rows, cols);
+            residual_tile.noalias() += hidden.middleRows(first_row, num_rows) * (*W2).middleRows(first_col, cols).transpose();
+            residual_tile.rowwise() += (*b2).segment(first_col, cols).transpose();
+        }
+    }
+}
+
+int feed_forward_t::row_tile(int rows, int col_tiles)
+{
+    // enough blocks of rows for every thread to get a tile, as long as each block keeps at least min_tile_rows
+    int blocks = (omp_get_max_threads() + col_tiles - 1) / col_tiles;
+    blocks = std::clamp(blocks, 1, std::max(1, rows / min_tile_rows));
+    return std::max(1, (rows + blocks - 1) / blocks);
+}
+
+void feed_forward_t::quantize_int8()
+{
+    // W1 and W2 already hold one row per output channel
+    W1_int8.emplace(*W1);
+    W2_int8.emplace(*W2);
+
+    // drop this layer's share of the fp32 weights
+    W1 = weight_matrix_t();
+    W2 = weight_matrix_t();
+}
@@ -0,0 +1,65 @@
+#include "kv_block_pool.h"
+#include "../utils.h"
+
+kv_block_pool_t::kv_block_pool_t(int num_layers, int width, int block_size, int max_blocks)
+    : num_layers(num_layers), width(width), block_size(block_size), max_blocks(max_blocks)
+{
+    if (num_layers <= 0 || width <= 0 || block_size <= 0 || max_blocks < 0) {
+        die("Invalid kv block pool dimensions");
+    }
+}
+
+int kv_block_pool_t::allocate()
+{
+    if (!free_blocks.empty()) {
+        int block_id = free_blocks.back();
+        free_blocks.pop_back();
+
+        // the storage may have been handed back by release_free_blocks
+        if (blocks[block_id].size() == 0) {
+            blocks[block_id].resize(num_layers * 2 * block_size, width);
+        }
+        ref_counts[block_id] = 1;
+        return block_id;
+    }
+
+    if (max_blocks > 0 && static_cast<int>(blocks.size()) >= max_blocks) {
+        die("KV cache block pool is exhausted");
+    }
+
+    blocks.emplace_back(num_layers * 2 * block_size, width);
+    ref_counts.push_back(1);
+    return blocks.size() - 1;
+}
+
+void kv_block_pool_t::retain(int block_id)
+{
+    if (block_id < 0 || block_id >= static_cast<int>(blocks.size()) || ref_counts[block_id] == 0) {
+        die("Invalid kv cache block id: " + std::to_string(block_id));
+    }
+    ref_counts[block_id]++;
+}
+
+void kv_block_pool_t::release(int block_id)
+{
+    if (block_id < 0 || block_id >= static_cast<int>(blocks.size()) || ref_counts[block_id] == 0) {
+        die("Invalid kv cache block id: " + std::to_string(block_id));
+    }
+    if (--ref_counts[block_id] == 0) {
+        free_blocks.push_back(block_id);
+    }
+}
+
+int kv_block_pool_t::clone(int block_id)
+{
+    int new_block_id = allocate();
+    blocks[new_block_id] = blocks[block_id];
+    return new_block_id;
+}
+
+void kv_block_pool_t::release_free_blocks()
+{
+    for (int block_id : free_blocks) {
+        blocks[block_id].resize(0, 0);
+    }
+}
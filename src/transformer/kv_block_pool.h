@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include "../eigen_config.h"
+
+// Non-owning view of the keys (or values) held in part of a block
+using kv_block_map_t = Eigen::Map<const activation_matrix_t, 0, Eigen::OuterStride<>>;
+
+// Pool of fixed size key/value blocks shared between every sequence
+// A block holds the keys and values of block_size consecutive positions for every layer, so a sequence's cache
+// is just a table of block ids. Blocks are recycled through a free list when sequences end, which means memory is
+// only ever held for positions that exist and there is no fragmentation from sequences growing at different rates.
+class kv_block_pool_t {
+private:
+
+    int num_layers, width, block_size, max_blocks;
+
+    // storage for each block, shape: [num_layers * 2 * block_size, width]
+    // the keys for layer l are the rows [2 * l * block_size, (2 * l + 1) * block_size) and the values are the next
+    // block_size rows, so like every other activation each position's keys (or values) are a contiguous row
+    std::vector<activation_matrix_t> blocks;
+    // number of holders of each block, sequences sharing a cached prefix all hold the same blocks
+    std::vector<int> ref_counts;
+    std::vector<int> free_blocks;
+
+public:
+
+    using block_rows_t = Eigen::Block<activation_matrix_t, Eigen::Dynamic, Eigen::Dynamic, true>;
+
+    // max_blocks limits how many blocks can exist at once, 0 means no limit
+    kv_block_pool_t(int num_layers, int width, int block_size = 16, int max_blocks = 0);
+
+    // take a block from the free list, or create a new one if there are none
+    // the caller holds the only reference to the new block
+    int allocate();
+
+    // take another reference to a block that is already in use
+    void retain(int block_id);
+
+    // drop a reference, once nobody holds the block it goes back on the free list
+    void release(int block_id);
+
+    int ref_count(int block_id) const { return ref_counts[block_id]; }
+
+    // allocate a new block holding a copy of an existing one, used to copy-on-write shared blocks
+    int clone(int block_id);
+
+    // hand the memory of any free blocks back to the system
+    void release_free_blocks();
+
+    // writable keys/values for every position in a block, shape: [block_size, width]
+    block_rows_t keys(int block_id, int layer) { return blocks[block_id].middleRows(2 * layer * block_size, block_size); }
+
+    block_rows_t values(int block_id, int layer) { return blocks[block_id].middleRows((2 * layer + 1) * block_size, block_size); }
+
+    // read only views of the first rows positions of a block, restricted to columns [col, col + cols)
+    kv_block_map_t keys(int block_id, int layer, int rows, int col, int cols) const
+    {
+        return kv_block_map_t(blocks[block_id].data() + 2 * layer * block_size * width + col, rows, cols, Eigen::OuterStride<>(width));
+    }
+
+    kv_block_map_t values(int block_id, int layer, int rows, int col, int cols) const
+    {
+        return kv_block_map_t(blocks[block_id].data() + (2 * layer + 1) * block_size * width + col, rows, cols, Eigen::OuterStride<>(width));
+    }
+
+    int get_num_layers() const { return num_layers; }
+
+    int get_block_size() const { return block_size; }
+
+    // blocks currently handed out to sequences
+    int num_used() const { return blocks.size() - free_blocks.size(); }
+
+    int num_free() const { return free_blocks.size(); }
+
+    // bytes of key/value storage in a single block
+    size_t block_bytes() const { return sizeof(float) * block_size * num_layers * 2 * width; }
+};
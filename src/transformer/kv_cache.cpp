@@ -0,0 +1,134 @@
+#include "kv_cache.h"
+#include <algorithm>
+#include "../utils.h"
+
+void layer_kv_cache_t::append(const Eigen::Ref<const activation_matrix_t>& new_K, const Eigen::Ref<const activation_matrix_t>& new_V)
+{
+    if (new_K.rows() != new_V.rows() || new_K.cols() != new_V.cols()) {
+        die("Keys and values appended to the cache must have the same shape");
+    }
+
+    kv_block_pool_t& pool = *cache->pool;
+    int block_size = pool.get_block_size();
+    int& length = cache->lengths[layer];
+
+    cache->reserve(length + new_K.rows());
+
+    // scatter the new rows over the blocks, the first may already be partly filled
+    int row = 0;
+    while (row < new_K.rows()) {
+        cache->make_writable(length / block_size);
+        int block_id = cache->block_table[length / block_size];
+        int block_row = length % block_size;
+        int rows = std::min(block_size - block_row, static_cast<int>(new_K.rows()) - row);
+
+        pool.keys(block_id, layer).middleRows(block_row, rows) = new_K.middleRows(row, rows);
+        pool.values(block_id, layer).middleRows(block_row, rows) = new_V.middleRows(row, rows);
+
+        row += rows;
+        length += rows;
+    }
+}
+
+int layer_kv_cache_t::size() const
+{
+    return cache->lengths[layer];
+}
+
+int layer_kv_cache_t::num_blocks() const
+{
+    int block_size = cache->pool->get_block_size();
+    return (size() + block_size - 1) / block_size;
+}
+
+kv_block_map_t layer_kv_cache_t::keys(int block, int col, int cols) const
+{
+    int block_size = cache->pool->get_block_size();
+    int rows = std::min(block_size, size() - block * block_size);
+    return cache->pool->keys(cache->block_table[block], layer, rows, col, cols);
+}
+
+kv_block_map_t layer_kv_cache_t::values(int block, int col, int cols) const
+{
+    int block_size = cache->pool->get_block_size();
+    int rows = std::min(block_size, size() - block * block_size);
+    return cache->pool->values(cache->block_table[block], layer, rows, col, cols);
+}
+
+kv_cache_t::kv_cache_t(kv_cache_t&& other) noexcept
+    : pool(other.pool), block_table(std::move(other.block_table)), lengths(std::move(other.lengths))
+{
+    other.block_table.clear();
+    other.lengths.clear();
+}
+
+kv_cache_t& kv_cache_t::operator=(kv_cache_t&& other) noexcept
+{
+    if (this != &other) {
+        free_blocks(0);
+        pool = other.pool;
+        block_table = std::move(other.block_table);
+        lengths = std::move(other.lengths);
+        other.block_table.clear();
+        other.lengths.clear();
+    }
+    return *this;
+}
+
+void kv_cache_t::reserve(int length)
+{
+    int block_size = pool->get_block_size();
+    while (static_cast<int>(block_table.size()) * block_size < length) {
+        block_table.push_back(pool->allocate());
+    }
+}
+
+void kv_cache_t::make_writable(int block)
+{
+    int block_id = block_table[block];
+    if (pool->ref_count(block_id) > 1) {
+        block_table[block] = pool->clone(block_id);
+        pool->release(block_id);
+    }
+}
+
+void kv_cache_t::attach_prefix(const std::vector<int>& blocks)
+{
+    if (!block_table.empty()) {
+        die("A prefix can only be attached to an empty kv cache");
+    }
+
+    for (int block_id : blocks) {
+        pool->retain(block_id);
+        block_table.push_back(block_id);
+    }
+
+    for (int& length : lengths) {
+        length = blocks.size() * pool->get_block_size();
+    }
+}
+
+void kv_cache_t::free_blocks(int first_block)
+{
+    for (size_t b = first_block; b < block_table.size(); ++b) {
+        pool->release(block_table[b]);
+    }
+    if (first_block < static_cast<int>(block_table.size())) {
+        block_table.resize(first_block);
+    }
+}
+
+void kv_cache_t::truncate(int new_length)
+{
+    if (new_length < 0 || new_length > size()) {
+        die("Invalid length to truncate the kv cache to: " + std::to_string(new_length));
+    }
+
+    for (int& length : lengths) {
+        length = std::min(length, new_length);
+    }
+
+    // hand back any blocks that no longer hold a position
+    int block_size = pool->get_block_size();
+    free_blocks((new_length + block_size - 1) / block_size);
+}
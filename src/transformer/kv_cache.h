@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include "../eigen_config.h"
+#include "kv_block_pool.h"
+
+class kv_cache_t;
+
+// Handle onto a single decoder layer of a sequence's kv cache
+// Rows are token positions, columns are the d_model wide key (or value) projections for all heads,
+// laid out in the same order as the K and V blocks of the fused QKV projection.
+// The positions are spread over the blocks in the sequence's block table, block b holds positions [b * block_size, (b + 1) * block_size)
+class layer_kv_cache_t {
+private:
+
+    kv_cache_t* cache;
+    int layer;
+
+public:
+
+    layer_kv_cache_t(kv_cache_t* cache, int layer) : cache(cache), layer(layer) {}
+
+    // append the keys and values for new positions, taking new blocks from the pool as needed
+    void append(const Eigen::Ref<const activation_matrix_t>& new_K, const Eigen::Ref<const activation_matrix_t>& new_V);
+
+    // number of positions currently cached
+    int size() const;
+
+    // number of blocks holding this layer's positions
+    int num_blocks() const;
+
+    // the keys/values stored in block b, restricted to columns [col, col + cols)
+    kv_block_map_t keys(int block, int col, int cols) const;
+
+    kv_block_map_t values(int block, int col, int cols) const;
+};
+
+// Per-sequence Key/Value cache covering every layer of the transformer
+// The cache owns its blocks and returns them to the pool when it is truncated or destroyed
+class kv_cache_t {
+private:
+
+    friend class layer_kv_cache_t;
+
+    kv_block_pool_t* pool;
+    // pool block ids, in position order
+    std::vector<int> block_table;
+    // number of positions cached for each layer, these only differ part way through a forward pass,
+    // or while a draft that only runs the first few layers is ahead of the rest
+    std::vector<int> lengths;
+
+    // make sure there are enough blocks to hold length positions
+    void reserve(int length);
+
+    // make sure block b isn't shared with anyone else before writing to it, copying it if it is
+    void make_writable(int block);
+
+    void free_blocks(int first_block);
+
+public:
+
+    kv_cache_t(kv_block_pool_t& pool) : pool(&pool), lengths(pool.get_num_layers(), 0) {}
+
+    ~kv_cache_t() { free_blocks(0); }
+
+    // the blocks belong to this cache, so it can be moved but not copied
+    kv_cache_t(const kv_cache_t&) = delete;
+    kv_cache_t& operator=(const kv_cache_t&) = delete;
+
+    kv_cache_t(kv_cache_t&& other) noexcept;
+    kv_cache_t& operator=(kv_cache_t&& other) noexcept;
+
+    layer_kv_cache_t layer(int layer_idx) { return layer_kv_cache_t(this, layer_idx); }
+
+    // number of positions cached, this is also the position offset of the next token
+    int size() const { return lengths.empty() ? 0 : lengths[0]; }
+
+    const std::vector<int>& get_block_table() const { return block_table; }
+
+    // start an empty cache off with full blocks that already hold the keys and values of a prefix, e.g. from the prefix cache
+    // the blocks are shared rather than copied, the cache takes its own reference to each
+    void attach_prefix(const std::vector<int>& blocks);
+
+    // drop everything after the first new_length positions, returning any blocks that are no longer needed
+    void truncate(int new_length);
+
+    void clear() { truncate(0); }
+};
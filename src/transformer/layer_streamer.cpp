@@ -0,0 +1,125 @@
+#include "layer_streamer.h"
+#include <chrono>
+#include "../utils.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+double elapsed_ms(clock_type::time_point from)
+{
+    return std::chrono::duration<double, std::milli>(clock_type::now() - from).count();
+}
+
+}  // namespace
+
+layer_streamer_t::layer_streamer_t(int num_layers, int num_heads, size_t memory_budget, layer_source_t source)
+    : num_layers(num_layers), num_heads(num_heads), memory_budget(memory_budget), source(std::move(source))
+{
+    if (num_layers <= 0 || !this->source.load || !this->source.bytes) {
+        die("Layer streaming needs at least one layer and a source to load them from");
+    }
+}
+
+layer_streamer_t::~layer_streamer_t()
+{
+    if (pending.valid()) {
+        pending.wait();
+    }
+}
+
+bool layer_streamer_t::make_room(size_t bytes, int keep)
+{
+    while (resident_bytes + bytes > memory_budget) {
+        auto victim = resident.end();
+        for (auto it = resident.begin(); it != resident.end(); ++it) {
+            if (it->first != keep && (victim == resident.end() || it->second.last_used < victim->second.last_used)) {
+                victim = it;
+            }
+        }
+        if (victim == resident.end()) {
+            return false;
+        }
+
+        resident_bytes -= victim->second.bytes;
+        resident.erase(victim);
+        stats.evictions++;
+    }
+
+    // the room is taken straight away, the layer's memory is allocated while it loads
+    resident_bytes += bytes;
+    stats.peak_resident_bytes = std::max(stats.peak_resident_bytes, resident_bytes);
+    return true;
+}
+
+void layer_streamer_t::insert(int layer, const decoder_layer_weights_t& weights)
+{
+    resident[layer] = {std::make_unique<decoder_layer_t>(num_heads, weights), source.bytes(layer), use_counter};
+    stats.loads++;
+}
+
+void layer_streamer_t::start_prefetch(int layer, int keep)
+{
+    // without room for both layers there's nothing to overlap, the layer is loaded when it's needed instead
+    if (!make_room(source.bytes(layer), keep)) {
+        return;
+    }
+
+    pending_layer = layer;
+    pending = std::async(std::launch::async, [this, layer]() {
+        auto start = clock_type::now();
+        decoder_layer_weights_t weights = source.load(layer);
+        // only read once the future is ready
+        pending_load_ms = elapsed_ms(start);
+        return weights;
+    });
+}
+
+void layer_streamer_t::finish_prefetch()
+{
+    auto start = clock_type::now();
+    decoder_layer_weights_t weights = pending.get();
+    stats.wait_ms += elapsed_ms(start);
+    stats.load_ms += pending_load_ms;
+
+    insert(pending_layer, weights);
+    pending_layer = -1;
+}
+
+decoder_layer_t& layer_streamer_t::acquire(int layer)
+{
+    if (layer < 0 || layer >= num_layers) {
+        die("Layer " + std::to_string(layer) + " is out of range for streaming");
+    }
+    use_counter++;
+
+    if (!resident.count(layer)) {
+        // only one load runs at a time, so a prefetch of some other layer (e.g. after a partial pass) has to finish first
+        if (pending_layer != -1) {
+            finish_prefetch();
+        }
+
+        if (!resident.count(layer)) {
+            if (!make_room(source.bytes(layer), -1)) {
+                die("Layer " + std::to_string(layer) + " doesn't fit in the streaming memory budget");
+            }
+
+            auto start = clock_type::now();
+            decoder_layer_weights_t weights = source.load(layer);
+            double load_ms = elapsed_ms(start);
+            stats.load_ms += load_ms;
+            stats.wait_ms += load_ms;
+            insert(layer, weights);
+        }
+    }
+
+    resident_layer_t& current = resident.at(layer);
+    current.last_used = use_counter;
+
+    int next = (layer + 1) % num_layers;
+    if (next != layer && pending_layer == -1 && !resident.count(next)) {
+        start_prefetch(next, layer);
+    }
+
+    return *current.layer;
+}
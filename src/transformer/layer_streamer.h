@@ -0,0 +1,84 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include "decoder_layer.h"
+
+// where a streaming transformer gets its layers' weights from
+struct layer_source_t {
+    // load a layer's weights into memory, e.g. from disk or by decompressing them, runs on a background thread
+    std::function<decoder_layer_weights_t(int layer)> load;
+    // memory taken by a loaded layer's weights, known before it's loaded so room can be made for it
+    std::function<size_t(int layer)> bytes;
+};
+
+struct layer_streaming_stats_t {
+    // layers loaded, layers come round again on every forward pass so this counts reloads after eviction too
+    long loads = 0;
+    long evictions = 0;
+    // time spent loading layers in the background, and time the forward pass spent blocked waiting on them
+    double load_ms = 0;
+    double wait_ms = 0;
+    size_t peak_resident_bytes = 0;
+
+    // fraction of the loading hidden behind compute, 1 means the forward pass never waited on a layer
+    double overlap() const { return load_ms == 0 ? 1.0 : std::max(0.0, 1.0 - wait_ms / load_ms); }
+};
+
+// Keeps a transformer's layers under a memory budget by loading them on demand
+// Layers are used in order, so while layer i runs layer i + 1 (wrapping round to the first for the next pass) is
+// loaded on a background thread. When a new layer doesn't fit in the budget the least recently used ones are evicted.
+// The budget has to fit at least one layer, and needs two for the prefetch to overlap with compute.
+class layer_streamer_t {
+private:
+
+    struct resident_layer_t {
+        std::unique_ptr<decoder_layer_t> layer;
+        size_t bytes;
+        long last_used;
+    };
+
+    int num_layers, num_heads;
+    size_t memory_budget;
+    layer_source_t source;
+
+    std::map<int, resident_layer_t> resident;
+    size_t resident_bytes = 0;
+    long use_counter = 0;
+
+    // the layer being loaded in the background, if any
+    int pending_layer = -1;
+    std::future<decoder_layer_weights_t> pending;
+    double pending_load_ms = 0;
+
+    layer_streaming_stats_t stats;
+
+    // evict least recently used layers, other than keep, until bytes more fit in the budget
+    // returns false if they can't be made to fit
+    bool make_room(size_t bytes, int keep);
+
+    void start_prefetch(int layer, int keep);
+
+    // wait for the background load to finish and make its layer resident
+    void finish_prefetch();
+
+    void insert(int layer, const decoder_layer_weights_t& weights);
+
+public:
+
+    layer_streamer_t(int num_layers, int num_heads, size_t memory_budget, layer_source_t source);
+    ~layer_streamer_t();
+
+    layer_streamer_t(const layer_streamer_t&) = delete;
+    layer_streamer_t& operator=(const layer_streamer_t&) = delete;
+
+    // the layer ready to run, blocking until it has been loaded, and starts loading the layer after it
+    // the reference stays valid until the next call
+    decoder_layer_t& acquire(int layer);
+
+    int size() const { return num_layers; }
+
+    const layer_streaming_stats_t& get_stats() const { return stats; }
+};
@@ -0,0 +1,123 @@
+#include "lm_head.h"
+#include <algorithm>
+#include "../utils.h"
+
+namespace {
+
+// ordering of candidates, better ones first, with ties broken towards the lower token id so the result doesn't
+// depend on which thread saw which tile
+bool is_better(const token_logit_t& a, const token_logit_t& b)
+{
+    return a.logit > b.logit || (a.logit == b.logit && a.token < b.token);
+}
+
+// keep the best k candidates seen so far in a heap with the worst of them at the front
+void push_candidate(std::vector<token_logit_t>& heap, const token_logit_t& candidate, int k)
+{
+    if (static_cast<int>(heap.size()) < k) {
+        heap.push_back(candidate);
+        std::push_heap(heap.begin(), heap.end(), is_better);
+    } else if (is_better(candidate, heap.front())) {
+        std::pop_heap(heap.begin(), heap.end(), is_better);
+        heap.back() = candidate;
+        std::push_heap(heap.begin(), heap.end(), is_better);
+    }
+}
+
+}  // namespace
+
+void lm_head_t::set_weights(const weight_matrix_t& new_token_embedding)
+{
+    token_embedding = new_token_embedding;
+    weights_int8.reset();
+}
+
+void lm_head_t::quantize_int8()
+{
+    if (!token_embedding) {
+        die("The lm head has no weights to quantize");
+    }
+    // the embedding matrix already has one row per output channel
+    weights_int8.emplace(*token_embedding);
+}
+
+void lm_head_t::project_tile(const Eigen::Ref<const activation_matrix_t>& hidden, const quantized_rows_t* hidden_int8, int first_token,
+                             Eigen::Ref<MatrixXf> tile) const
+{
+    if (hidden_int8) {
+        weights_int8->multiply_channels(*hidden_int8, first_token, tile);
+    } else {
+        tile.noalias() = hidden * (*token_embedding).middleRows(first_token, tile.cols()).transpose();
+    }
+}
+
+MatrixXf lm_head_t::forward(const Eigen::Ref<const activation_matrix_t>& hidden) const
+{
+    if (weights_int8) {
+        return weights_int8->multiply(hidden);
+    }
+    return hidden * (*token_embedding).transpose();
+}
+
+MatrixXf lm_head_t::forward_transposed(const Eigen::Ref<const activation_matrix_t>& hidden) const
+{
+    if (weights_int8) {
+        return weights_int8->multiply(hidden).transpose();
+    }
+    return *token_embedding * hidden.transpose();
+}
+
+std::vector<std::vector<token_logit_t>> lm_head_t::top_k(const Eigen::Ref<const activation_matrix_t>& hidden, int k) const
+{
+    int rows = hidden.rows();
+    int vocab = vocab_size();
+    if (k <= 0) {
+        die("top k needs k > 0, got " + std::to_string(k));
+    }
+    k = std::min(k, vocab);
+
+    // the hidden states only need quantizing once, not once per tile
+    std::optional<quantized_rows_t> hidden_int8;
+    if (weights_int8) {
+        hidden_int8 = quantized_matrix_t::quantize_rows(hidden);
+    }
+
+    std::vector<std::vector<token_logit_t>> best(rows);
+    int num_tiles = (vocab + vocab_tile_rows - 1) / vocab_tile_rows;
+
+#pragma omp parallel
+    {
+        // every thread keeps its own running top k over its share of the tiles
+        std::vector<std::vector<token_logit_t>> thread_best(rows);
+        MatrixXf tile_logits;
+
+#pragma omp for schedule(static)
+        for (int t = 0; t < num_tiles; ++t) {
+            int first_token = t * vocab_tile_rows;
+            int tile_tokens = std::min(vocab_tile_rows, vocab - first_token);
+
+            tile_logits.resize(rows, tile_tokens);
+            project_tile(hidden, hidden_int8 ? &*hidden_int8 : nullptr, first_token, tile_logits);
+
+            for (int j = 0; j < tile_tokens; ++j) {
+                for (int r = 0; r < rows; ++r) {
+                    push_candidate(thread_best[r], {first_token + j, tile_logits(r, j)}, k);
+                }
+            }
+        }
+
+        // then they're merged
+#pragma omp critical
+        for (int r = 0; r < rows; ++r) {
+            for (const token_logit_t& candidate : thread_best[r]) {
+                push_candidate(best[r], candidate, k);
+            }
+        }
+    }
+
+    for (std::vector<token_logit_t>& row_best : best) {
+        std::sort(row_best.begin(), row_best.end(), is_better);
+    }
+
+    return best;
+}
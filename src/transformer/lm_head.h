@@ -0,0 +1,51 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+#include "../eigen_config.h"
+#include "quantized_matrix.h"
+#include "shared_weight.h"
+
+// a candidate next token and its logit
+struct token_logit_t {
+    int token;
+    float logit;
+};
+
+// Projection from the final hidden states back onto the vocabulary
+// GPT2 ties these weights to the token embeddings, so the head only holds a handle on the embedding matrix (one row
+// per vocabulary entry), plus an optional int8 copy of it.
+// top_k works through the vocabulary a tile at a time keeping a running top k per row, so when only the best
+// candidates are wanted the full vocab wide logits are never built, and the tiles are shared out between threads.
+class lm_head_t {
+private:
+
+    // vocabulary entries per tile, small enough that a tile of logits stays in cache
+    static constexpr int vocab_tile_rows = 2048;
+
+    weight_matrix_t token_embedding;
+    std::optional<quantized_matrix_t> weights_int8;
+
+    // logits of the vocabulary entries [first_token, first_token + tile.cols())
+    // hidden_int8 is the quantized hidden states when the int8 weights are in use
+    void project_tile(const Eigen::Ref<const activation_matrix_t>& hidden, const quantized_rows_t* hidden_int8, int first_token,
+                      Eigen::Ref<MatrixXf> tile) const;
+
+public:
+
+    // shape: [vocab_size, d_model]
+    void set_weights(const weight_matrix_t& token_embedding);
+
+    void quantize_int8();
+
+    int vocab_size() const { return token_embedding.rows(); }
+
+    // full logits for every row of hidden, shape: [hidden.rows(), vocab_size]
+    MatrixXf forward(const Eigen::Ref<const activation_matrix_t>& hidden) const;
+
+    // the same logits with one column per row of hidden, so each row's logits are contiguous, shape: [vocab_size, hidden.rows()]
+    MatrixXf forward_transposed(const Eigen::Ref<const activation_matrix_t>& hidden) const;
+
+    // the k largest logits for each row of hidden, best first (ties go to the lower token id)
+    std::vector<std::vector<token_logit_t>> top_k(const Eigen::Ref<const activation_matrix_t>& hidden, int k) const;
+};
@@ -3,37 +3,112 @@
 
 MatrixXf multi_head_attention_t::forward(const MatrixXf& X)
 {
-    int seq_len = X.rows();
+    return forward_batch(X, sequence_batch_t({static_cast<int>(X.rows())}));
+}
 
-    // Compute Q, K, V for all heads at once
-    MatrixXf QKV = (X * qkv_weights).rowwise() + qkv_bias.transpose();
+MatrixXf multi_head_attention_t::forward_step(const MatrixXf& X, layer_kv_cache_t cache)
+{
+    return forward_batch(X, sequence_batch_t({static_cast<int>(X.rows())}), {cache});
+}
 
-    Eigen::MatrixXf Q = QKV.leftCols(d_model);
-    Eigen::MatrixXf K = QKV.middleCols(d_model, d_model);
-    Eigen::MatrixXf V = QKV.rightCols(d_model);
+MatrixXf multi_head_attention_t::forward_batch(const MatrixXf& X, const sequence_batch_t& batch, const std::vector<layer_kv_cache_t>& caches)
+{
+    activation_matrix_t output = activation_matrix_t::Zero(X.rows(), d_model);
+    workspace_t workspace;
+    forward_residual(X, batch, caches, workspace, output);
+    return output;
+}
 
-    // Split Q, K, V for each head
-    std::vector<MatrixXf> Q_heads, K_heads, V_heads;
-    for (int i = 0; i < num_heads; ++i) {
-        Q_heads.push_back(Q.block(0, i * d_k, seq_len, d_k));
-        K_heads.push_back(K.block(0, i * d_k, seq_len, d_k));
-        V_heads.push_back(V.block(0, i * d_k, seq_len, d_k));
+void multi_head_attention_t::forward_residual(const Eigen::Ref<const activation_matrix_t>& X, const sequence_batch_t& batch,
+                                              const std::vector<layer_kv_cache_t>& caches, workspace_t& workspace,
+                                              Eigen::Ref<activation_matrix_t> residual)
+{
+    if (!caches.empty() && static_cast<int>(caches.size()) != batch.size()) {
+        die("Batched attention needs one kv cache per sequence");
+    }
+    if (!qkv_weights && !qkv_weights_int8) {
+        die("Attention weights have not been set");
     }
 
-    // Process each head
-    std::vector<MatrixXf> head_outputs;
-    for (int i = 0; i < num_heads; ++i) {
-        MatrixXf head_output = attention_head.forward(Q_heads[i], K_heads[i], V_heads[i]);
-        
-        head_outputs.push_back(head_output);
+    // Compute Q, K, V for all heads and all sequences at once
+    auto QKV = workspace.matrix(workspace_t::qkv, X.rows(), 3 * d_model);
+    if (qkv_weights_int8) {
+        qkv_weights_int8->multiply(X, QKV, workspace.quantized_rows(X.cols()));
+    } else {
+        QKV.noalias() = X * *qkv_weights;
+    }
+    QKV.rowwise() += (*qkv_bias).transpose();
+
+    auto concatenated_output = workspace.matrix(workspace_t::heads, batch.total_rows(), d_model);
+
+    for (int s = 0; s < batch.size(); ++s) {
+        auto seq_QKV = QKV.middleRows(batch.offset(s), batch.length(s));
+        auto seq_output = concatenated_output.middleRows(batch.offset(s), batch.length(s));
+
+        if (caches.empty()) {
+            attend(seq_QKV.leftCols(d_model), seq_QKV.middleCols(d_model, d_model), seq_QKV.rightCols(d_model), seq_output, workspace);
+        } else {
+            // Only the new positions were projected, the keys and values for earlier positions are already cached
+            layer_kv_cache_t cache = caches[s];
+            cache.append(seq_QKV.middleCols(d_model, d_model), seq_QKV.rightCols(d_model));
+            attend_cached(seq_QKV.leftCols(d_model), cache, seq_output, workspace);
+        }
+    }
+
+    // Final output projection, added straight onto the residual
+    if (output_projection_int8) {
+        auto projected = workspace.matrix(workspace_t::projection, X.rows(), d_model);
+        output_projection_int8->multiply(concatenated_output, projected, workspace.quantized_rows(d_model));
+        residual += projected;
+    } else {
+        residual.noalias() += concatenated_output * *output_projection;
     }
+    residual.rowwise() += (*output_bias).transpose();
+}
+
+void multi_head_attention_t::quantize_int8()
+{
+    // the int8 matrices are laid out with one row per output channel, the transpose of how these are used
+    qkv_weights_int8.emplace((*qkv_weights).transpose());
+    output_projection_int8.emplace((*output_projection).transpose());
+
+    // drop this layer's share of the fp32 weights
+    qkv_weights = weight_matrix_t();
+    output_projection = weight_matrix_t();
+}
+
+void multi_head_attention_t::attend(const Eigen::Ref<const activation_matrix_t>& Q, const Eigen::Ref<const activation_matrix_t>& K,
+                                    const Eigen::Ref<const activation_matrix_t>& V, Eigen::Ref<activation_matrix_t> output, workspace_t& workspace)
+{
+    std::vector<attention_scratch_t>& scratch = workspace.heads_scratch(num_heads);
 
-    // Concatenate head outputs
-    MatrixXf concatenated_output(seq_len, num_heads * d_k);
+    // Process each head, writing its output into that head's columns of the concatenated output
+    // the heads touch disjoint columns, so they can run side by side without any copies
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < num_heads; ++i) {
-        concatenated_output.block(0, i * d_k, seq_len, d_k) = head_outputs[i];
+        attention_t::forward(Q.middleCols(i * d_k, d_k), K.middleCols(i * d_k, d_k), V.middleCols(i * d_k, d_k), output.middleCols(i * d_k, d_k),
+                             scratch[i]);
     }
+}
 
-    // Final output projection
-    return (concatenated_output * output_projection).rowwise() + output_bias.transpose();
-}
\ No newline at end of file
+void multi_head_attention_t::attend_cached(const Eigen::Ref<const activation_matrix_t>& Q, const layer_kv_cache_t& cache,
+                                           Eigen::Ref<activation_matrix_t> output, workspace_t& workspace)
+{
+    int num_blocks = cache.num_blocks();
+    std::vector<attention_scratch_t>& scratch = workspace.heads_scratch(num_heads);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_heads; ++i) {
+        // views onto this head's columns in each block of the cache
+        std::vector<kv_block_map_t>& K_blocks = scratch[i].K_tiles;
+        std::vector<kv_block_map_t>& V_blocks = scratch[i].V_tiles;
+        K_blocks.clear();
+        V_blocks.clear();
+        for (int b = 0; b < num_blocks; ++b) {
+            K_blocks.push_back(cache.keys(b, i * d_k, d_k));
+            V_blocks.push_back(cache.values(b, i * d_k, d_k));
+        }
+
+        attention_t::forward_blocks(Q.middleCols(i * d_k, d_k), K_blocks, V_blocks, output.middleCols(i * d_k, d_k), scratch[i]);
+    }
+}
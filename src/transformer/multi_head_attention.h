@@ -3,85 +3,88 @@
 #include <vector>
 #include "../utils.h"
 #include "attention.h"  // Include the file containing the attention_t class
+#include "kv_cache.h"
+#include "quantized_matrix.h"
+#include "sequence_batch.h"
+#include "shared_weight.h"
+#include "workspace.h"
 
 class multi_head_attention_t {
 private:
 
     int d_model, num_heads, d_k;
-    attention_t attention_head;
-    MatrixXf query_weights, key_weights, value_weights;
-    VectorXf query_bias, key_bias, value_bias;
-    MatrixXf output_projection;
-    VectorXf output_bias;
-    float scale_factor;
 
-    MatrixXf qkv_weights;
-    VectorXf qkv_bias;
+    // handles on the weights' storage, shared with the model rather than copied into every layer
+    // Q, K and V are projected together by qkv_weights, shape: [d_model, 3 * d_model]
+    weight_matrix_t qkv_weights;
+    weight_vector_t qkv_bias;
+    weight_matrix_t output_projection;
+    weight_vector_t output_bias;
+
+    // int8 copies of the projections, once set these are used and the fp32 weights are released
+    std::optional<quantized_matrix_t> qkv_weights_int8, output_projection_int8;
+
+    // runs every head of Q against K and V, writing the concatenated head outputs into output
+    // Q, K and V are views into the QKV projection, each head works on its own columns of them in place
+    // and the heads are spread over the OpenMP threads, each with its own scratch space from the workspace
+    void attend(const Eigen::Ref<const activation_matrix_t>& Q, const Eigen::Ref<const activation_matrix_t>& K,
+                const Eigen::Ref<const activation_matrix_t>& V, Eigen::Ref<activation_matrix_t> output, workspace_t& workspace);
+
+    // same as attend, but gathering the keys and values from the blocks of a paged kv cache
+    void attend_cached(const Eigen::Ref<const activation_matrix_t>& Q, const layer_kv_cache_t& cache, Eigen::Ref<activation_matrix_t> output,
+                       workspace_t& workspace);
 
 public:
 
+    // nothing is allocated for the weights, they have to be set before the first forward pass
     multi_head_attention_t(int d_model, int num_heads) : d_model(d_model), num_heads(num_heads)
     {
-
         if (d_model % num_heads != 0) {
             die("d_model must be a multiple of num_heads");
         }
 
         d_k = d_model / num_heads;
+    }
 
-        // Initialize matrices
-        allocate_and_initialize(query_weights, d_model, d_model);
-        allocate_and_initialize(key_weights, d_model, d_model);
-        allocate_and_initialize(value_weights, d_model, d_model);
-
-        allocate_and_initialize(output_projection, d_model, d_model);
+    // straight from loaded weights, d_model is taken from their shape
+    multi_head_attention_t(int num_heads, const weight_matrix_t& qkv_weights, const weight_vector_t& qkv_bias, const weight_matrix_t& out_proj,
+                           const weight_vector_t& out_bias)
+        : multi_head_attention_t(out_proj.rows(), num_heads)
+    {
+        set_weights2(qkv_weights, qkv_bias, out_proj, out_bias);
+    }
 
-        query_bias = Eigen::VectorXf::Zero(d_model);
-        key_bias = Eigen::VectorXf::Zero(d_model);
-        value_bias = Eigen::VectorXf::Zero(d_model);
+    MatrixXf forward(const MatrixXf& X);
 
-        output_bias = Eigen::VectorXf::Zero(d_model);
-        scale_factor = 1.0f / std::sqrt(static_cast<float>(d_k));
+    // incremental decoding: X only holds the new positions, their keys and values are appended to the cache
+    // and the new queries attend to everything cached so far
+    MatrixXf forward_step(const MatrixXf& X, layer_kv_cache_t cache);
 
-        allocate_and_initialize(qkv_weights, d_model, 3 * d_model);
-        qkv_bias = Eigen::VectorXf::Zero(3 * d_model);
+    // batched path: X holds several sequences packed back to back as described by batch
+    // the projections run over every row at once, while attention is restricted to each sequence's own rows
+    // if caches is not empty it must hold one cache per sequence, and each sequence attends to its cached prefix as well
+    MatrixXf forward_batch(const MatrixXf& X, const sequence_batch_t& batch, const std::vector<layer_kv_cache_t>& caches = {});
 
-    }
+    // same as forward_batch, but adding the output onto residual in place and keeping every intermediate in workspace
+    void forward_residual(const Eigen::Ref<const activation_matrix_t>& X, const sequence_batch_t& batch, const std::vector<layer_kv_cache_t>& caches,
+                          workspace_t& workspace, Eigen::Ref<activation_matrix_t> residual);
 
-    MatrixXf forward(const MatrixXf& X);
+    // switch the qkv and output projections over to int8 weights
+    void quantize_int8();
 
-    void set_weights(const MatrixXf& q_weights, const MatrixXf& k_weights, const MatrixXf& v_weights, const VectorXf& q_bias, const VectorXf& k_bias,
-                     const VectorXf& v_bias, const MatrixXf& out_proj, const VectorXf& out_bias)
+    void set_weights2(const weight_matrix_t& _qkv_weights, const weight_vector_t& _qkv_bias, const weight_matrix_t& out_proj,
+                      const weight_vector_t& out_bias)
     {
-        query_weights = q_weights;
-        key_weights = k_weights;
-        value_weights = v_weights;
-        query_bias = q_bias;
-        key_bias = k_bias;
-        value_bias = v_bias;
-        output_projection = out_proj;
-        output_bias = out_bias;
-
-        // Sanity checks
-        assert(query_weights.rows() == d_model && query_weights.cols() == d_model);
-        assert(key_weights.rows() == d_model && key_weights.cols() == d_model);
-        assert(value_weights.rows() == d_model && value_weights.cols() == d_model);
-        assert(query_bias.size() == d_model);
-        assert(key_bias.size() == d_model);
-        assert(value_bias.size() == d_model);
-        assert(output_projection.rows() == d_model && output_projection.cols() == d_model);
-        assert(output_bias.size() == d_model);
-    }
+        if (_qkv_weights.rows() != d_model || _qkv_weights.cols() != 3 * d_model || _qkv_bias.size() != 3 * d_model || out_proj.rows() != d_model ||
+            out_proj.cols() != d_model || out_bias.size() != d_model) {
+            die("Attention weights have the wrong shape for d_model " + std::to_string(d_model));
+        }
 
-    void set_weights2(const MatrixXf& _qkv_weights,  const VectorXf& _qkv_bias, const MatrixXf& out_proj, const VectorXf& out_bias)
-    {
         qkv_weights = _qkv_weights;
+        qkv_weights_int8.reset();
+        output_projection_int8.reset();
         qkv_bias = _qkv_bias;
-       
         output_projection = out_proj;
         output_bias = out_bias;
-
-        // Sanity checks
-       
     }
-};
\ No newline at end of file
+};
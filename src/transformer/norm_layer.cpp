@@ -1,16 +1,121 @@
 #include "norm_layer.h"
+#include <cmath>
 #include <iostream>
 
-MatrixXf norm_layer_t::forward(const MatrixXf& x)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NORM_LAYER_X86
+#endif
+
+namespace {
+
+// normalizes one row of n features: out = (x - mean) / sqrt(var + eps) * gamma + beta
+// the activations are row-major, so a row's features are contiguous
+using norm_row_kernel_t = void (*)(const float* x, float* out, int n, const float* gamma, const float* beta, float eps);
+
+// the mean and variance come from a single pass of Welford's update, which unlike summing x and x^2 doesn't lose
+// the variance to cancellation when the mean is large compared to the spread (GPT-2's residual stream has a few
+// features far bigger than the rest)
+void norm_row_scalar(const float* x, float* out, int n, const float* gamma, const float* beta, float eps)
+{
+    float mean = 0.0f, m2 = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        float value = x[i];
+        float delta = value - mean;
+        mean += delta / (i + 1);
+        m2 += delta * (value - mean);
+    }
+
+    float inv_std = 1.0f / std::sqrt(m2 / n + eps);
+    for (int i = 0; i < n; ++i) {
+        out[i] = (x[i] - mean) * inv_std * gamma[i] + beta[i];
+    }
+}
+
+#ifdef NORM_LAYER_X86
+
+// each of the 8 lanes runs Welford's update over every 8th feature, then the lanes' partial statistics are merged
+// the row only has to come in from memory once, the second loop finds it in L1
+__attribute__((target("avx2,fma"))) void norm_row_avx2(const float* x, float* out, int n, const float* gamma, const float* beta, float eps)
 {
+    int vector_end = n - n % 8;
+
+    __m256 lane_mean = _mm256_setzero_ps();
+    __m256 lane_m2 = _mm256_setzero_ps();
+    for (int i = 0, count = 1; i < vector_end; i += 8, ++count) {
+        __m256 value = _mm256_loadu_ps(x + i);
+        __m256 delta = _mm256_sub_ps(value, lane_mean);
+        lane_mean = _mm256_fmadd_ps(delta, _mm256_set1_ps(1.0f / count), lane_mean);
+        lane_m2 = _mm256_fmadd_ps(delta, _mm256_sub_ps(value, lane_mean), lane_m2);
+    }
 
-    Eigen::RowVectorXf mean = x.rowwise().mean();
+    // merge the lanes (Chan et al.), they all saw the same number of features
+    alignas(32) float means[8], m2s[8];
+    _mm256_store_ps(means, lane_mean);
+    _mm256_store_ps(m2s, lane_m2);
+    float count = vector_end / 8;
+    float mean = 0.0f, m2 = 0.0f, total = 0.0f;
+    for (int lane = 0; lane < 8 && count > 0; ++lane) {
+        float delta = means[lane] - mean;
+        float merged = total + count;
+        mean += delta * count / merged;
+        m2 += m2s[lane] + delta * delta * total * count / merged;
+        total = merged;
+    }
+    for (int i = vector_end; i < n; ++i) {
+        total += 1.0f;
+        float delta = x[i] - mean;
+        mean += delta / total;
+        m2 += delta * (x[i] - mean);
+    }
 
-    Eigen::RowVectorXf var = (x.colwise() - mean.transpose()).array().square().rowwise().mean().sqrt();
+    float inv_std = 1.0f / std::sqrt(m2 / n + eps);
+    __m256 mean_v = _mm256_set1_ps(mean);
+    __m256 inv_std_v = _mm256_set1_ps(inv_std);
+    for (int i = 0; i < vector_end; i += 8) {
+        __m256 normalized = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(x + i), mean_v), inv_std_v);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(normalized, _mm256_loadu_ps(gamma + i), _mm256_loadu_ps(beta + i)));
+    }
+    for (int i = vector_end; i < n; ++i) {
+        out[i] = (x[i] - mean) * inv_std * gamma[i] + beta[i];
+    }
+}
+
+#endif
+
+// the simd kernel if the cpu has it, otherwise the scalar one
+norm_row_kernel_t row_kernel()
+{
+    static const norm_row_kernel_t kernel = []() -> norm_row_kernel_t {
+#ifdef NORM_LAYER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return norm_row_avx2;
+        }
+#endif
+        return norm_row_scalar;
+    }();
+    return kernel;
+}
 
-    Eigen::MatrixXf x_norm = (x.colwise() - mean.transpose()).array().colwise() / (var.transpose().array() + eps);
+}  // namespace
 
-    Eigen::MatrixXf result = (x_norm.transpose().array().colwise() * gamma.array()).colwise() + beta.array();
+MatrixXf norm_layer_t::forward(const MatrixXf& x)
+{
+    activation_matrix_t output(x.rows(), x.cols());
+    forward(x, output);
+    return output;
+}
+
+void norm_layer_t::forward(const Eigen::Ref<const activation_matrix_t>& x, Eigen::Ref<activation_matrix_t> output) const
+{
+    if (x.cols() != gamma.size() || output.rows() != x.rows() || output.cols() != x.cols()) {
+        die("Layer norm input has " + std::to_string(x.cols()) + " features, expected " + std::to_string(gamma.size()));
+    }
 
-    return result.transpose();
+    // output may be x itself, each row is read in full before any of it is written
+    norm_row_kernel_t kernel = row_kernel();
+    for (Eigen::Index r = 0; r < x.rows(); ++r) {
+        kernel(x.row(r).data(), output.row(r).data(), x.cols(), (*gamma).data(), (*beta).data(), eps);
+    }
 }
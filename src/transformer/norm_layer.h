@@ -3,15 +3,31 @@
 #include <iostream>
 #include "../eigen_config.h"
 #include "../utils.h"
+#include "shared_weight.h"
 
+// Layer normalization over the features of each row, (x - mean) / sqrt(var + eps) * gamma + beta
+// Each row's statistics are gathered in a single pass, with a simd kernel when the row is contiguous in memory.
 class norm_layer_t {
 public:
 
     norm_layer_t(int features, float eps = 1e-5) : gamma(VectorXf::Ones(features)), beta(VectorXf::Zero(features)), eps(eps) {}
 
+    // straight from loaded weights
+    norm_layer_t(const weight_vector_t& gamma, const weight_vector_t& beta, float eps = 1e-5) : gamma(gamma), beta(beta), eps(eps)
+    {
+        if (gamma.size() != beta.size()) {
+            die("Gamma and beta must have the same size");
+        }
+    }
+
     MatrixXf forward(const MatrixXf& x);
 
-    void setGammaBeta(const Eigen::VectorXf& new_gamma, const Eigen::VectorXf& new_beta)
+    // writes the normalized rows of x into output, which must have the same shape
+    // output may be x itself, normalizing in place: each row is read in full before any of it is written, and every
+    // output only depends on the input in the same place. Any other overlap isn't allowed.
+    void forward(const Eigen::Ref<const activation_matrix_t>& x, Eigen::Ref<activation_matrix_t> output) const;
+
+    void setGammaBeta(const weight_vector_t& new_gamma, const weight_vector_t& new_beta)
     {
         if (new_gamma.size() != gamma.size() || new_beta.size() != beta.size()) {
             std::cout << "new_gamma: " << new_gamma.size() << std::endl;
@@ -26,6 +42,6 @@ public:
 
 private:
 
-    VectorXf gamma, beta;
+    weight_vector_t gamma, beta;
     float eps;
 };
\ No newline at end of file
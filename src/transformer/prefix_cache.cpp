@@ -0,0 +1,124 @@
+#include "prefix_cache.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
+
+int prefix_cache_t::lookup(const std::vector<int>& tokens, kv_cache_t& cache)
+{
+    clock++;
+    int block_size = pool.get_block_size();
+
+    // never match the whole sequence, the last token still has to go through the model to get its logits
+    int max_blocks_to_match = tokens.empty() ? 0 : (tokens.size() - 1) / block_size;
+
+    // walk down the tree one block of tokens at a time
+    std::vector<int> blocks;
+    node_t* node = &root;
+    for (int b = 0; b < max_blocks_to_match; ++b) {
+        std::vector<int> key(tokens.begin() + b * block_size, tokens.begin() + (b + 1) * block_size);
+        auto it = node->children.find(key);
+        if (it == node->children.end()) {
+            break;
+        }
+
+        node = it->second.get();
+        node->last_used = clock;
+        blocks.push_back(node->block_id);
+    }
+
+    int matched_tokens = blocks.size() * block_size;
+
+    stats.lookup_tokens += tokens.size();
+    stats.hit_tokens += matched_tokens;
+    if (blocks.empty()) {
+        stats.misses++;
+    } else {
+        stats.hits++;
+        cache.attach_prefix(blocks);
+    }
+
+    return matched_tokens;
+}
+
+void prefix_cache_t::insert(const std::vector<int>& tokens, const kv_cache_t& cache)
+{
+    clock++;
+    int block_size = pool.get_block_size();
+    const std::vector<int>& block_table = cache.get_block_table();
+
+    // only full blocks can be shared, a partly filled block is still being written to
+    int full_blocks = std::min(static_cast<int>(tokens.size()), cache.size()) / block_size;
+
+    node_t* node = &root;
+    for (int b = 0; b < full_blocks; ++b) {
+        std::vector<int> key(tokens.begin() + b * block_size, tokens.begin() + (b + 1) * block_size);
+        auto it = node->children.find(key);
+
+        if (it == node->children.end()) {
+            auto child = std::make_unique<node_t>();
+            child->tokens = key;
+            child->block_id = block_table[b];
+            child->parent = node;
+            pool.retain(child->block_id);
+            num_blocks++;
+
+            it = node->children.emplace(key, std::move(child)).first;
+        }
+
+        // if the block was already cached we keep the tree's copy, it holds exactly the same keys and values
+        node = it->second.get();
+        node->last_used = clock;
+    }
+
+    evict(max_blocks);
+}
+
+void prefix_cache_t::evict(int target_blocks)
+{
+    if (num_blocks <= target_blocks) {
+        return;
+    }
+
+    // only leaves that no sequence is using can go, oldest first
+    // a block nobody else holds has a single reference, the tree's own
+    auto older = [](const node_t* a, const node_t* b) { return a->last_used > b->last_used; };
+    std::priority_queue<node_t*, std::vector<node_t*>, decltype(older)> candidates(older);
+
+    auto is_evictable = [this](const node_t* node) { return node != &root && node->children.empty() && pool.ref_count(node->block_id) == 1; };
+
+    std::function<void(node_t&)> collect = [&](node_t& node) {
+        if (is_evictable(&node)) {
+            candidates.push(&node);
+        }
+        for (auto& [key, child] : node.children) {
+            collect(*child);
+        }
+    };
+    collect(root);
+
+    while (num_blocks > target_blocks && !candidates.empty()) {
+        node_t* node = candidates.top();
+        candidates.pop();
+
+        node_t* parent = node->parent;
+        pool.release(node->block_id);
+        num_blocks--;
+        stats.evictions++;
+        std::vector<int> key = node->tokens;
+        parent->children.erase(key);
+
+        // removing the last child may have turned the parent into a leaf
+        if (is_evictable(parent)) {
+            candidates.push(parent);
+        }
+    }
+}
+
+void prefix_cache_t::release_subtree(node_t& node)
+{
+    for (auto& [key, child] : node.children) {
+        release_subtree(*child);
+        pool.release(child->block_id);
+    }
+    node.children.clear();
+}
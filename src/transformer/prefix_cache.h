@@ -0,0 +1,74 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+#include "kv_block_pool.h"
+#include "kv_cache.h"
+
+struct prefix_cache_stats_t {
+    // lookups that reused at least one block, and those that reused nothing
+    long hits = 0;
+    long misses = 0;
+    // prompt tokens looked up, and how many of those were served from the cache instead of being prefilled
+    long lookup_tokens = 0;
+    long hit_tokens = 0;
+    long evictions = 0;
+
+    double hit_rate() const { return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses); }
+
+    double token_hit_rate() const { return lookup_tokens == 0 ? 0.0 : static_cast<double>(hit_tokens) / lookup_tokens; }
+};
+
+// Shared prompt prefix cache
+// A radix tree over token ids where every edge is one full kv cache block worth of tokens, and every node holds the
+// pool block with the keys and values for those tokens (for every layer). Requests that start with the same tokens
+// (system prompts, few-shot examples) attach the matching blocks to their kv cache and only prefill what is left.
+// The tree holds its own reference on each block, so blocks stay around after the sequences that made them have
+// finished. Once the tree holds more than max_blocks, the least recently used leaves that no sequence is using are evicted.
+class prefix_cache_t {
+private:
+
+    struct node_t {
+        // the block_size tokens on the edge into this node
+        std::vector<int> tokens;
+        int block_id = -1;
+        node_t* parent = nullptr;
+        std::map<std::vector<int>, std::unique_ptr<node_t>> children;
+        // lookup counter value the last time this node was used
+        long last_used = 0;
+    };
+
+    kv_block_pool_t& pool;
+    int max_blocks;
+    int num_blocks = 0;
+    long clock = 0;
+    node_t root;
+    prefix_cache_stats_t stats;
+
+    void evict(int target_blocks);
+
+    void release_subtree(node_t& node);
+
+public:
+
+    prefix_cache_t(kv_block_pool_t& pool, int max_blocks) : pool(pool), max_blocks(max_blocks) {}
+
+    ~prefix_cache_t() { release_subtree(root); }
+
+    prefix_cache_t(const prefix_cache_t&) = delete;
+    prefix_cache_t& operator=(const prefix_cache_t&) = delete;
+
+    // find the longest cached prefix of tokens and attach its blocks to the empty cache
+    // at least one token is always left over, so the caller still has a position to compute logits for
+    // returns the number of tokens that no longer need prefilling
+    int lookup(const std::vector<int>& tokens, kv_cache_t& cache);
+
+    // remember the full blocks of a sequence, tokens[i] being the token at position i of cache
+    void insert(const std::vector<int>& tokens, const kv_cache_t& cache);
+
+    // number of blocks held by the tree
+    int size() const { return num_blocks; }
+
+    const prefix_cache_stats_t& get_stats() const { return stats; }
+};
@@ -0,0 +1,316 @@
+#include "quantized_matrix.h"
+#include <algorithm>
+#include <cmath>
+#include "../utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define QUANTIZED_MATRIX_X86
+#endif
+
+namespace {
+
+// symmetric quantization onto [-127, 127], leaving -128 unused keeps the sign trick in the simd kernels exact
+constexpr float int8_max = 127.0f;
+
+// prefill multiplies many rows at once, so the products are worked out a tile of rows x channels at a time, each weight
+// load is then used by every row in the tile and each activation load by every channel
+constexpr int tile_rows = 4;
+constexpr int tile_channels = 2;
+
+// the weights of a block of channels are kept small enough to stay in cache while every tile of rows goes past them
+constexpr size_t channel_block_bytes = 64 * 1024;
+
+// channels handed to each parallel task, enough to fill several tiles while keeping the threads evenly loaded
+constexpr int parallel_channels = 32;
+
+using dot_kernel_t = int32_t (*)(const int8_t* a, const int8_t* b, int n);
+
+// sums[i][j] = dot(x[i], w[j]) over n bytes
+using tile_kernel_t = void (*)(const int8_t* const* x, const int8_t* const* w, int n, int32_t (*sums)[tile_channels]);
+
+int32_t dot_scalar(const int8_t* a, const int8_t* b, int n)
+{
+    int32_t sum = 0;
+    for (int k = 0; k < n; ++k) {
+        sum += static_cast<int32_t>(a[k]) * static_cast<int32_t>(b[k]);
+    }
+    return sum;
+}
+
+void tile_scalar(const int8_t* const* x, const int8_t* const* w, int n, int32_t (*sums)[tile_channels])
+{
+    for (int i = 0; i < tile_rows; ++i) {
+        for (int j = 0; j < tile_channels; ++j) {
+            sums[i][j] = dot_scalar(x[i], w[j], n);
+        }
+    }
+}
+
+#ifdef QUANTIZED_MATRIX_X86
+
+__attribute__((target("avx2"))) int32_t horizontal_sum(__m256i v)
+{
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+// the byte multiply instructions take one unsigned and one signed operand, so a's sign is moved over onto b
+// since neither side ever holds -128 this is exact, and a pair of products can't overflow the 16 bit sums
+__attribute__((target("avx2"))) int32_t dot_avx2(const int8_t* a, const int8_t* b, int n)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+
+    int k = 0;
+    for (; k + 32 <= n; k += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k));
+        __m256i pairs = _mm256_maddubs_epi16(_mm256_sign_epi8(va, va), _mm256_sign_epi8(vb, va));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+    }
+
+    return horizontal_sum(acc) + dot_scalar(a + k, b + k, n - k);
+}
+
+__attribute__((target("avx2,avxvnni"))) int32_t dot_avx_vnni(const int8_t* a, const int8_t* b, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+
+    int k = 0;
+    for (; k + 32 <= n; k += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k));
+        acc = _mm256_dpbusd_avx_epi32(acc, _mm256_sign_epi8(va, va), _mm256_sign_epi8(vb, va));
+    }
+
+    return horizontal_sum(acc) + dot_scalar(a + k, b + k, n - k);
+}
+
+// the tiles move each weight's sign onto the activations instead, so the absolute weights are taken once per load
+// rather than once per row, with 8 accumulators the whole tile stays in registers
+__attribute__((target("avx2"))) void tile_avx2(const int8_t* const* x, const int8_t* const* w, int n, int32_t (*sums)[tile_channels])
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc[tile_rows][tile_channels];
+    for (int i = 0; i < tile_rows; ++i) {
+        for (int j = 0; j < tile_channels; ++j) {
+            acc[i][j] = _mm256_setzero_si256();
+        }
+    }
+
+    int k = 0;
+    for (; k + 32 <= n; k += 32) {
+        __m256i w0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w[0] + k));
+        __m256i w1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w[1] + k));
+        __m256i abs_w0 = _mm256_sign_epi8(w0, w0);
+        __m256i abs_w1 = _mm256_sign_epi8(w1, w1);
+        for (int i = 0; i < tile_rows; ++i) {
+            __m256i vx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x[i] + k));
+            __m256i pairs0 = _mm256_maddubs_epi16(abs_w0, _mm256_sign_epi8(vx, w0));
+            __m256i pairs1 = _mm256_maddubs_epi16(abs_w1, _mm256_sign_epi8(vx, w1));
+            acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(pairs0, ones));
+            acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(pairs1, ones));
+        }
+    }
+
+    for (int i = 0; i < tile_rows; ++i) {
+        for (int j = 0; j < tile_channels; ++j) {
+            sums[i][j] = horizontal_sum(acc[i][j]) + dot_scalar(x[i] + k, w[j] + k, n - k);
+        }
+    }
+}
+
+__attribute__((target("avx2,avxvnni"))) void tile_avx_vnni(const int8_t* const* x, const int8_t* const* w, int n, int32_t (*sums)[tile_channels])
+{
+    __m256i acc[tile_rows][tile_channels];
+    for (int i = 0; i < tile_rows; ++i) {
+        for (int j = 0; j < tile_channels; ++j) {
+            acc[i][j] = _mm256_setzero_si256();
+        }
+    }
+
+    int k = 0;
+    for (; k + 32 <= n; k += 32) {
+        __m256i w0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w[0] + k));
+        __m256i w1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w[1] + k));
+        __m256i abs_w0 = _mm256_sign_epi8(w0, w0);
+        __m256i abs_w1 = _mm256_sign_epi8(w1, w1);
+        for (int i = 0; i < tile_rows; ++i) {
+            __m256i vx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x[i] + k));
+            acc[i][0] = _mm256_dpbusd_avx_epi32(acc[i][0], abs_w0, _mm256_sign_epi8(vx, w0));
+            acc[i][1] = _mm256_dpbusd_avx_epi32(acc[i][1], abs_w1, _mm256_sign_epi8(vx, w1));
+        }
+    }
+
+    for (int i = 0; i < tile_rows; ++i) {
+        for (int j = 0; j < tile_channels; ++j) {
+            sums[i][j] = horizontal_sum(acc[i][j]) + dot_scalar(x[i] + k, w[j] + k, n - k);
+        }
+    }
+}
+
+#endif
+
+struct dot_kernel_choice_t {
+    dot_kernel_t kernel;
+    tile_kernel_t tile;
+    const char* name;
+};
+
+dot_kernel_choice_t choose_dot_kernel()
+{
+#ifdef QUANTIZED_MATRIX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avxvnni")) {
+        return {dot_avx_vnni, tile_avx_vnni, "avx-vnni"};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return {dot_avx2, tile_avx2, "avx2"};
+    }
+#endif
+    return {dot_scalar, tile_scalar, "scalar"};
+}
+
+const dot_kernel_choice_t& dot_kernel()
+{
+    static const dot_kernel_choice_t choice = choose_dot_kernel();
+    return choice;
+}
+
+}  // namespace
+
+quantized_matrix_t::quantized_matrix_t(const Eigen::Ref<const MatrixXf>& weights) : values(weights.rows(), weights.cols()), scales(weights.rows())
+{
+    for (int c = 0; c < weights.rows(); ++c) {
+        float max_abs = weights.row(c).cwiseAbs().maxCoeff();
+        scales(c) = max_abs / int8_max;
+
+        float inverse_scale = max_abs > 0 ? int8_max / max_abs : 0.0f;
+        values.row(c) = (weights.row(c) * inverse_scale).array().round().cast<int8_t>();
+    }
+}
+
+quantized_rows_t quantized_matrix_t::quantize_rows(const Eigen::Ref<const activation_matrix_t>& X)
+{
+    quantized_rows_t quantized;
+    quantize_rows(X, quantized);
+    return quantized;
+}
+
+void quantized_matrix_t::quantize_rows(const Eigen::Ref<const activation_matrix_t>& X, quantized_rows_t& quantized)
+{
+    quantized.values.resize(X.rows(), X.cols());
+    quantized.scales.resize(X.rows());
+    for (int r = 0; r < X.rows(); ++r) {
+        float max_abs = X.row(r).cwiseAbs().maxCoeff();
+        quantized.scales(r) = max_abs / int8_max;
+
+        float inverse_scale = max_abs > 0 ? int8_max / max_abs : 0.0f;
+        quantized.values.row(r) = (X.row(r) * inverse_scale).array().round().cast<int8_t>();
+    }
+}
+
+MatrixXf quantized_matrix_t::multiply(const Eigen::Ref<const activation_matrix_t>& X) const
+{
+    activation_matrix_t output(X.rows(), values.rows());
+    quantized_rows_t X_quantized;
+    multiply(X, output, X_quantized);
+    return output;
+}
+
+void quantized_matrix_t::multiply(const Eigen::Ref<const activation_matrix_t>& X, Eigen::Ref<activation_matrix_t> output,
+                                  quantized_rows_t& X_quantized) const
+{
+    if (X.cols() != values.cols()) {
+        die("Input to the quantized matrix has " + std::to_string(X.cols()) + " columns, expected " + std::to_string(values.cols()));
+    }
+
+    // quantize the activations dynamically, one scale per row
+    quantize_rows(X, X_quantized);
+
+    // each thread takes runs of output channels, so it streams through its share of the weights exactly once
+    int num_runs = (values.rows() + parallel_channels - 1) / parallel_channels;
+#pragma omp parallel for schedule(static)
+    for (int run = 0; run < num_runs; ++run) {
+        int first = run * parallel_channels;
+        int count = std::min(parallel_channels, static_cast<int>(values.rows()) - first);
+        // the output is row-major, so a run of its columns is mapped with the rows as the inner stride
+        Eigen::Map<MatrixXf, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>> channels(output.data() + first, output.rows(), count,
+                                                                                         Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(1, output.outerStride()));
+        multiply_channels(X_quantized, first, channels);
+    }
+}
+
+void quantized_matrix_t::multiply_channels(const quantized_rows_t& X, int first_channel, channel_output_t output) const
+{
+    const dot_kernel_choice_t& kernels = dot_kernel();
+    int inner = values.cols();
+    int rows = output.rows();
+    int channels = output.cols();
+
+    auto row = [&](int r) { return X.values.data() + static_cast<size_t>(r) * inner; };
+    auto weights = [&](int c) { return values.data() + static_cast<size_t>(first_channel + c) * inner; };
+
+    // decoding has too few rows to fill a tile, each output is a dot product against one weight row streamed from memory
+    if (rows < tile_rows) {
+        for (int c = 0; c < channels; ++c) {
+            float weight_scale = scales(first_channel + c);
+            for (int r = 0; r < rows; ++r) {
+                output(r, c) = kernels.kernel(row(r), weights(c), inner) * X.scales(r) * weight_scale;
+            }
+        }
+        return;
+    }
+
+    int block_channels = std::max<int>(tile_channels, channel_block_bytes / std::max(inner, 1) / tile_channels * tile_channels);
+    for (int block = 0; block < channels; block += block_channels) {
+        int block_end = std::min(channels, block + block_channels);
+        for (int r = 0; r < rows; r += tile_rows) {
+            // a partial tile at the edge repeats its last row or channel and drops the extra sums
+            const int8_t* x[tile_rows];
+            for (int i = 0; i < tile_rows; ++i) {
+                x[i] = row(std::min(r + i, rows - 1));
+            }
+            for (int c = block; c < block_end; c += tile_channels) {
+                const int8_t* w[tile_channels];
+                for (int j = 0; j < tile_channels; ++j) {
+                    w[j] = weights(std::min(c + j, block_end - 1));
+                }
+
+                int32_t sums[tile_rows][tile_channels];
+                kernels.tile(x, w, inner, sums);
+
+                for (int i = 0; i < std::min(tile_rows, rows - r); ++i) {
+                    for (int j = 0; j < std::min(tile_channels, block_end - c); ++j) {
+                        output(r + i, c + j) = sums[i][j] * X.scales(r + i) * scales(first_channel + c + j);
+                    }
+                }
+            }
+        }
+    }
+}
+
+MatrixXf quantized_matrix_t::dequantize() const
+{
+    return scales.asDiagonal() * values.cast<float>();
+}
+
+const char* quantized_matrix_t::kernel_name()
+{
+    return dot_kernel().name;
+}
+
+quantization_t parse_quantization(const std::string& name)
+{
+    if (name == "fp32" || name == "none") {
+        return quantization_t::none;
+    }
+    if (name == "int8") {
+        return quantization_t::int8;
+    }
+    die("Unknown quantization mode: " + name + ", expected fp32 or int8");
+    return quantization_t::none;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include "../eigen_config.h"
+
+using int8_matrix_t = Eigen::Matrix<int8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+// activations quantized with one scale per row, X ~= values * scales
+struct quantized_rows_t {
+    int8_matrix_t values;
+    VectorXf scales;
+};
+
+// INT8 copy of a weight matrix for the linear layers
+// The weights are quantized symmetrically per output channel when the matrix is built, and the activations are
+// quantized per row every time it is used, so each output is an integer dot product scaled back by the two scales.
+// This needs a quarter of the memory of the fp32 weights, which is what matters when decoding is bandwidth bound.
+// The dot products run on AVX-VNNI or AVX2 when the cpu has them, with a portable scalar fallback otherwise.
+class quantized_matrix_t {
+private:
+
+    // one row per output channel, so each channel's weights are contiguous, shape: [out_features, in_features]
+    int8_matrix_t values;
+    // per output channel scale, weight ~= values * scale
+    VectorXf scales;
+
+public:
+
+    quantized_matrix_t() = default;
+
+    // weights has one row per output channel, shape: [out_features, in_features]
+    explicit quantized_matrix_t(const Eigen::Ref<const MatrixXf>& weights);
+
+    // X * weights^T, shape: [X.rows(), out_features]
+    MatrixXf multiply(const Eigen::Ref<const activation_matrix_t>& X) const;
+
+    // same, writing into output and quantizing X into X_quantized, so a caller reusing both allocates nothing
+    void multiply(const Eigen::Ref<const activation_matrix_t>& X, Eigen::Ref<activation_matrix_t> output, quantized_rows_t& X_quantized) const;
+
+    // any block of a matrix, row or column-major
+    using channel_output_t = Eigen::Ref<MatrixXf, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>>;
+
+    // just the output channels [first_channel, first_channel + output.cols()) of X * weights^T
+    // runs on the calling thread, so callers working through the channels in tiles can split them up themselves
+    void multiply_channels(const quantized_rows_t& X, int first_channel, channel_output_t output) const;
+
+    static quantized_rows_t quantize_rows(const Eigen::Ref<const activation_matrix_t>& X);
+
+    // into an existing quantized_rows_t, which only reallocates if the shape of X changes
+    static void quantize_rows(const Eigen::Ref<const activation_matrix_t>& X, quantized_rows_t& quantized);
+
+    // the weights converted back to fp32, mostly useful for checking the quantization error
+    MatrixXf dequantize() const;
+
+    int rows() const { return values.rows(); }
+    int cols() const { return values.cols(); }
+
+    size_t bytes() const { return values.size() * sizeof(int8_t) + scales.size() * sizeof(float); }
+
+    // name of the dot product kernel picked for this cpu
+    static const char* kernel_name();
+};
+
+enum class quantization_t { none, int8 };
+
+// parses the value of --quant, "fp32" (or "none") and "int8"
+quantization_t parse_quantization(const std::string& name);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include "../eigen_config.h"
+
+// Growable block of floats handed out as a matrix or vector of whatever shape is needed right now
+// Unlike resizing a MatrixXf, which reallocates whenever the size changes at all, the storage only grows when asked
+// for more than it has ever held, and then rounds up to the next power of two. Shapes that creep up a row at a time
+// (the attention scores as the cache grows) or that shrink again (a prefill then single token steps) reuse the same
+// memory, so once a buffer has seen the largest shape it's used with it never touches the heap again.
+// The views stay valid until the next call that has to grow the buffer.
+class scratch_buffer_t {
+private:
+
+    VectorXf storage;
+
+    // times any scratch buffer has grown, from any thread
+    inline static std::atomic<long> growth_count{0};
+
+    float* reserve(Eigen::Index size)
+    {
+        if (size > storage.size()) {
+            growth_count.fetch_add(1, std::memory_order_relaxed);
+            Eigen::Index capacity = 64;
+            while (capacity < size) {
+                capacity *= 2;
+            }
+            storage.resize(capacity);
+        }
+        return storage.data();
+    }
+
+public:
+
+    using matrix_map_t = Eigen::Map<activation_matrix_t, Eigen::AlignedMax>;
+    using vector_map_t = Eigen::Map<VectorXf, Eigen::AlignedMax>;
+
+    // the contents are whatever was left from the last use
+    matrix_map_t matrix(Eigen::Index rows, Eigen::Index cols) { return matrix_map_t(reserve(rows * cols), rows, cols); }
+
+    vector_map_t vector(Eigen::Index size) { return vector_map_t(reserve(size), size); }
+
+    size_t bytes() const { return storage.size() * sizeof(float); }
+
+    // for checking that a warm workspace has stopped allocating, this only counts up
+    static long growths() { return growth_count.load(std::memory_order_relaxed); }
+};
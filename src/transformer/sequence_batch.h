@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include "../utils.h"
+
+// Describes how the rows of a packed activation matrix are split between sequences
+// The sequences are stored back to back with no padding, so sequence i owns rows [offset(i), offset(i) + length(i)).
+// Everything that works row by row (projections, layer norm, feed-forward) runs over all the rows at once,
+// only attention needs to know where each sequence starts and ends.
+class sequence_batch_t {
+private:
+
+    std::vector<int> lengths;
+    std::vector<int> offsets;
+    int rows = 0;
+
+public:
+
+    sequence_batch_t(const std::vector<int>& seq_lengths) : lengths(seq_lengths)
+    {
+        offsets.reserve(lengths.size());
+        for (int length : lengths) {
+            if (length <= 0) {
+                die("Every sequence in a batch needs at least one row");
+            }
+            offsets.push_back(rows);
+            rows += length;
+        }
+    }
+
+    // number of sequences in the batch
+    int size() const { return lengths.size(); }
+
+    int length(int seq_idx) const { return lengths[seq_idx]; }
+
+    int offset(int seq_idx) const { return offsets[seq_idx]; }
+
+    // total number of rows across all sequences
+    int total_rows() const { return rows; }
+};
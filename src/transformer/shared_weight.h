@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include "../eigen_config.h"
+
+// Read only handle on a weight tensor that lives somewhere else
+// The handle is a view plus a share in whatever owns the storage (a loaded matrix, or a mapped weight file), so copying
+// it never copies the tensor and the storage stays alive for as long as any layer still points into it.
+// Constructing one from a plain matrix or expression takes its own copy, which is handy for tests and standalone layers.
+template <typename Dense>
+class shared_weight_t {
+private:
+
+    std::shared_ptr<const void> owner;
+    const float* data = nullptr;
+    Eigen::Index rows_ = 0, cols_ = 0;
+
+public:
+
+    using view_t = Eigen::Map<const Dense>;
+
+    shared_weight_t() = default;
+
+    // take ownership of a standalone tensor
+    shared_weight_t(Dense&& tensor)
+    {
+        auto owned = std::make_shared<const Dense>(std::move(tensor));
+        data = owned->data();
+        rows_ = owned->rows();
+        cols_ = owned->cols();
+        owner = std::move(owned);
+    }
+
+    template <typename Derived>
+    shared_weight_t(const Eigen::MatrixBase<Derived>& tensor) : shared_weight_t(Dense(tensor))
+    {
+    }
+
+    // a tensor inside storage kept alive by owner, e.g. a mapped weight file
+    shared_weight_t(std::shared_ptr<const void> owner, const float* data, Eigen::Index rows, Eigen::Index cols)
+        : owner(std::move(owner)), data(data), rows_(rows), cols_(cols)
+    {
+    }
+
+    view_t operator*() const { return view_t(data, rows_, cols_); }
+
+    // false once released, e.g. after switching to int8 weights
+    explicit operator bool() const { return data != nullptr; }
+
+    Eigen::Index rows() const { return rows_; }
+    Eigen::Index cols() const { return cols_; }
+    Eigen::Index size() const { return rows_ * cols_; }
+};
+
+using weight_matrix_t = shared_weight_t<MatrixXf>;
+using weight_vector_t = shared_weight_t<VectorXf>;
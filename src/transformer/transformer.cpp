@@ -4,20 +4,70 @@
 MatrixXf transformer_t::forward(const MatrixXf& X)
 {
     // X is the input sequence, shape: [seq_len, d_model]
-    MatrixXf output = X;
-    // Pass input through each encoder layer
+    return forward_batch(X, sequence_batch_t({static_cast<int>(X.rows())}));
+}
+
+MatrixXf transformer_t::forward_step(const MatrixXf& X, kv_cache_t& cache)
+{
+    // X is the new part of the sequence, shape: [new_len, d_model]
+    return forward_batch(X, sequence_batch_t({static_cast<int>(X.rows())}), {&cache});
+}
+
+MatrixXf transformer_t::forward_batch(const MatrixXf& X, const sequence_batch_t& batch, const std::vector<kv_cache_t*>& caches)
+{
+    return forward_first_layers(X, batch, caches, get_num_layers());
+}
+
+MatrixXf transformer_t::forward_first_layers(const MatrixXf& X, const sequence_batch_t& batch, const std::vector<kv_cache_t*>& caches, int num_layers)
+{
+    // X is the packed batch, shape: [total_rows, d_model]
+    activation_matrix_t output = X;
+    forward_in_place(output, batch, caches, num_layers, own_workspace);
+    return output;
+}
+
+void transformer_t::forward_in_place(Eigen::Ref<activation_matrix_t> hidden, const sequence_batch_t& batch, const std::vector<kv_cache_t*>& caches,
+                                     int num_layers, workspace_t& workspace)
+{
+    if (num_layers <= 0 || num_layers > get_num_layers()) {
+        die("Cannot run " + std::to_string(num_layers) + " layers of a " + std::to_string(get_num_layers()) + " layer transformer");
+    }
+
+    // Pass input through each decoder layer
+    for (int i = 0; i < num_layers; ++i) {
+        // gather every sequence's cache for this layer
+        std::vector<layer_kv_cache_t>& layer_caches = workspace.layer_cache_list();
+        for (kv_cache_t* cache : caches) {
+            layer_caches.push_back(cache->layer(i));
+        }
+        // when streaming this also starts loading the next layer in the background
+        decoder_layer_t& layer = streamer ? streamer->acquire(i) : layers[i];
+        layer.forward_in_place(hidden, batch, layer_caches, workspace);
+    }
+}
+
+void transformer_t::quantize_int8()
+{
+    if (streamer) {
+        die("Streamed layers can't be quantized, they're reloaded from their source");
+    }
     for (decoder_layer_t& layer : layers) {
-        output = layer.forward(output);
+        layer.quantize_int8();
     }
-    return output;
 }
 
-void transformer_t::set_layer_weights(const int layer_idx, const MatrixXf& self_attn_qkv_weight, const VectorXf& self_attn_qkv_bias,
-                                      const MatrixXf& self_attn_out_proj_weight, const VectorXf& self_attn_out_proj_bias, const VectorXf& norm1_gamma,
-                                      const VectorXf& norm1_beta, const MatrixXf& ff_linear1_weight, const VectorXf& ff_linear1_bias,
-                                      const MatrixXf& ff_linear2_weight, const VectorXf& ff_linear2_bias, const VectorXf& norm2_gamma,
-                                      const VectorXf& norm2_beta)
+void transformer_t::set_layer_weights(const int layer_idx, const weight_matrix_t& self_attn_qkv_weight, const weight_vector_t& self_attn_qkv_bias,
+                                      const weight_matrix_t& self_attn_out_proj_weight, const weight_vector_t& self_attn_out_proj_bias,
+                                      const weight_vector_t& norm1_gamma, const weight_vector_t& norm1_beta, const weight_matrix_t& ff_linear1_weight,
+                                      const weight_vector_t& ff_linear1_bias, const weight_matrix_t& ff_linear2_weight,
+                                      const weight_vector_t& ff_linear2_bias, const weight_vector_t& norm2_gamma, const weight_vector_t& norm2_beta)
 {
     layers[layer_idx].set_weights(self_attn_qkv_weight, self_attn_qkv_bias, self_attn_out_proj_weight, self_attn_out_proj_bias, norm1_gamma,
                                   norm1_beta, ff_linear1_weight, ff_linear1_bias, ff_linear2_weight, ff_linear2_bias, norm2_gamma, norm2_beta);
-}
\ No newline at end of file
+}
+
+void transformer_t::enable_streaming(int num_heads, size_t memory_budget, layer_source_t source)
+{
+    streamer = std::make_unique<layer_streamer_t>(get_num_layers(), num_heads, memory_budget, std::move(source));
+    layers.clear();
+}
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include "../eigen_config.h"
 #include "decoder_layer.h"
+#include "kv_cache.h"
+#include "layer_streamer.h"
+#include "sequence_batch.h"
+#include "workspace.h"
 
 // transformer_t class
 // This stacks multiple Encoder Layers
@@ -11,6 +16,12 @@ private:
 
     std::vector<decoder_layer_t> layers;
 
+    // set when the layers are streamed in rather than kept resident, layers is empty then
+    std::unique_ptr<layer_streamer_t> streamer;
+
+    // for the calls that don't bring their own workspace
+    workspace_t own_workspace;
+
 public:
 
     transformer_t(int num_layers, int d_model, int num_heads, int d_ff)
@@ -21,11 +32,49 @@ public:
         }
     }
 
+    // one layer per entry of layer_weights, built straight from the loaded weights
+    transformer_t(int num_heads, const std::vector<decoder_layer_weights_t>& layer_weights)
+    {
+        layers.reserve(layer_weights.size());
+        for (const decoder_layer_weights_t& weights : layer_weights) {
+            layers.emplace_back(num_heads, weights);
+        }
+    }
+
     MatrixXf forward(const MatrixXf& X);
 
-    void set_layer_weights(const int layer_idx, const MatrixXf& self_attn_qkv_weight, const VectorXf& self_attn_qkv_bias,
-                           const MatrixXf& self_attn_out_proj_weight, const VectorXf& self_attn_out_proj_bias, const VectorXf& norm1_gamma,
-                           const VectorXf& norm1_beta, const MatrixXf& ff_linear1_weight, const VectorXf& ff_linear1_bias,
-                           const MatrixXf& ff_linear2_weight, const VectorXf& ff_linear2_bias, const VectorXf& norm2_gamma,
-                           const VectorXf& norm2_beta);
+    // step path for incremental decoding
+    // X holds just the embeddings of the new positions, which start at position cache.size()
+    MatrixXf forward_step(const MatrixXf& X, kv_cache_t& cache);
+
+    // batched path: X holds several sequences of different lengths packed back to back as described by batch
+    // if caches is not empty it holds one cache per sequence and each sequence's rows continue on from its cache
+    MatrixXf forward_batch(const MatrixXf& X, const sequence_batch_t& batch, const std::vector<kv_cache_t*>& caches = {});
+
+    // same as forward_batch, but stopping after the first num_layers layers, e.g. as a cheap draft of the full model
+    // only those layers of the caches are extended
+    MatrixXf forward_first_layers(const MatrixXf& X, const sequence_batch_t& batch, const std::vector<kv_cache_t*>& caches, int num_layers);
+
+    // the same again, but running the layers over the hidden states in place with every intermediate result kept in
+    // workspace, so once the workspace has seen a step of this size nothing is allocated
+    void forward_in_place(Eigen::Ref<activation_matrix_t> hidden, const sequence_batch_t& batch, const std::vector<kv_cache_t*>& caches,
+                          int num_layers, workspace_t& workspace);
+
+    // switch every layer over to int8 weights
+    void quantize_int8();
+
+    // drop the resident layers and load each one from source as the forward pass reaches it instead, keeping at most
+    // memory_budget bytes of layers in memory, see layer_streamer_t
+    void enable_streaming(int num_heads, size_t memory_budget, layer_source_t source);
+
+    // nullptr unless streaming
+    const layer_streaming_stats_t* get_streaming_stats() const { return streamer ? &streamer->get_stats() : nullptr; }
+
+    int get_num_layers() const { return streamer ? streamer->size() : layers.size(); }
+
+    void set_layer_weights(const int layer_idx, const weight_matrix_t& self_attn_qkv_weight, const weight_vector_t& self_attn_qkv_bias,
+                           const weight_matrix_t& self_attn_out_proj_weight, const weight_vector_t& self_attn_out_proj_bias,
+                           const weight_vector_t& norm1_gamma, const weight_vector_t& norm1_beta, const weight_matrix_t& ff_linear1_weight,
+                           const weight_vector_t& ff_linear1_bias, const weight_matrix_t& ff_linear2_weight, const weight_vector_t& ff_linear2_bias,
+                           const weight_vector_t& norm2_gamma, const weight_vector_t& norm2_beta);
 };
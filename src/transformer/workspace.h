@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include "../eigen_config.h"
+#include "attention.h"
+#include "kv_cache.h"
+#include "quantized_matrix.h"
+#include "scratch_buffer.h"
+
+// Scratch memory for the forward passes of one session (or one batch)
+// Every intermediate result of the layers, from the layer norms through the QKV projection and the per-head softmax
+// state to the feed-forward hidden activations, is written into a buffer from here rather than a fresh matrix. The
+// buffers only grow (see scratch_buffer_t), so after the first step of a given size a forward pass doesn't allocate.
+// Each layer overwrites what the one before it left, so the workspace is only as big as a single layer's working set.
+class workspace_t {
+private:
+
+    std::vector<scratch_buffer_t> buffers;
+    std::vector<attention_scratch_t> head_scratch;
+    // one per width of activations, so switching between the d_model and d_ff wide inputs doesn't reallocate
+    std::vector<quantized_rows_t> quantized;
+    std::vector<layer_kv_cache_t> layer_caches;
+
+public:
+
+    // what each buffer holds, any one of them is only used for one thing at a time
+    enum buffer_t {
+        // the residual stream, i.e. the hidden states passed from one layer to the next
+        hidden,
+        // output of whichever layer norm ran last
+        normed,
+        // fused Q, K and V projection, shape: [rows, 3 * d_model]
+        qkv,
+        // the heads' outputs side by side, before the output projection
+        heads,
+        // output of an int8 projection, before it's added onto the residual stream
+        projection,
+        // the feed-forward network's hidden activations, shape: [rows, d_ff]
+        ff_hidden,
+        num_buffers
+    };
+
+    workspace_t() : buffers(num_buffers) {}
+
+    scratch_buffer_t::matrix_map_t matrix(buffer_t buffer, Eigen::Index rows, Eigen::Index cols) { return buffers[buffer].matrix(rows, cols); }
+
+    // one scratch space per head so they can run on different threads, call this before splitting them up
+    std::vector<attention_scratch_t>& heads_scratch(int num_heads)
+    {
+        if (static_cast<int>(head_scratch.size()) < num_heads) {
+            head_scratch.resize(num_heads);
+        }
+        return head_scratch;
+    }
+
+    // for quantizing cols wide activations for the int8 projections
+    quantized_rows_t& quantized_rows(Eigen::Index cols)
+    {
+        for (quantized_rows_t& rows : quantized) {
+            if (rows.values.cols() == cols) {
+                return rows;
+            }
+        }
+        quantized.emplace_back();
+        quantized.back().values.resize(0, cols);
+        return quantized.back();
+    }
+
+    // for gathering every sequence's cache for one layer, empty but keeping its capacity
+    std::vector<layer_kv_cache_t>& layer_cache_list()
+    {
+        layer_caches.clear();
+        return layer_caches;
+    }
+
+    // memory held by the buffers
+    size_t bytes() const
+    {
+        size_t total = 0;
+        for (const quantized_rows_t& rows : quantized) {
+            total += rows.values.size() * sizeof(int8_t) + rows.scales.size() * sizeof(float);
+        }
+        for (const scratch_buffer_t& buffer : buffers) {
+            total += buffer.bytes();
+        }
+        for (const attention_scratch_t& head : head_scratch) {
+            total += head.scores.bytes() + head.partial_output.bytes() + head.row_max.bytes() + head.row_sum.bytes() + head.tile_max.bytes() +
+                     head.correction.bytes();
+        }
+        return total;
+    }
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+// Unicode character classes used to split text the way GPT-2's pre-tokenizer pattern does
+
+// \p{L}, any letter in any script
+bool is_letter(char32_t c);
+
+// \p{N}, digits but also numerals like roman numerals and fractions
+bool is_number(char32_t c);
+
+// \s, the characters with the White_Space property
+bool is_whitespace(char32_t c);
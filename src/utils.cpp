@@ -1,4 +1,5 @@
 #include "utils.h"
+#include <sys/resource.h>
 #include <cmath>
 #include <random>
 #include "logger.h"
@@ -14,6 +15,14 @@ void die(const string_t& message)
     throw std::runtime_error(message);
 }
 
+size_t peak_rss_bytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // linux reports this in kilobytes
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
 // Softmax function
 // Used in attention mechanism to convert scores to probabilities
 VectorXf softmax(const VectorXf& x)
@@ -85,7 +94,7 @@ float relu(float x)
 
 float gelu(float x) {
     const float sqrt_2_over_pi = std::sqrt(2.0f / M_PI);
-    return 0.5f * x * (1.0f + std::tanh(sqrt_2_over_pi * (x + 0.044715f * std::pow(x, 3.0f))));
+    return 0.5f * x * (1.0f + std::tanh(sqrt_2_over_pi * (x + 0.044715f * x * x * x)));
 }
 
 Eigen::MatrixXf apply_relu(const Eigen::MatrixXf& X)
@@ -4,6 +4,9 @@
 
 void die(const string_t& message);
 
+// the most memory this process has had resident at once so far, in bytes
+size_t peak_rss_bytes();
+
 // Softmax function
 // Used in attention mechanism to convert scores to probabilities
 VectorXf softmax(const VectorXf& x);
@@ -0,0 +1,179 @@
+#include "weight_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include "utils.h"
+
+using namespace weight_file_format;
+
+weight_file_writer_t::weight_file_writer_t(const string_t& path) : file(path, std::ios::binary | std::ios::trunc)
+{
+    if (!file) {
+        die("Cannot open " + path + " for writing");
+    }
+
+    // the header is only filled in by finish, once the table's offset is known
+    header_t header = {};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    offset = sizeof(header);
+}
+
+void weight_file_writer_t::pad_to_alignment()
+{
+    static const char zeros[alignment] = {};
+    uint64_t padding = (alignment - offset % alignment) % alignment;
+    file.write(zeros, padding);
+    offset += padding;
+}
+
+void weight_file_writer_t::add(const string_t& name, const Eigen::Ref<const MatrixXf>& tensor)
+{
+    if (name.empty() || name.size() > max_name_length) {
+        die("Invalid tensor name for the weight file: " + name);
+    }
+
+    pad_to_alignment();
+
+    table_entry_t entry = {};
+    std::memcpy(entry.name, name.data(), name.size());
+    entry.rows = tensor.rows();
+    entry.cols = tensor.cols();
+    entry.offset = offset;
+    table.push_back(entry);
+
+    // a Ref can have an outer stride, so write a column at a time
+    for (Eigen::Index c = 0; c < tensor.cols(); ++c) {
+        file.write(reinterpret_cast<const char*>(tensor.col(c).data()), tensor.rows() * sizeof(float));
+    }
+    offset += tensor.size() * sizeof(float);
+}
+
+void weight_file_writer_t::finish()
+{
+    pad_to_alignment();
+
+    header_t header = {};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.num_tensors = table.size();
+    header.table_offset = offset;
+
+    file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(table_entry_t));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+
+    if (!file) {
+        die("Failed to write the weight file");
+    }
+}
+
+bool weight_file_t::is_weight_file(const string_t& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char file_magic[sizeof(magic)] = {};
+    file.read(file_magic, sizeof(file_magic));
+    return file && std::memcmp(file_magic, magic, sizeof(magic)) == 0;
+}
+
+weight_file_t::weight_file_t(const string_t& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        die("Cannot open weight file " + path);
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(header_t)) {
+        close(fd);
+        die("Weight file " + path + " is too small to hold a header");
+    }
+    size = file_stat.st_size;
+
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps the file alive on its own
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        die("Cannot mmap weight file " + path);
+    }
+    data = static_cast<const char*>(mapping);
+
+    // the destructor doesn't run when the constructor throws, so a rejected file has to be unmapped here
+    auto reject = [this](const string_t& message) {
+        munmap(const_cast<char*>(data), size);
+        data = nullptr;
+        die(message);
+    };
+
+    // every size is checked against what's left of the file before it's added to anything, so a crafted file can't
+    // wrap the sums around and pass the bounds checks
+    const header_t* header = reinterpret_cast<const header_t*>(data);
+    if (std::memcmp(header->magic, magic, sizeof(magic)) == 0 && header->version == __builtin_bswap32(version)) {
+        reject(path + " was written on a machine with the other byte order");
+    }
+    if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version) {
+        reject(path + " is not a version " + std::to_string(version) + " weight file");
+    }
+    if (header->table_offset % alignment != 0 || header->table_offset > size ||
+        header->num_tensors > (size - header->table_offset) / sizeof(table_entry_t)) {
+        reject("Weight file " + path + " is truncated");
+    }
+
+    const table_entry_t* table = reinterpret_cast<const table_entry_t*>(data + header->table_offset);
+    for (uint32_t i = 0; i < header->num_tensors; ++i) {
+        const table_entry_t& tensor = table[i];
+        bool in_bounds = tensor.offset <= header->table_offset;
+        if (in_bounds && tensor.rows != 0) {
+            uint64_t floats_left = (header->table_offset - tensor.offset) / sizeof(float);
+            in_bounds = tensor.cols <= floats_left / tensor.rows;
+        }
+        if (tensor.name[max_name_length] != '\0' || tensor.offset % alignment != 0 || !in_bounds) {
+            reject("Weight file " + path + " has a corrupt table entry");
+        }
+        tensors[tensor.name] = &tensor;
+    }
+}
+
+weight_file_t::~weight_file_t()
+{
+    if (data) {
+        munmap(const_cast<char*>(data), size);
+    }
+}
+
+const table_entry_t& weight_file_t::entry(const string_t& name) const
+{
+    auto it = tensors.find(name);
+    if (it == tensors.end()) {
+        die("Weight file has no tensor named " + name);
+    }
+    return *it->second;
+}
+
+weight_matrix_view_t weight_file_t::matrix(const string_t& name) const
+{
+    const table_entry_t& tensor = entry(name);
+    return weight_matrix_view_t(reinterpret_cast<const float*>(data + tensor.offset), tensor.rows, tensor.cols);
+}
+
+weight_vector_view_t weight_file_t::vector(const string_t& name) const
+{
+    const table_entry_t& tensor = entry(name);
+    if (tensor.cols != 1) {
+        die("Weight file tensor " + name + " is not a vector");
+    }
+    return weight_vector_view_t(reinterpret_cast<const float*>(data + tensor.offset), tensor.rows);
+}
+
+void weight_file_t::release(const string_t& name) const
+{
+    const table_entry_t& tensor = entry(name);
+
+    // madvise works on whole pages, the neighbours sharing the end pages just get read back in if they're needed
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t first = tensor.offset / page_size * page_size;
+    size_t end = tensor.offset + tensor.rows * tensor.cols * sizeof(float);
+    madvise(const_cast<char*>(data) + first, end - first, MADV_DONTNEED);
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include "eigen_config.h"
+#include "types/basic_types.h"
+
+// Native weight format
+// A flat file in host byte order (little-endian on every supported target) that can be mmap'd and used in place: a
+// fixed header, the tensors themselves and then a table describing them. A file from a machine with the other byte
+// order reads back with a byte swapped version, and is rejected. Every tensor is stored column-major (Eigen's default)
+// in exactly the layout the model uses, already transposed where needed, and starts on a 64 byte boundary so the
+// views are aligned for SIMD loads.
+//
+//   header:  magic "GPT2WTS\0", uint32 version, uint32 tensor count, uint64 offset of the table, zero padded to 64 bytes
+//   data:    the tensors, each padded out to the next 64 byte boundary
+//   table:   one 128 byte entry per tensor: a zero terminated name of up to 103 characters, uint64 rows, uint64 cols
+//            and the uint64 offset of its data from the start of the file
+
+namespace weight_file_format {
+
+constexpr char magic[8] = {'G', 'P', 'T', '2', 'W', 'T', 'S', '\0'};
+constexpr uint32_t version = 1;
+constexpr uint64_t alignment = 64;
+constexpr size_t header_size = 64;
+constexpr size_t max_name_length = 103;
+
+struct header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_tensors;
+    uint64_t table_offset;
+    char padding[header_size - 24];
+};
+
+struct table_entry_t {
+    char name[max_name_length + 1];
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t offset;
+};
+
+static_assert(sizeof(header_t) == header_size, "weight file header must be 64 bytes");
+static_assert(sizeof(table_entry_t) == 128, "weight file table entries must be 128 bytes");
+
+}  // namespace weight_file_format
+
+// read only view of a tensor inside a mapped weight file
+using weight_matrix_view_t = Eigen::Map<const MatrixXf, Eigen::Aligned64>;
+using weight_vector_view_t = Eigen::Map<const VectorXf, Eigen::Aligned64>;
+
+// Writes a native weight file one tensor at a time, so converting never needs more than one tensor in memory
+class weight_file_writer_t {
+private:
+
+    std::ofstream file;
+    std::vector<weight_file_format::table_entry_t> table;
+    uint64_t offset = 0;
+
+    void pad_to_alignment();
+
+public:
+
+    explicit weight_file_writer_t(const string_t& path);
+
+    void add(const string_t& name, const Eigen::Ref<const MatrixXf>& tensor);
+
+    // write the table and the header, nothing is readable until this has been called
+    void finish();
+};
+
+// A native weight file mapped read only into memory
+// The views point straight into the mapping, so they stay valid for as long as the weight_file_t does. Pages are only
+// read in from disk when first touched, and every process mapping the same file shares them through the page cache.
+class weight_file_t {
+private:
+
+    const char* data = nullptr;
+    size_t size = 0;
+    std::unordered_map<string_t, const weight_file_format::table_entry_t*> tensors;
+
+    const weight_file_format::table_entry_t& entry(const string_t& name) const;
+
+public:
+
+    explicit weight_file_t(const string_t& path);
+    ~weight_file_t();
+
+    weight_file_t(const weight_file_t&) = delete;
+    weight_file_t& operator=(const weight_file_t&) = delete;
+
+    // true if the file exists and starts with the native format's magic
+    static bool is_weight_file(const string_t& path);
+
+    bool contains(const string_t& name) const { return tensors.count(name) != 0; }
+
+    weight_matrix_view_t matrix(const string_t& name) const;
+
+    // a tensor with a single column
+    weight_vector_view_t vector(const string_t& name) const;
+
+    // tell the kernel this process is done with a tensor's pages for now, so they stop counting towards its resident
+    // memory. Views stay valid, the pages are just read back in from the file if they're touched again
+    void release(const string_t& name) const;
+};
@@ -1,5 +1,6 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <limits>
 #include <random>
 #include "../src/eigen_config.h"
 #include "../src/transformer/multi_head_attention.h"
@@ -73,4 +74,47 @@ TEST_CASE("Multi-Head Attention matches PyTorch output", "[multi_head_attention]
     REQUIRE(output.cols() == expected_output.cols());
 
     REQUIRE(matrices_approx_equal(output, expected_output, 1e-4));
-}
\ No newline at end of file
+}
+
+// straightforward attention over the full score matrix, to check the tiled kernel against
+static Eigen::MatrixXf reference_attention(const Eigen::MatrixXf& Q, const Eigen::MatrixXf& K, const Eigen::MatrixXf& V, bool causal)
+{
+    Eigen::MatrixXf scores = Q * K.transpose() / std::sqrt(static_cast<float>(Q.cols()));
+    int offset = K.rows() - Q.rows();
+    Eigen::MatrixXf weights(scores.rows(), scores.cols());
+    for (int i = 0; i < scores.rows(); ++i) {
+        if (causal) {
+            for (int j = offset + i + 1; j < scores.cols(); ++j) {
+                scores(i, j) = -std::numeric_limits<float>::infinity();
+            }
+        }
+        weights.row(i) = softmax(scores.row(i).transpose()).transpose();
+    }
+    return weights * V;
+}
+
+TEST_CASE("Tiled attention matches the full score matrix", "[attention]")
+{
+    int d_k = 64;
+    attention_t attn;
+
+    // lengths that don't line up with the tiles, and queries that only cover the end of the keys as when decoding
+    for (auto [q_len, kv_len] : std::vector<std::pair<int, int>>{{1, 1}, {10, 10}, {150, 150}, {1, 200}, {70, 135}}) {
+        Eigen::MatrixXf Q = Eigen::MatrixXf::Random(q_len, d_k);
+        Eigen::MatrixXf K = Eigen::MatrixXf::Random(kv_len, d_k);
+        Eigen::MatrixXf V = Eigen::MatrixXf::Random(kv_len, d_k);
+
+        REQUIRE(matrices_approx_equal(attn.forward(Q, K, V, true), reference_attention(Q, K, V, true), 1e-5));
+        REQUIRE(matrices_approx_equal(attn.forward(Q, K, V, false), reference_attention(Q, K, V, false), 1e-5));
+
+        // and split into uneven blocks as a paged cache would hand them over
+        activation_matrix_t K_rows = K, V_rows = V;
+        std::vector<kv_block_map_t> K_blocks, V_blocks;
+        for (int row = 0; row < kv_len; row += 16) {
+            int rows = std::min(16, kv_len - row);
+            K_blocks.emplace_back(K_rows.data() + row * d_k, rows, d_k, Eigen::OuterStride<>(d_k));
+            V_blocks.emplace_back(V_rows.data() + row * d_k, rows, d_k, Eigen::OuterStride<>(d_k));
+        }
+        REQUIRE(matrices_approx_equal(attn.forward_blocks(Q, K_blocks, V_blocks), reference_attention(Q, K, V, true), 1e-5));
+    }
+}
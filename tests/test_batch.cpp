@@ -0,0 +1,62 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include "../src/eigen_config.h"
+#include "../src/gpt2.h"
+#include "../src/transformer/sequence_batch.h"
+#include "test_utils.h"
+
+TEST_CASE("Sequence batch offsets", "[batch]")
+{
+    sequence_batch_t batch({3, 1, 5});
+
+    REQUIRE(batch.size() == 3);
+    REQUIRE(batch.total_rows() == 9);
+    REQUIRE(batch.offset(0) == 0);
+    REQUIRE(batch.offset(1) == 3);
+    REQUIRE(batch.offset(2) == 4);
+}
+
+TEST_CASE("GPT2 batched forward matches individual forwards", "[batch]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    std::vector<std::vector<int>> prompts = {gpt2.tokenize("GPT2 is a model developed by OpenAI"), gpt2.tokenize("Hello"),
+                                             gpt2.tokenize("The quick brown fox jumps over the lazy dog")};
+
+    MatrixXf batch_logits = gpt2.forward_batch(prompts);
+
+    // every sequence should only see itself, so its rows should match running it on its own
+    int offset = 0;
+    for (const std::vector<int>& prompt : prompts) {
+        MatrixXf logits = gpt2.forward(prompt);
+        REQUIRE(matrices_approx_equal(batch_logits.middleRows(offset, prompt.size()), logits, 1e-2));
+        offset += prompt.size();
+    }
+    REQUIRE(offset == batch_logits.rows());
+}
+
+TEST_CASE("GPT2 batched step mixes prefill and decode", "[batch]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    std::vector<int> first = gpt2.tokenize("GPT2 is a model developed by OpenAI");
+    std::vector<int> second = gpt2.tokenize("The quick brown fox jumps over the lazy dog");
+
+    MatrixXf first_logits = gpt2.forward(first);
+    MatrixXf second_logits = gpt2.forward(second);
+
+    // the first sequence has already prefilled all but its last token, the second is prefilled from scratch in the same batch
+    gpt2_session_t first_session = gpt2.create_session();
+    gpt2_session_t second_session = gpt2.create_session();
+    gpt2.forward_step(std::vector<int>(first.begin(), first.end() - 1), first_session);
+
+    MatrixXf batch_logits = gpt2.forward_batch({{first.back()}, second}, {&first_session, &second_session});
+
+    REQUIRE(batch_logits.rows() == 1 + static_cast<int>(second.size()));
+    REQUIRE(matrices_approx_equal(batch_logits.topRows(1), first_logits.bottomRows(1), 1e-2));
+    REQUIRE(matrices_approx_equal(batch_logits.bottomRows(second.size()), second_logits, 1e-2));
+    REQUIRE(first_session.size() == static_cast<int>(first.size()));
+    REQUIRE(second_session.tokens == second);
+}
@@ -0,0 +1,98 @@
+#include <catch2/catch_all.hpp>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include "../src/batch_tokenizer.h"
+#include "../src/tokenizer.h"
+
+namespace {
+
+std::vector<int> read_tokens(const std::string& bytes)
+{
+    std::vector<uint16_t> tokens(bytes.size() / sizeof(uint16_t));
+    std::memcpy(tokens.data(), bytes.data(), tokens.size() * sizeof(uint16_t));
+    return std::vector<int>(tokens.begin(), tokens.end());
+}
+
+}  // namespace
+
+TEST_CASE("Batch tokenizer splits only where the tokens can't change", "[batch_tokenizer]")
+{
+    REQUIRE(batch_tokenizer_t::find_split("the cat", 0) == 3);
+    REQUIRE(batch_tokenizer_t::find_split("the cat sat", 4) == 7);
+    // not after whitespace, which could join the space into a run, and not before it
+    REQUIRE(batch_tokenizer_t::find_split("the  cat\n mat", 0) == std::string_view::npos);
+    // not next to a multi byte character, which might be whitespace
+    REQUIRE(batch_tokenizer_t::find_split("caf\xC3\xA9 au", 0) == std::string_view::npos);
+    // and never at the very end, where what follows the space isn't known yet
+    REQUIRE(batch_tokenizer_t::find_split("the ", 0) == std::string_view::npos);
+}
+
+TEST_CASE("Batch tokenizer gives the same tokens as tokenizing in one go", "[batch_tokenizer]")
+{
+    tokenizer_t tokenizer("gpt2/vocab.json", "gpt2/merges.txt");
+
+    std::mt19937 rng(3);
+    std::vector<std::string> pieces = {"the", " quick", " brown", " fox", "'s", " ", "  ", "\n", "\n\n", "\t", " 42", "!", ", ",
+                                       " naïve", " 日本語", "　", " \xE2\x80\x83", "_", "\xFF"};
+    std::string text;
+    while (text.size() < 200000) {
+        text += pieces[rng() % pieces.size()];
+    }
+    std::vector<int> expected = tokenizer.tokenize(text);
+
+    // tiny segments so there are lots of splits, and blocks that leave a tail to carry over
+    for (auto [segment_bytes, threads] : std::vector<std::pair<size_t, int>>{{16, 1}, {100, 3}, {4096, 4}, {1 << 20, 2}}) {
+        std::istringstream input(text);
+        std::ostringstream output;
+        batch_tokenization_stats_t stats = batch_tokenizer_t(tokenizer, segment_bytes, threads).tokenize(input, output);
+
+        REQUIRE(read_tokens(output.str()) == expected);
+        REQUIRE(stats.bytes == text.size());
+        REQUIRE(stats.tokens == expected.size());
+    }
+}
+
+TEST_CASE("Batch tokenizer falls back to chunk ends without ASCII split points", "[batch_tokenizer]")
+{
+    tokenizer_t tokenizer("gpt2/vocab.json", "gpt2/merges.txt");
+
+    // no space ever sits between two ASCII characters that aren't whitespace, so find_split never finds anything
+    std::mt19937 rng(5);
+    std::vector<std::string> pieces = {"日本語", "のテキスト", "。", "\n", "\n\n", "　", "abc", ",", "\n ", ":\t", "{\"k\":1}", "Ελληνικά"};
+    std::string text;
+    while (text.size() < 100000) {
+        text += pieces[rng() % pieces.size()];
+    }
+    REQUIRE(batch_tokenizer_t::find_split(text, 0) == std::string_view::npos);
+
+    // cutting at a chunk end gives the same tokens as the whole
+    for (size_t from : {1, 100, 5000, 99000}) {
+        size_t split = batch_tokenizer_t::find_chunk_split(text, from);
+        REQUIRE(split != std::string_view::npos);
+        REQUIRE(split >= from);
+        std::vector<int> halves = tokenizer.tokenize(text.substr(0, split));
+        std::vector<int> second = tokenizer.tokenize(text.substr(split));
+        halves.insert(halves.end(), second.begin(), second.end());
+        REQUIRE(halves == tokenizer.tokenize(text));
+    }
+    // not so close to the end that what comes next could still move it
+    REQUIRE(batch_tokenizer_t::find_chunk_split("abc def", 4) == std::string_view::npos);
+
+    // many blocks of it, which used to pile up as one ever growing carry
+    std::vector<int> expected = tokenizer.tokenize(text);
+    for (auto [segment_bytes, threads] : std::vector<std::pair<size_t, int>>{{64, 4}, {1000, 3}, {4096, 2}}) {
+        std::istringstream input(text);
+        std::ostringstream output;
+        batch_tokenizer_t(tokenizer, segment_bytes, threads).tokenize(input, output);
+        REQUIRE(read_tokens(output.str()) == expected);
+    }
+
+    // a single chunk longer than any block can't be cut at all, it's carried until it ends
+    std::string one_chunk(20000, 'x');
+    std::istringstream input(one_chunk + "。" + one_chunk);
+    std::ostringstream output;
+    batch_tokenizer_t(tokenizer, 64, 4).tokenize(input, output);
+    REQUIRE(read_tokens(output.str()) == tokenizer.tokenize(one_chunk + "。" + one_chunk));
+}
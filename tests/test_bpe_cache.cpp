@@ -0,0 +1,107 @@
+#include <catch2/catch_all.hpp>
+#include <thread>
+#include "../src/bpe_cache.h"
+#include "../src/tokenizer.h"
+
+TEST_CASE("BPE cache evicts the least recently used chunks", "[bpe_cache]")
+{
+    // one entry per shard, so chunks landing in the same shard push each other out
+    bpe_cache_t cache(bpe_cache_t::num_shards);
+    std::vector<int> tokens = {1, 2, 3};
+
+    std::vector<int> output;
+    REQUIRE_FALSE(cache.lookup("hello", output));
+    cache.insert("hello", tokens.data(), tokens.size());
+    REQUIRE(cache.lookup("hello", output));
+    REQUIRE(output == tokens);
+
+    // a hit appends to what is already there
+    REQUIRE(cache.lookup("hello", output));
+    REQUIRE(output == std::vector<int>({1, 2, 3, 1, 2, 3}));
+
+    // fill the cache well past its capacity, "hello" has to go eventually
+    for (int i = 0; i < 1000; ++i) {
+        std::string chunk = "chunk " + std::to_string(i);
+        cache.insert(chunk, &i, 1);
+    }
+    bpe_cache_stats_t stats = cache.get_stats();
+    REQUIRE(stats.entries <= static_cast<long>(bpe_cache_t::num_shards));
+    REQUIRE(stats.evictions == 1001 - stats.entries);
+    REQUIRE(stats.hits == 2);
+    REQUIRE(stats.misses == 1);
+
+    // the most recent insert is still there
+    output.clear();
+    REQUIRE(cache.lookup("chunk 999", output));
+    REQUIRE(output == std::vector<int>({999}));
+
+    // chunks too long to be worth keeping are never cached
+    std::string long_chunk(bpe_cache_t::max_chunk_bytes + 1, 'x');
+    cache.insert(long_chunk, tokens.data(), tokens.size());
+    REQUIRE_FALSE(cache.lookup(long_chunk, output));
+
+    cache.clear();
+    REQUIRE(cache.get_stats().entries == 0);
+    REQUIRE_FALSE(cache.lookup("chunk 999", output));
+}
+
+TEST_CASE("BPE cache can be shared between threads", "[bpe_cache]")
+{
+    bpe_cache_t cache(64);
+    int num_threads = 8, rounds = 2000;
+
+    // every thread looks up and inserts the same small set of chunks, whatever it gets back must be what was stored
+    std::vector<int> failures(num_threads, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            std::vector<int> output;
+            for (int i = 0; i < rounds; ++i) {
+                int key = (i * 7 + t) % 100;
+                std::string chunk = "word" + std::to_string(key);
+                std::vector<int> expected = {key, key + 1};
+
+                output.clear();
+                if (cache.lookup(chunk, output)) {
+                    failures[t] += output != expected;
+                } else {
+                    cache.insert(chunk, expected.data(), expected.size());
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (int t = 0; t < num_threads; ++t) {
+        REQUIRE(failures[t] == 0);
+    }
+    bpe_cache_stats_t stats = cache.get_stats();
+    REQUIRE(stats.hits + stats.misses == num_threads * rounds);
+    REQUIRE(stats.entries <= 64);
+}
+
+TEST_CASE("Tokenizer gives the same tokens with and without the cache", "[bpe_cache]")
+{
+    tokenizer_t tokenizer("gpt2/vocab.json", "gpt2/merges.txt");
+
+    std::string text;
+    for (int i = 0; i < 200; ++i) {
+        text += "The cache should make repeated words cheap, word " + std::to_string(i % 13) + " and so on.\n";
+    }
+
+    tokenizer.set_cache_capacity(0);
+    std::vector<int> uncached = tokenizer.tokenize(text);
+    REQUIRE(tokenizer.get_cache_stats().hits == 0);
+
+    // small enough that it has to evict as it goes
+    tokenizer.set_cache_capacity(32);
+    REQUIRE(tokenizer.tokenize(text) == uncached);
+    REQUIRE(tokenizer.tokenize(text) == uncached);
+
+    bpe_cache_stats_t stats = tokenizer.get_cache_stats();
+    REQUIRE(stats.hits > 0);
+    REQUIRE(stats.evictions > 0);
+    REQUIRE(stats.hit_rate() > 0.5);
+}
@@ -22,8 +22,8 @@ TEST_CASE("Decoder Layer Forward Pass", "[encoder_layer]")
     // Set weights and biases
     decoder_layer.set_weights(gpt_weights.layers[0].attn_c_attn_weight, gpt_weights.layers[0].attn_c_attn_bias,
                               gpt_weights.layers[0].attn_c_proj_weight, gpt_weights.layers[0].attn_c_proj_bias, gpt_weights.layers[0].ln_1_weight,
-                              gpt_weights.layers[0].ln_1_bias, gpt_weights.layers[0].mlp_c_fc_weight.transpose(), gpt_weights.layers[0].mlp_c_fc_bias,
-                              gpt_weights.layers[0].mlp_c_proj_weight.transpose(), gpt_weights.layers[0].mlp_c_proj_bias,
+                              gpt_weights.layers[0].ln_1_bias, gpt_weights.layers[0].mlp_c_fc_weight, gpt_weights.layers[0].mlp_c_fc_bias,
+                              gpt_weights.layers[0].mlp_c_proj_weight, gpt_weights.layers[0].mlp_c_proj_bias,
                               gpt_weights.layers[0].ln_2_weight, gpt_weights.layers[0].ln_2_bias);
 
     // Load input
@@ -38,4 +38,30 @@ TEST_CASE("Decoder Layer Forward Pass", "[encoder_layer]")
     REQUIRE(output.cols() == pytorch_final_output.cols());
 
     REQUIRE(matrices_approx_equal(output, pytorch_final_output, 1e-1));
-}
\ No newline at end of file
+}
+
+TEST_CASE("Decoder layer built from weights matches set_weights", "[encoder_layer]")
+{
+    int d_model = 64;
+    int num_heads = 4;
+    int d_ff = 256;
+
+    decoder_layer_weights_t weights = {MatrixXf::Random(d_model, 3 * d_model), VectorXf::Random(3 * d_model),
+                                       MatrixXf::Random(d_model, d_model),     VectorXf::Random(d_model),
+                                       VectorXf::Random(d_model),              VectorXf::Random(d_model),
+                                       MatrixXf::Random(d_ff, d_model),        VectorXf::Random(d_ff),
+                                       MatrixXf::Random(d_model, d_ff),        VectorXf::Random(d_model),
+                                       VectorXf::Random(d_model),              VectorXf::Random(d_model)};
+
+    // no weights yet, so there's nothing to run
+    decoder_layer_t set_later(d_model, num_heads, d_ff);
+    MatrixXf input = MatrixXf::Random(5, d_model);
+    REQUIRE_THROWS(set_later.forward(input));
+
+    set_later.set_weights(weights.qkv_weights, weights.qkv_bias, weights.self_attn_out_proj_weight, weights.self_attn_out_proj_bias,
+                          weights.norm1_gamma, weights.norm1_beta, weights.ff_linear1_weight, weights.ff_linear1_bias, weights.ff_linear2_weight,
+                          weights.ff_linear2_bias, weights.norm2_gamma, weights.norm2_beta);
+    decoder_layer_t built(num_heads, weights);
+
+    REQUIRE(matrices_approx_equal(built.forward(input), set_later.forward(input)));
+}
@@ -1,8 +1,10 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
 #include <Eigen/Dense>
+#include "../src/transformer/activations.h"
 #include "../src/transformer/feed_forward.h"  // Assume this contains your feed_forward_t class
 #include <iostream>
+#include <omp.h>
 #include "test_utils.h"
 #include "../src/gpt2.h"
 
@@ -69,6 +71,43 @@ TEST_CASE("GELU function", "[gelu]") {
     }
 }
 
+TEST_CASE("Fused bias and GELU matches the scalar GELU", "[gelu]") {
+    // wide enough to cover the saturated ends of tanh, and not a multiple of the simd width
+    VectorXf bias = VectorXf::Random(45);
+    for (int rows : {1, 7}) {
+        activation_matrix_t X = MatrixXf::Random(rows, 45) * 12.0f;
+        MatrixXf expected = apply_gelu(X.rowwise() + bias.transpose());
+
+        bias_gelu_in_place(X, bias);
+        REQUIRE(matrices_approx_equal(X, expected, 1e-5f));
+    }
+}
+
+TEST_CASE("Feed-forward tiles add up to the whole projection", "[feed_forward]") {
+    // d_ff isn't a multiple of the tile width, so the last tile is a partial one
+    int d_model = 48;
+    int d_ff = 300;
+    MatrixXf W1 = MatrixXf::Random(d_ff, d_model);
+    MatrixXf W2 = MatrixXf::Random(d_model, d_ff);
+    VectorXf b1 = VectorXf::Random(d_ff);
+    VectorXf b2 = VectorXf::Random(d_model);
+    feed_forward_t ff(W1, W2, b1, b2);
+
+    MatrixXf X = MatrixXf::Random(5, d_model);
+    MatrixXf expected = (apply_gelu((X * W1.transpose()).rowwise() + b1.transpose()) * W2.transpose()).rowwise() + b2.transpose();
+    REQUIRE(matrices_approx_equal(ff.forward(X), expected, 1e-3f));
+    REQUIRE(matrices_approx_equal(ff.forward(X.topRows(1)), expected.topRows(1), 1e-3f));
+
+    // a prefill long enough to be split into blocks of rows as well, which takes more threads than tiles of columns
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(16);
+    MatrixXf prefill = MatrixXf::Random(101, d_model);
+    MatrixXf prefill_expected = (apply_gelu((prefill * W1.transpose()).rowwise() + b1.transpose()) * W2.transpose()).rowwise() + b2.transpose();
+    MatrixXf prefill_output = ff.forward(prefill);
+    omp_set_num_threads(threads);
+    REQUIRE(matrices_approx_equal(prefill_output, prefill_expected, 1e-3f));
+}
+
 TEST_CASE("Feed-Forward matches PyTorch output", "[feed_forward]") {
 
     int d_model = 768;
@@ -80,7 +119,7 @@ TEST_CASE("Feed-Forward matches PyTorch output", "[feed_forward]") {
 
     // Create and initialize feed_forward_t
     feed_forward_t ff(d_model, d_ff);
-    ff.set_weights(gpt_weights.layers[0].mlp_c_fc_weight.transpose(), gpt_weights.layers[0].mlp_c_proj_weight.transpose(),
+    ff.set_weights(gpt_weights.layers[0].mlp_c_fc_weight, gpt_weights.layers[0].mlp_c_proj_weight,
                     gpt_weights.layers[0].mlp_c_fc_bias, gpt_weights.layers[0].mlp_c_proj_bias);
 
     MatrixXf input = readMatrixFromFile("tests/test_data/feed_forward/ff_input.txt", seq_length, d_model);
@@ -40,4 +40,44 @@ TEST_CASE("Vocabulary loader correctly loads GPT-2 vocabulary", "[gpt2]")
     string_t next_token = gpt2.get_next_max_like_token(logits);
 
     REQUIRE(next_token == "Ġto");
-}
\ No newline at end of file
+}
+
+TEST_CASE("GPT2 generate matches greedy decoding with full forward passes", "[gpt2]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    std::vector<int> prompt = gpt2.tokenize("GPT2 is a model developed by OpenAI");
+
+    generation_params_t params;
+    params.max_new_tokens = 8;
+    params.stop_at_eos = false;
+
+    std::vector<int> streamed;
+    generation_result_t result = gpt2.generate(prompt, params, [&streamed](int token) { streamed.push_back(token); });
+
+    REQUIRE(result.tokens.size() == 8);
+    REQUIRE(streamed == result.tokens);
+    REQUIRE(result.stats.prompt_tokens == static_cast<int>(prompt.size()));
+    REQUIRE(result.stats.generated_tokens == 8);
+    REQUIRE(result.stats.token_latencies_ms.size() == 8);
+    REQUIRE(result.stats.tokens_per_second > 0);
+
+    // each generated token should be the argmax of a full, uncached, forward pass over everything before it
+    std::vector<int> sequence = prompt;
+    for (int token : result.tokens) {
+        MatrixXf logits = gpt2.forward(sequence);
+        Eigen::Index max_index;
+        logits.row(logits.rows() - 1).maxCoeff(&max_index);
+        REQUIRE(token == static_cast<int>(max_index));
+        sequence.push_back(token);
+    }
+
+    // stopping on a token should end generation just before it
+    int stop_token = result.tokens[4];
+    size_t stop_index = std::find(result.tokens.begin(), result.tokens.end(), stop_token) - result.tokens.begin();
+    params.stop_tokens = {stop_token};
+    generation_result_t stopped = gpt2.generate(prompt, params);
+
+    REQUIRE(stopped.tokens == std::vector<int>(result.tokens.begin(), result.tokens.begin() + stop_index));
+}
@@ -0,0 +1,98 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include "../src/eigen_config.h"
+#include "../src/gpt2.h"
+#include "../src/transformer/kv_block_pool.h"
+#include "../src/transformer/kv_cache.h"
+#include "../src/transformer/multi_head_attention.h"
+#include "test_utils.h"
+
+TEST_CASE("Paged KV cache grows and truncates", "[kv_cache]")
+{
+    kv_block_pool_t pool(1, 8, 2);
+
+    MatrixXf K = MatrixXf::Random(3, 8);
+    MatrixXf V = MatrixXf::Random(3, 8);
+
+    {
+        kv_cache_t cache(pool);
+        cache.layer(0).append(K, V);
+        cache.layer(0).append(K.topRows(1), V.topRows(1));
+
+        // 4 positions in blocks of 2
+        REQUIRE(cache.size() == 4);
+        REQUIRE(cache.get_block_table().size() == 2);
+        REQUIRE(pool.num_used() == 2);
+
+        // the positions should be spread over the blocks in order
+        REQUIRE(matrices_approx_equal(cache.layer(0).keys(0, 0, 8), K.topRows(2)));
+        REQUIRE(matrices_approx_equal(cache.layer(0).keys(1, 0, 8).topRows(1), K.row(2)));
+        REQUIRE(matrices_approx_equal(cache.layer(0).values(1, 0, 8).bottomRows(1), V.topRows(1)));
+        REQUIRE(matrices_approx_equal(cache.layer(0).keys(0, 2, 3), K.block(0, 2, 2, 3)));
+
+        // truncating hands back the blocks that are no longer needed
+        cache.truncate(2);
+        REQUIRE(cache.size() == 2);
+        REQUIRE(cache.layer(0).num_blocks() == 1);
+        REQUIRE(pool.num_used() == 1);
+        REQUIRE(pool.num_free() == 1);
+    }
+
+    // and destroying the cache returns everything to the pool
+    REQUIRE(pool.num_used() == 0);
+}
+
+TEST_CASE("Multi-Head Attention step matches full forward", "[kv_cache]")
+{
+    int d_model = 768;
+    int num_heads = 12;
+    int seq_length = 10;
+    int prefix_length = 6;
+
+    gpt2_weights_t gpt_weights = load_gpt2_weights("gpt2/tf_model.h5");
+
+    multi_head_attention_t mha(d_model, num_heads);
+    mha.set_weights2(gpt_weights.layers[0].attn_c_attn_weight, gpt_weights.layers[0].attn_c_attn_bias, gpt_weights.layers[0].attn_c_proj_weight,
+                     gpt_weights.layers[0].attn_c_proj_bias);
+
+    MatrixXf input = readMatrixFromFile("tests/test_data/multi_head_attention/mha_input.txt", seq_length, d_model);
+    MatrixXf full_output = mha.forward(input);
+
+    // run the prefix in one go, then the remaining positions one at a time
+    // small blocks so the cached keys and values are spread over several of them
+    kv_block_pool_t pool(1, d_model, 4);
+    kv_cache_t cache(pool);
+    MatrixXf step_output(seq_length, d_model);
+    step_output.topRows(prefix_length) = mha.forward_step(input.topRows(prefix_length), cache.layer(0));
+    for (int i = prefix_length; i < seq_length; ++i) {
+        step_output.row(i) = mha.forward_step(input.row(i), cache.layer(0));
+    }
+
+    REQUIRE(cache.size() == seq_length);
+    REQUIRE(matrices_approx_equal(step_output, full_output, 1e-4));
+}
+
+TEST_CASE("GPT2 incremental decoding matches full forward", "[kv_cache]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    std::vector<int> tokens = gpt2.tokenize("GPT2 is a model developed by OpenAI");
+    MatrixXf full_logits = gpt2.forward(tokens);
+
+    gpt2_session_t session = gpt2.create_session();
+
+    // prefill the first few tokens, then feed the rest one token per step like a decode loop would
+    int prefix_length = 4;
+    MatrixXf prefix_logits = gpt2.forward_step(std::vector<int>(tokens.begin(), tokens.begin() + prefix_length), session);
+    REQUIRE(matrices_approx_equal(prefix_logits, full_logits.topRows(prefix_length), 1e-2));
+
+    for (size_t i = prefix_length; i < tokens.size(); ++i) {
+        MatrixXf step_logits = gpt2.forward_step({tokens[i]}, session);
+        REQUIRE(step_logits.rows() == 1);
+        REQUIRE(matrices_approx_equal(step_logits, full_logits.row(i), 1e-2));
+    }
+
+    REQUIRE(session.size() == static_cast<int>(tokens.size()));
+    REQUIRE(session.tokens == tokens);
+}
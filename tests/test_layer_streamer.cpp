@@ -0,0 +1,87 @@
+#include <catch2/catch_test_macros.hpp>
+#include <filesystem>
+#include <vector>
+#include "../src/gpt2.h"
+#include "../src/transformer/layer_streamer.h"
+#include "../src/transformer/transformer.h"
+#include "test_utils.h"
+
+static decoder_layer_weights_t random_layer_weights(int d_model, int d_ff)
+{
+    return {MatrixXf::Random(d_model, 3 * d_model), VectorXf::Random(3 * d_model), MatrixXf::Random(d_model, d_model), VectorXf::Random(d_model),
+            VectorXf::Random(d_model),              VectorXf::Random(d_model),     MatrixXf::Random(d_ff, d_model),    VectorXf::Random(d_ff),
+            MatrixXf::Random(d_model, d_ff),        VectorXf::Random(d_model),     VectorXf::Random(d_model),          VectorXf::Random(d_model)};
+}
+
+TEST_CASE("Streamed transformer matches the resident one", "[streaming]")
+{
+    int d_model = 32;
+    int num_heads = 4;
+    int d_ff = 64;
+    int num_layers = 6;
+
+    std::vector<decoder_layer_weights_t> layer_weights;
+    for (int i = 0; i < num_layers; ++i) {
+        layer_weights.push_back(random_layer_weights(d_model, d_ff));
+    }
+    size_t layer_bytes = (4 * d_model * d_model + 2 * d_model * d_ff + 3 * d_model + d_ff + 5 * d_model) * sizeof(float);
+
+    transformer_t resident(num_heads, layer_weights);
+    transformer_t streamed(num_heads, layer_weights);
+
+    int loads = 0;
+    layer_source_t source;
+    source.load = [&layer_weights, &loads](int i) {
+        loads++;
+        return layer_weights[i];
+    };
+    source.bytes = [layer_bytes](int) { return layer_bytes; };
+    // room for three of the six layers
+    streamed.enable_streaming(num_heads, 3 * layer_bytes, source);
+    REQUIRE(streamed.get_num_layers() == num_layers);
+
+    MatrixXf input = MatrixXf::Random(5, d_model);
+    for (int pass = 1; pass <= 2; ++pass) {
+        REQUIRE(matrices_approx_equal(streamed.forward(input), resident.forward(input)));
+    }
+
+    // with only half the layers fitting, every layer is loaded again on the second pass
+    const layer_streaming_stats_t& stats = *streamed.get_streaming_stats();
+    REQUIRE(stats.peak_resident_bytes <= 3 * layer_bytes);
+    REQUIRE(stats.evictions > 0);
+    REQUIRE(stats.loads >= 2 * num_layers);
+    REQUIRE(stats.overlap() >= 0.0);
+    REQUIRE(stats.overlap() <= 1.0);
+
+    // a budget that can't hold a single layer is an error
+    transformer_t too_small(num_heads, layer_weights);
+    too_small.enable_streaming(num_heads, layer_bytes / 2, source);
+    REQUIRE_THROWS(too_small.forward(input));
+}
+
+TEST_CASE("GPT2 with streamed layers gives the same logits", "[streaming]")
+{
+    string_t path = (std::filesystem::temp_directory_path() / "test_streaming.weights").string();
+    convert_gpt2_weights(gpt2_t::h5_weights_path, path);
+
+    gpt2_t resident;
+    resident.init(path);
+    gpt2_t streamed;
+    streamed.init(path);
+    // a quarter of the layers at a time
+    streamed.enable_layer_streaming(3 * 7087104 * sizeof(float));
+
+    std::vector<int> tokens = resident.tokenize("GPT2 is a model developed by OpenAI");
+    REQUIRE(matrices_approx_equal(streamed.forward(tokens), resident.forward(tokens)));
+
+    // the kv cache path streams the same way
+    generation_params_t params;
+    params.max_new_tokens = 4;
+    params.stop_at_eos = false;
+    REQUIRE(streamed.generate(tokens, params).tokens == resident.generate(tokens, params).tokens);
+
+    REQUIRE(streamed.get_layer_streaming_stats()->loads > 12);
+    REQUIRE(resident.get_layer_streaming_stats() == nullptr);
+
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,77 @@
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <numeric>
+#include "../src/eigen_config.h"
+#include "../src/gpt2.h"
+#include "../src/transformer/lm_head.h"
+#include "test_utils.h"
+
+// the k largest entries of each row, best first, worked out the slow way from the full logits
+static std::vector<std::vector<int>> sorted_top_k(const MatrixXf& logits, int k)
+{
+    std::vector<std::vector<int>> result;
+    for (int r = 0; r < logits.rows(); ++r) {
+        std::vector<int> order(logits.cols());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return logits(r, a) > logits(r, b); });
+        result.emplace_back(order.begin(), order.begin() + k);
+    }
+    return result;
+}
+
+TEST_CASE("LM head top k matches the full logits", "[lm_head]")
+{
+    // a vocabulary spanning several tiles, with a partial one at the end
+    MatrixXf token_embedding = MatrixXf::Random(5000, 32);
+    MatrixXf hidden = MatrixXf::Random(3, 32);
+
+    lm_head_t lm_head;
+    lm_head.set_weights(token_embedding);
+    REQUIRE(lm_head.vocab_size() == 5000);
+
+    MatrixXf logits = lm_head.forward(hidden);
+    REQUIRE(matrices_approx_equal(logits, hidden * token_embedding.transpose(), 1e-4));
+
+    for (bool quantized : {false, true}) {
+        if (quantized) {
+            lm_head.quantize_int8();
+            logits = lm_head.forward(hidden);
+        }
+
+        std::vector<std::vector<token_logit_t>> top = lm_head.top_k(hidden, 5);
+        std::vector<std::vector<int>> expected = sorted_top_k(logits, 5);
+
+        REQUIRE(top.size() == 3);
+        for (int r = 0; r < 3; ++r) {
+            REQUIRE(top[r].size() == 5);
+            for (int i = 0; i < 5; ++i) {
+                REQUIRE(top[r][i].token == expected[r][i]);
+                REQUIRE(std::abs(top[r][i].logit - logits(r, expected[r][i])) < 1e-4f);
+            }
+        }
+    }
+}
+
+TEST_CASE("GPT2 last token logits and fused top k", "[lm_head]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    std::vector<std::vector<int>> prompts = {gpt2.tokenize("GPT2 is a model developed by OpenAI"), gpt2.tokenize("Hello")};
+
+    MatrixXf all_logits = gpt2.forward_batch(prompts);
+    MatrixXf last_logits = gpt2.forward_last(prompts);
+    std::vector<std::vector<token_logit_t>> top = gpt2.forward_top_k(prompts, {}, 3);
+
+    REQUIRE(last_logits.cols() == 2);
+    int row = 0;
+    for (size_t s = 0; s < prompts.size(); ++s) {
+        row += prompts[s].size();
+        REQUIRE(matrices_approx_equal(last_logits.col(s).transpose(), all_logits.row(row - 1), 1e-3));
+
+        REQUIRE(top[s].size() == 3);
+        REQUIRE(top[s][0].token == gpt2_t::max_like_token_id(all_logits, row - 1));
+        REQUIRE(top[s][0].logit >= top[s][1].logit);
+        REQUIRE(top[s][1].logit >= top[s][2].logit);
+    }
+}
@@ -30,4 +30,35 @@ TEST_CASE("LayerNorm forward pass", "[layernorm]")
         REQUIRE(norm_output.cols() == expected_output.cols());
         REQUIRE(matrices_approx_equal(norm_output, expected_output, 1e-4));
 
-}
\ No newline at end of file
+}
+TEST_CASE("LayerNorm kernels match a double precision reference", "[layernorm]")
+{
+    // an odd width exercises the simd kernel's tail, and the offset makes the mean large next to the spread
+    for (int d_model : {37, 768}) {
+        VectorXf gamma = VectorXf::Random(d_model);
+        VectorXf beta = VectorXf::Random(d_model);
+        norm_layer_t layer_norm(gamma, beta, 1e-5);
+
+        MatrixXf input = (MatrixXf::Random(6, d_model).array() * 3.0f + 100.0f).matrix();
+        input.row(5).setConstant(2.0f);
+
+        Eigen::MatrixXd x = input.cast<double>();
+        Eigen::MatrixXd expected(x.rows(), x.cols());
+        for (int r = 0; r < x.rows(); ++r) {
+            double mean = x.row(r).mean();
+            double var = (x.row(r).array() - mean).square().mean();
+            expected.row(r) = ((x.row(r).array() - mean) / std::sqrt(var + 1e-5)).transpose() * gamma.cast<double>().array() + beta.cast<double>().array();
+        }
+
+        // the whole matrix at once, and each row on its own
+        REQUIRE(matrices_approx_equal(layer_norm.forward(input), expected.cast<float>(), 1e-3f));
+        for (int r = 0; r < input.rows(); ++r) {
+            REQUIRE(matrices_approx_equal(layer_norm.forward(MatrixXf(input.row(r))), expected.row(r).cast<float>(), 1e-3f));
+        }
+
+        // and in place, as the model does for the final layer norm
+        activation_matrix_t in_place = input;
+        layer_norm.forward(in_place, in_place);
+        REQUIRE(matrices_approx_equal(MatrixXf(in_place), expected.cast<float>(), 1e-3f));
+    }
+}
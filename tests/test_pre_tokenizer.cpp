@@ -0,0 +1,109 @@
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_all.hpp>
+#include <iterator>
+#include <random>
+#include <regex>
+#include "../src/pre_tokenizer.h"
+#include "../src/tokenizer.h"
+
+namespace {
+
+std::vector<std::string> split(std::string_view text)
+{
+    std::vector<std::string> chunks;
+    pre_tokenizer_t pre_tokenizer(text);
+    std::string_view chunk;
+    while (pre_tokenizer.next(chunk)) {
+        chunks.emplace_back(chunk);
+    }
+    return chunks;
+}
+
+// the old std::regex split, which agrees with the GPT-2 pattern on ASCII text without underscores (its \w counted
+// them as letters)
+std::regex regex_pattern()
+{
+    return std::regex("'s|'t|'re|'ve|'m|'ll|'d| ?[a-zA-Z]+| ?[0-9]+| ?[^\\s\\w]+|\\s+(?!\\S)|\\s+");
+}
+
+// a megabyte of random English-like ASCII text, with contractions and runs of whitespace
+std::string ascii_text()
+{
+    std::mt19937 rng(7);
+    std::vector<std::string> pieces = {"the", " quick", "Brown", " fox", "'s", "'ll", "'", " ", "  ", "\n", "\t", "42", " 7", "!", "?!", ".", "-", " (", ")"};
+    std::string text;
+    while (text.size() < (1 << 20)) {
+        text += pieces[rng() % pieces.size()];
+    }
+    return text;
+}
+
+}  // namespace
+
+TEST_CASE("Pre-tokenizer splits like the GPT-2 pattern", "[pre_tokenizer]")
+{
+    // expected chunks from the pattern with Python's Unicode letter, number and whitespace classes
+    std::vector<std::pair<std::string, std::vector<std::string>>> cases = {
+        {"Hello world, it's 2024!", {"Hello", " world", ",", " it", "'s", " 2024", "!"}},
+        {"Ünïcödé 日本語 emoji 🙂 text", {"Ünïcödé", " 日本語", " emoji", " 🙂", " text"}},
+        {"price: ½ or Ⅻ or ٣٤", {"price", ":", " ½", " or", " Ⅻ", " or", " ٣٤"}},
+        {"snake_case_name __init__", {"snake", "_", "case", "_", "name", " __", "init", "__"}},
+        {"  two spaces\n\n\nnewlines   ", {" ", " two", " spaces", "\n\n", "\n", "newlines", "   "}},
+        {"tab\tseparated　ideographic space", {"tab", "\t", "separated", "　", "ideographic", " space"}},
+        {"don't we'll they're I'VE 'tis", {"don", "'t", " we", "'ll", " they", "'re", " I", "'", "VE", " '", "tis"}},
+        {"naïve café Ελληνικά русский", {"naïve", " café", " Ελληνικά", " русский"}},
+        // long enough runs for the 16 byte blocks, ending in the middle of one
+        {"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZé 12345678901234567890 !!!!!!!!!!!!!!!!!!!?é",
+         {"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZé", " 12345678901234567890", " !!!!!!!!!!!!!!!!!!!?", "é"}},
+        {"", {}},
+    };
+    for (const auto& [text, expected] : cases) {
+        REQUIRE(split(text) == expected);
+    }
+}
+
+TEST_CASE("Pre-tokenizer keeps bytes that aren't UTF-8", "[pre_tokenizer]")
+{
+    // a stray continuation byte, a truncated sequence, an overlong encoding and a surrogate, none of which are letters
+    std::string text = "ab\x80 cd\xE6\x97 x\xC0\xAFy \xED\xA0\x80z";
+    std::vector<std::string> chunks = split(text);
+    REQUIRE(chunks == std::vector<std::string>({"ab", "\x80", " cd", "\xE6\x97", " x", "\xC0\xAF", "y", " \xED\xA0\x80", "z"}));
+
+    tokenizer_t tokenizer("gpt2/vocab.json", "gpt2/merges.txt");
+    REQUIRE(tokenizer.decode(tokenizer.tokenize(text)) == text);
+}
+
+TEST_CASE("Pre-tokenizer matches the regex it replaced on ASCII text", "[pre_tokenizer]")
+{
+    std::regex pattern = regex_pattern();
+    std::string text = ascii_text();
+
+    std::vector<std::string> expected;
+    for (std::sregex_iterator it(text.begin(), text.end(), pattern), end; it != end; ++it) {
+        expected.push_back(it->str());
+    }
+    REQUIRE(split(text) == expected);
+}
+
+TEST_CASE("Pre-tokenizer throughput against the regex it replaced", "[pre_tokenizer][!benchmark]")
+{
+    std::regex pattern = regex_pattern();
+    std::string text = ascii_text();
+
+    // just the scans, without copying out the chunks
+    BENCHMARK("pre_tokenizer_t on 1 MB of ASCII text")
+    {
+        size_t num_chunks = 0;
+        pre_tokenizer_t pre_tokenizer(text);
+        std::string_view chunk;
+        while (pre_tokenizer.next(chunk)) {
+            ++num_chunks;
+        }
+        return num_chunks;
+    };
+
+    BENCHMARK("std::regex on 1 MB of ASCII text")
+    {
+        return std::distance(std::sregex_iterator(text.begin(), text.end(), pattern), std::sregex_iterator());
+    };
+}
@@ -0,0 +1,107 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include "../src/eigen_config.h"
+#include "../src/gpt2.h"
+#include "../src/transformer/kv_block_pool.h"
+#include "../src/transformer/kv_cache.h"
+#include "../src/transformer/prefix_cache.h"
+#include "test_utils.h"
+
+// fill a cache with one row per token, so it's easy to check which blocks ended up where
+static void fill_cache(kv_cache_t& cache, const std::vector<int>& tokens)
+{
+    for (int token : tokens) {
+        MatrixXf row = MatrixXf::Constant(1, 4, token);
+        cache.layer(0).append(row, row);
+    }
+}
+
+TEST_CASE("Prefix cache shares full blocks", "[prefix_cache]")
+{
+    kv_block_pool_t pool(1, 4, 2);
+    prefix_cache_t prefix_cache(pool, 16);
+
+    std::vector<int> tokens = {1, 2, 3, 4, 5};
+    {
+        kv_cache_t cache(pool);
+        fill_cache(cache, tokens);
+        prefix_cache.insert(tokens, cache);
+    }
+
+    // only the two full blocks are kept, and they outlive the sequence that made them
+    REQUIRE(prefix_cache.size() == 2);
+    REQUIRE(pool.num_used() == 2);
+
+    // a request with the same start reuses them
+    kv_cache_t cache(pool);
+    REQUIRE(prefix_cache.lookup({1, 2, 3, 4, 9, 9}, cache) == 4);
+    REQUIRE(cache.size() == 4);
+    REQUIRE(pool.ref_count(cache.get_block_table()[0]) == 2);
+    REQUIRE(cache.layer(0).keys(1, 0, 4)(0, 0) == 3);
+    REQUIRE(cache.layer(0).keys(1, 0, 4)(1, 0) == 4);
+
+    // the last token is never matched, there has to be something left to compute logits for
+    kv_cache_t exact(pool);
+    REQUIRE(prefix_cache.lookup({1, 2, 3, 4}, exact) == 2);
+
+    kv_cache_t miss(pool);
+    REQUIRE(prefix_cache.lookup({7, 8, 9}, miss) == 0);
+
+    REQUIRE(prefix_cache.get_stats().hits == 2);
+    REQUIRE(prefix_cache.get_stats().misses == 1);
+    REQUIRE(prefix_cache.get_stats().hit_tokens == 6);
+
+    // writing into a shared block copies it first, leaving the cached one untouched
+    int shared_block = cache.get_block_table()[1];
+    cache.truncate(3);
+    MatrixXf row = MatrixXf::Constant(1, 4, 42);
+    cache.layer(0).append(row, row);
+    REQUIRE(cache.get_block_table()[1] != shared_block);
+    REQUIRE(matrices_approx_equal(pool.keys(shared_block, 0, 2, 0, 4).row(1), MatrixXf::Constant(1, 4, 4)));
+}
+
+TEST_CASE("Prefix cache evicts least recently used blocks", "[prefix_cache]")
+{
+    kv_block_pool_t pool(1, 4, 2);
+    prefix_cache_t prefix_cache(pool, 2);
+
+    for (const std::vector<int>& tokens : std::vector<std::vector<int>>{{1, 2}, {3, 4}, {5, 6}}) {
+        kv_cache_t cache(pool);
+        fill_cache(cache, tokens);
+        prefix_cache.insert(tokens, cache);
+    }
+
+    // the oldest entry went to make room for the newest
+    REQUIRE(prefix_cache.size() == 2);
+    REQUIRE(prefix_cache.get_stats().evictions == 1);
+    REQUIRE(pool.num_used() == 2);
+
+    kv_cache_t cache(pool);
+    REQUIRE(prefix_cache.lookup({1, 2, 0}, cache) == 0);
+    REQUIRE(prefix_cache.lookup({5, 6, 0}, cache) == 2);
+}
+
+TEST_CASE("GPT2 generate reuses cached prompt prefixes", "[prefix_cache]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    std::string system_prompt = "You are a helpful assistant. Answer every question as briefly and accurately as you possibly can. ";
+    std::vector<int> first = gpt2.tokenize(system_prompt + "What is the capital of France?");
+    std::vector<int> second = gpt2.tokenize(system_prompt + "Who wrote Hamlet?");
+
+    generation_params_t params;
+    params.max_new_tokens = 4;
+    params.stop_at_eos = false;
+
+    generation_result_t expected = gpt2.generate(second, params);
+
+    gpt2.enable_prefix_cache(64);
+    gpt2.generate(first, params);
+    generation_result_t result = gpt2.generate(second, params);
+
+    REQUIRE(result.stats.cached_prompt_tokens > 0);
+    REQUIRE(result.tokens == expected.tokens);
+    REQUIRE(gpt2.get_prefix_cache()->get_stats().hits == 1);
+    REQUIRE(gpt2.get_prefix_cache()->get_stats().misses == 1);
+}
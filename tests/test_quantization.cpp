@@ -0,0 +1,122 @@
+#include <catch2/catch_test_macros.hpp>
+#include <iostream>
+#include "../src/eigen_config.h"
+#include "../src/gpt2.h"
+#include "../src/transformer/quantized_matrix.h"
+#include "test_utils.h"
+
+// how far off the int8 logits are from the fp32 ones
+struct logits_error_t {
+    float max_abs_error = 0;
+    float mean_abs_error = 0;
+    float relative_error = 0;
+    // rows where both pick the same most likely token
+    int top1_matches = 0;
+};
+
+static logits_error_t compare_logits(const MatrixXf& logits, const MatrixXf& reference)
+{
+    logits_error_t error;
+    MatrixXf diff = logits - reference;
+    error.max_abs_error = diff.cwiseAbs().maxCoeff();
+    error.mean_abs_error = diff.cwiseAbs().mean();
+    error.relative_error = diff.norm() / reference.norm();
+    for (int r = 0; r < logits.rows(); ++r) {
+        error.top1_matches += gpt2_t::max_like_token_id(logits, r) == gpt2_t::max_like_token_id(reference, r);
+    }
+    return error;
+}
+
+static void report(const std::string& name, const logits_error_t& error, int rows)
+{
+    std::cout << name << " (" << quantized_matrix_t::kernel_name() << " kernel): max abs error " << error.max_abs_error << ", mean abs error "
+              << error.mean_abs_error << ", relative error " << error.relative_error << ", top-1 agreement " << error.top1_matches << "/" << rows
+              << std::endl;
+}
+
+TEST_CASE("Int8 matrix multiply stays close to fp32", "[quantization]")
+{
+    // an inner size that isn't a multiple of the simd width, so the tail gets used too
+    MatrixXf W = MatrixXf::Random(48, 100);
+    MatrixXf X = MatrixXf::Random(7, 100);
+    X.row(3).setZero();
+
+    quantized_matrix_t W_int8(W);
+    REQUIRE(W_int8.rows() == 48);
+    REQUIRE(W_int8.cols() == 100);
+
+    // each weight is off by at most half a step of its channel's scale
+    MatrixXf step = W.cwiseAbs().rowwise().maxCoeff() / 127.0f;
+    MatrixXf weight_error = (W_int8.dequantize() - W).cwiseAbs();
+    for (int c = 0; c < W.rows(); ++c) {
+        REQUIRE(weight_error.row(c).maxCoeff() <= step(c) * 0.5f + 1e-6f);
+    }
+
+    MatrixXf expected = X * W.transpose();
+    MatrixXf output = W_int8.multiply(X);
+    REQUIRE(output.rows() == 7);
+    REQUIRE(output.cols() == 48);
+    REQUIRE((output - expected).norm() / expected.norm() < 0.02f);
+    REQUIRE(output.row(3).isZero());
+}
+
+TEST_CASE("Int8 matrix multiply tiles match the single row products", "[quantization]")
+{
+    // channel and row counts that leave partial tiles, and an inner size with a simd tail
+    MatrixXf W = MatrixXf::Random(37, 100);
+    activation_matrix_t X = activation_matrix_t::Random(9, 100);
+    quantized_matrix_t W_int8(W);
+
+    // the integer sums are exact, so the tiles land on the same floats as multiplying the rows one at a time
+    MatrixXf output = W_int8.multiply(X);
+    for (int r = 0; r < X.rows(); ++r) {
+        REQUIRE(W_int8.multiply(X.row(r)) == output.row(r));
+    }
+
+    quantized_rows_t X_int8 = quantized_matrix_t::quantize_rows(X);
+    MatrixXf expected = X_int8.scales.asDiagonal() * X_int8.values.cast<float>() * W_int8.dequantize().transpose();
+    REQUIRE((output - expected).cwiseAbs().maxCoeff() <= 1e-4f * expected.cwiseAbs().maxCoeff());
+
+    // a run of channels starting part way through a tile
+    MatrixXf channels(X.rows(), 11);
+    W_int8.multiply_channels(X_int8, 5, channels);
+    REQUIRE(channels == output.middleCols(5, 11));
+}
+
+TEST_CASE("Int8 GPT2 logits against the fp32 reference", "[quantization]")
+{
+    int seq_length = 10;
+    int vocab_size = 50257;
+
+    MatrixXf expected_logits = readMatrixFromFile("tests/test_data/gpt2/gpt2_output.txt", seq_length, vocab_size);
+
+    gpt2_t gpt2;
+    gpt2.init();
+    gpt2.quantize(quantization_t::int8);
+
+    MatrixXf logits = gpt2.forward(std::string("GPT2 is a model developed by OpenAI"));
+
+    logits_error_t error = compare_logits(logits, expected_logits);
+    report("int8 vs fp32 reference logits", error, seq_length);
+
+    REQUIRE(error.relative_error < 0.1f);
+    REQUIRE(gpt2_t::max_like_token_id(logits, seq_length - 1) == gpt2_t::max_like_token_id(expected_logits, seq_length - 1));
+}
+
+TEST_CASE("Int8 GPT2 tracks the fp32 model", "[quantization]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    std::vector<int> tokens = gpt2.tokenize("The quick brown fox jumps over the lazy dog");
+    MatrixXf fp32_logits = gpt2.forward(tokens);
+
+    gpt2.quantize(quantization_t::int8);
+    REQUIRE(gpt2.get_quantization() == quantization_t::int8);
+    MatrixXf int8_logits = gpt2.forward(tokens);
+
+    logits_error_t error = compare_logits(int8_logits, fp32_logits);
+    report("int8 vs fp32 model logits", error, tokens.size());
+
+    REQUIRE(error.relative_error < 0.1f);
+}
@@ -0,0 +1,210 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cmath>
+#include <map>
+#include <set>
+#include <vector>
+#include "../src/gpt2.h"
+#include "../src/sampler.h"
+#include "../src/scheduler.h"
+
+// draw n tokens from fresh copies of the logits, the sampler is allowed to scribble over them
+static std::map<int, int> sample_counts(sampler_t& sampler, const std::vector<float>& logits, int n)
+{
+    std::map<int, int> counts;
+    for (int i = 0; i < n; ++i) {
+        std::vector<float> scratch = logits;
+        counts[sampler.sample(scratch.data(), scratch.size())]++;
+    }
+    return counts;
+}
+
+TEST_CASE("Greedy sampling and penalties", "[sampler]")
+{
+    std::vector<float> logits = {1.0f, 3.0f, 2.5f, -1.0f};
+
+    sampler_t greedy(sampling_params_t{});
+    REQUIRE(sample_counts(greedy, logits, 1).begin()->first == 1);
+
+    // token 1 was in the prompt, halving its logit hands the win to token 2
+    sampling_params_t params;
+    params.repetition_penalty = 2.0f;
+    sampler_t penalised(params, {1});
+    REQUIRE(sample_counts(penalised, logits, 1).begin()->first == 2);
+
+    // and frequent enough tokens are pushed below the rest by the frequency penalty
+    params = sampling_params_t{};
+    params.frequency_penalty = 0.5f;
+    sampler_t frequency(params, {1, 1, 1, 1, 1, 2, 2, 2, 2});
+    REQUIRE(sample_counts(frequency, logits, 1).begin()->first == 0);
+}
+
+TEST_CASE("Temperature sampling follows the softmax", "[sampler]")
+{
+    std::vector<float> logits = {0.0f, 1.0f, 2.0f, 0.5f};
+
+    sampling_params_t params;
+    params.temperature = 1.0f;
+    params.seed = 42;
+    sampler_t sampler(params);
+
+    int n = 20000;
+    std::map<int, int> counts = sample_counts(sampler, logits, n);
+
+    double total = 0;
+    for (float logit : logits) {
+        total += std::exp(logit);
+    }
+    for (size_t token = 0; token < logits.size(); ++token) {
+        double expected = std::exp(logits[token]) / total;
+        REQUIRE(std::abs(counts[token] / static_cast<double>(n) - expected) < 0.02);
+    }
+}
+
+TEST_CASE("Top k, top p and min p restrict the candidates", "[sampler]")
+{
+    // probabilities at temperature 1 are roughly 0.61, 0.22, 0.08, 0.03 ... for the first few tokens
+    std::vector<float> logits(1000, -5.0f);
+    logits[10] = 4.0f;
+    logits[20] = 3.0f;
+    logits[30] = 2.0f;
+    logits[40] = 1.0f;
+
+    sampling_params_t base_params;
+    base_params.temperature = 1.0f;
+
+    {
+        sampling_params_t params = base_params;
+        params.top_k = 2;
+        sampler_t sampler(params);
+        std::map<int, int> counts = sample_counts(sampler, logits, 2000);
+        REQUIRE(counts.size() == 2);
+        REQUIRE(counts.count(10) == 1);
+        REQUIRE(counts.count(20) == 1);
+    }
+
+    {
+        sampling_params_t params = base_params;
+        // the first token alone doesn't cover 0.7, the first two do
+        params.top_p = 0.7f;
+        sampler_t sampler(params);
+        std::map<int, int> counts = sample_counts(sampler, logits, 2000);
+        REQUIRE(counts.size() == 2);
+        REQUIRE(counts.count(10) == 1);
+        REQUIRE(counts.count(20) == 1);
+    }
+
+    {
+        sampling_params_t params = base_params;
+        // a tenth of the top probability keeps the tokens within ln(10) of the top logit
+        params.min_p = 0.1f;
+        sampler_t sampler(params);
+        std::map<int, int> counts = sample_counts(sampler, logits, 2000);
+        REQUIRE(counts.size() == 3);
+        REQUIRE(counts.count(30) == 1);
+    }
+}
+
+TEST_CASE("Top k breaks ties towards the lower token id", "[sampler]")
+{
+    // every token is equally likely, so which three top k keeps comes down to the tie break alone
+    std::vector<float> logits(300, 1.0f);
+
+    sampling_params_t params;
+    params.temperature = 1.0f;
+    params.top_k = 3;
+    params.min_p = 0.5f;
+    sampler_t sampler(params);
+    std::map<int, int> counts = sample_counts(sampler, logits, 3000);
+    REQUIRE(counts.size() == 3);
+    REQUIRE(counts.begin()->first == 0);
+    REQUIRE(counts.rbegin()->first == 2);
+}
+
+TEST_CASE("Samplers with the same seed give the same tokens", "[sampler]")
+{
+    std::vector<float> logits(500);
+    for (size_t i = 0; i < logits.size(); ++i) {
+        logits[i] = std::sin(static_cast<float>(i));
+    }
+
+    sampling_params_t params;
+    params.temperature = 0.8f;
+    params.top_p = 0.9f;
+    params.seed = 7;
+
+    sampler_t first(params), second(params);
+    std::vector<int> first_tokens, second_tokens;
+    for (int i = 0; i < 50; ++i) {
+        std::vector<float> a = logits, b = logits;
+        first_tokens.push_back(first.sample(a.data(), a.size()));
+        second_tokens.push_back(second.sample(b.data(), b.size()));
+    }
+    REQUIRE(first_tokens == second_tokens);
+    REQUIRE(std::set<int>(first_tokens.begin(), first_tokens.end()).size() > 1);
+}
+
+TEST_CASE("Scheduler samples like generate", "[sampler]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    generation_params_t params;
+    params.max_new_tokens = 5;
+    params.stop_at_eos = false;
+    params.sampling.temperature = 0.9f;
+    params.sampling.top_k = 40;
+    params.sampling.repetition_penalty = 1.2f;
+
+    std::vector<std::vector<int>> prompts = {gpt2.tokenize("GPT2 is a model developed by OpenAI"), gpt2.tokenize("Hello")};
+
+    scheduler_config_t config;
+    scheduler_t scheduler(gpt2, config);
+
+    std::map<int, generation_result_t> results;
+    for (size_t i = 0; i < prompts.size(); ++i) {
+        generation_request_t request;
+        request.prompt = prompts[i];
+        request.params = params;
+        request.params.sampling.seed = i;
+        request.on_finish = [&results, i](const generation_result_t& result) { results[i] = result; };
+        scheduler.submit(request);
+    }
+    scheduler.run_until_idle();
+
+    // each sequence has its own random stream, so batching them together doesn't change what they sample
+    for (size_t i = 0; i < prompts.size(); ++i) {
+        generation_params_t sequence_params = params;
+        sequence_params.sampling.seed = i;
+        REQUIRE(results[i].tokens == gpt2.generate(prompts[i], sequence_params).tokens);
+    }
+}
+
+TEST_CASE("Scheduler gives requests without a seed their own random streams", "[sampler]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    generation_params_t params;
+    params.max_new_tokens = 16;
+    params.stop_at_eos = false;
+    params.sampling.temperature = 1.5f;
+
+    std::vector<int> prompt = gpt2.tokenize("Hello");
+
+    scheduler_config_t config;
+    scheduler_t scheduler(gpt2, config);
+
+    std::vector<generation_result_t> results(2);
+    for (size_t i = 0; i < results.size(); ++i) {
+        generation_request_t request;
+        request.prompt = prompt;
+        request.params = params;
+        request.on_finish = [&results, i](const generation_result_t& result) { results[i] = result; };
+        scheduler.submit(request);
+    }
+    scheduler.run_until_idle();
+
+    // the same prompt twice, sampled from different streams
+    REQUIRE(results[0].tokens.size() == static_cast<size_t>(params.max_new_tokens));
+    REQUIRE(results[0].tokens != results[1].tokens);
+}
@@ -0,0 +1,53 @@
+#include <catch2/catch_test_macros.hpp>
+#include <map>
+#include <vector>
+#include "../src/gpt2.h"
+#include "../src/scheduler.h"
+
+TEST_CASE("Scheduler matches sequential generation", "[scheduler]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    std::vector<std::vector<int>> prompts = {gpt2.tokenize("GPT2 is a model developed by OpenAI"), gpt2.tokenize("Hello"),
+                                             gpt2.tokenize("The quick brown fox jumps over the lazy dog"), gpt2.tokenize("One two three")};
+    std::vector<int> max_new_tokens = {6, 3, 5, 4};
+
+    // a small batch and token budget, so requests have to queue and long prompts are prefilled in chunks
+    scheduler_config_t config;
+    config.max_batch_size = 2;
+    config.max_tokens_per_step = 6;
+    scheduler_t scheduler(gpt2, config);
+
+    std::map<int, generation_result_t> results;
+    std::map<int, std::vector<int>> streamed;
+    for (size_t i = 0; i < prompts.size(); ++i) {
+        generation_request_t request;
+        request.prompt = prompts[i];
+        request.params.max_new_tokens = max_new_tokens[i];
+        request.params.stop_at_eos = false;
+        request.on_token = [&streamed, i](int token) { streamed[i].push_back(token); };
+        request.on_finish = [&results, i](const generation_result_t& result) { results[i] = result; };
+        scheduler.submit(request);
+    }
+
+    REQUIRE(scheduler.num_queued() == 4);
+
+    scheduler.run_until_idle();
+
+    REQUIRE(scheduler.num_active() == 0);
+    REQUIRE(scheduler.num_queued() == 0);
+    REQUIRE(scheduler.get_stats().completed_requests == 4);
+    REQUIRE(scheduler.get_stats().max_batch_size_seen == 2);
+
+    for (size_t i = 0; i < prompts.size(); ++i) {
+        generation_params_t params;
+        params.max_new_tokens = max_new_tokens[i];
+        params.stop_at_eos = false;
+        generation_result_t expected = gpt2.generate(prompts[i], params);
+
+        REQUIRE(results[i].tokens == expected.tokens);
+        REQUIRE(streamed[i] == expected.tokens);
+        REQUIRE(results[i].stats.generated_tokens == max_new_tokens[i]);
+    }
+}
@@ -0,0 +1,111 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cmath>
+#include <vector>
+#include "../src/gpt2.h"
+#include "../src/speculative.h"
+
+TEST_CASE("N-gram draft continues the latest match", "[speculative]")
+{
+    // "1 2" appears twice before the end, the later occurrence was followed by 5 6
+    std::vector<int> context = {1, 2, 3, 4, 1, 2, 5, 6, 7, 1, 2};
+    REQUIRE(ngram_draft(context, 2, 3) == std::vector<int>({5, 6}));
+
+    // the longest match wins, "9 1 2" only appears once
+    context = {9, 1, 2, 8, 1, 2, 5, 9, 1, 2};
+    REQUIRE(ngram_draft(context, 3, 3) == std::vector<int>({8, 1, 2}));
+
+    // the draft stops at the end of the context
+    context = {4, 5, 4};
+    REQUIRE(ngram_draft(context, 4, 3) == std::vector<int>({5, 4}));
+
+    REQUIRE(ngram_draft({1, 2, 3}, 4, 3).empty());
+}
+
+TEST_CASE("Greedy speculative decoding matches generate", "[speculative]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    generation_params_t params;
+    params.max_new_tokens = 12;
+    params.stop_at_eos = false;
+
+    std::vector<int> prompt = gpt2.tokenize("GPT2 is a model developed by OpenAI. GPT2 is a model");
+    std::vector<int> expected = gpt2.generate(prompt, params).tokens;
+
+    speculative_config_t config;
+    config.num_draft_tokens = 3;
+
+    config.draft = draft_mode_t::ngram;
+    speculative_decoder_t ngram(gpt2, config);
+    REQUIRE(ngram.generate(prompt, params).tokens == expected);
+    REQUIRE(ngram.get_stats().generated_tokens == params.max_new_tokens);
+
+    config.draft = draft_mode_t::truncated;
+    config.draft_layers = 2;
+    speculative_decoder_t truncated(gpt2, config);
+    REQUIRE(truncated.generate(prompt, params).tokens == expected);
+
+    // drafting with every layer is the full model, so every draft is accepted
+    config.draft_layers = gpt2.get_num_layers();
+    speculative_decoder_t full(gpt2, config);
+    REQUIRE(full.generate(prompt, params).tokens == expected);
+    REQUIRE(full.get_stats().acceptance_rate() == 1.0);
+    REQUIRE(full.get_stats().verify_steps < params.max_new_tokens);
+}
+
+TEST_CASE("Speculative sampling is deterministic for a seed", "[speculative]")
+{
+    gpt2_t gpt2;
+    gpt2.init();
+
+    generation_params_t params;
+    params.max_new_tokens = 8;
+    params.stop_at_eos = false;
+    params.sampling.temperature = 0.8f;
+    params.sampling.top_k = 40;
+    params.sampling.seed = 3;
+
+    std::vector<int> prompt = gpt2.tokenize("Hello, my name is");
+
+    speculative_config_t config;
+    config.draft = draft_mode_t::truncated;
+    config.draft_layers = 4;
+
+    speculative_decoder_t first(gpt2, config), second(gpt2, config);
+    std::vector<int> tokens = first.generate(prompt, params).tokens;
+    REQUIRE(tokens.size() == static_cast<size_t>(params.max_new_tokens));
+    REQUIRE(tokens == second.generate(prompt, params).tokens);
+}
+
+TEST_CASE("Speculative sampling draws tokens with the full model's distribution", "[speculative]")
+{
+    // a small vocabulary where the draft disagrees with the full model, so plenty of drafts are rejected
+    std::vector<token_prob_t> target = {{0, 0.1f}, {1, 0.4f}, {2, 0.3f}, {3, 0.2f}};
+    std::vector<token_prob_t> draft_dist = {{0, 0.4f}, {1, 0.1f}, {2, 0.3f}, {3, 0.2f}};
+    int vocab_size = target.size();
+
+    sampling_params_t params;
+    params.temperature = 1.0f;
+    params.seed = 11;
+    sampler_t speculative(params), plain(params);
+
+    int n = 100000;
+    std::vector<int> speculative_counts(vocab_size), plain_counts(vocab_size);
+    std::vector<float> draft_probs;
+    std::vector<token_prob_t> residual;
+    for (int i = 0; i < n; ++i) {
+        // the draft is drawn the way the decoder draws it, from a fork of the sequence's sampler
+        int draft = speculative.fork(i).draw(draft_dist);
+        speculative_counts[verify_draft(speculative, target, &draft_dist, draft, vocab_size, draft_probs, residual).token]++;
+
+        plain_counts[plain.draw(target)]++;
+    }
+
+    for (int token = 0; token < vocab_size; ++token) {
+        double speculative_frequency = speculative_counts[token] / static_cast<double>(n);
+        double plain_frequency = plain_counts[token] / static_cast<double>(n);
+        REQUIRE(std::abs(speculative_frequency - target[token].prob) < 0.01);
+        REQUIRE(std::abs(speculative_frequency - plain_frequency) < 0.015);
+    }
+}
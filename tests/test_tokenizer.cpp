@@ -38,4 +38,50 @@ TEST_CASE("Vocabulary loader correctly loads GPT-2 vocabulary", "[vocab_loader]"
     // expected tokens from the hugging face python api
     std::vector<int> expected_tokens = {38, 11571, 17, 318, 257, 2746, 4166, 416, 4946, 20185};
     REQUIRE(tokens == expected_tokens);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Tokenizer decode round trips text", "[vocab_loader]")
+{
+    tokenizer_t tokenizer("gpt2/vocab.json", "gpt2/merges.txt");
+
+    std::string text = "GPT2 is a model developed by OpenAI.\n  It's 2019!";
+
+    REQUIRE(tokenizer.decode(tokenizer.tokenize(text)) == text);
+}
+
+TEST_CASE("BPE merges in the same order as the reference", "[vocab_loader]")
+{
+    tokenizer_t tokenizer("gpt2/vocab.json", "gpt2/merges.txt");
+
+    // repeated symbols where the same pair can be merged at overlapping positions, runs of whitespace, and multi byte
+    // characters, expected tokens from the original implementation that rescanned every pair on each merge
+    std::vector<std::pair<std::string, std::vector<int>>> cases = {
+        {"aaaaaaa", {24794, 46071}},
+        {"        indented    code\n\n\n", {220, 220, 220, 220, 220, 220, 220, 773, 4714, 220, 220, 220, 2438, 628, 198}},
+        {"mmmmmmmmmmmmmmmm!!!!!!!!", {40133, 40133, 40133, 40133, 34635}},
+        {"Ünïcödé 日本語 emoji 🙂 text",
+         {127, 250, 77, 26884, 66, 9101, 67, 2634, 10545, 245, 98, 17312, 105, 45739, 252, 44805, 32485, 2420}},
+        {"antidisestablishmentarianism", {415, 29207, 44390, 3699, 1042}},
+        {"    def foo(self):\n        return 1234567890",
+         {220, 220, 220, 825, 22944, 7, 944, 2599, 198, 220, 220, 220, 220, 220, 220, 220, 1441, 17031, 2231, 30924, 3829}},
+    };
+    for (const auto& [text, expected] : cases) {
+        REQUIRE(tokenizer.tokenize(text) == expected);
+    }
+}
+
+TEST_CASE("Tokenizer handles long documents", "[vocab_loader]")
+{
+    tokenizer_t tokenizer("gpt2/vocab.json", "gpt2/merges.txt");
+
+    // a single chunk thousands of bytes long, merged pair by pair this would take minutes
+    std::string word(20000, 'a');
+    REQUIRE(tokenizer.decode(tokenizer.tokenize(word)) == word);
+
+    std::string document;
+    for (int i = 0; i < 2000; ++i) {
+        document += "Paragraph " + std::to_string(i) + " of the document, with some punctuation; and numbers: " + std::to_string(i * 7919) + ".\n";
+    }
+    std::vector<int> tokens = tokenizer.tokenize(document);
+    REQUIRE(tokenizer.decode(tokens) == document);
+}
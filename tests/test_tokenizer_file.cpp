@@ -0,0 +1,78 @@
+#include <catch2/catch_all.hpp>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "../src/tokenizer.h"
+#include "../src/tokenizer_file.h"
+
+TEST_CASE("Compiled tokenizer matches the one built from vocab.json", "[tokenizer_file]")
+{
+    string_t path = (std::filesystem::temp_directory_path() / "test_round_trip.tokenizer").string();
+
+    tokenizer_t from_json("gpt2/vocab.json", "gpt2/merges.txt");
+    from_json.save_compiled(path);
+
+    REQUIRE(tokenizer_file_t::is_tokenizer_file(path));
+    REQUIRE_FALSE(tokenizer_file_t::is_tokenizer_file("gpt2/vocab.json"));
+
+    tokenizer_t compiled(path);
+
+    REQUIRE(compiled.get_vocab_size() == from_json.get_vocab_size());
+    REQUIRE(compiled.get_mergers_size() == from_json.get_mergers_size());
+
+    std::string text = "GPT2 is a model developed by OpenAI.\n\n  Ünïcödé 日本語 🙂 it's 2024, \xFF\xFE stray bytes\t";
+    std::vector<int> tokens = from_json.tokenize(text);
+    REQUIRE(compiled.tokenize(text) == tokens);
+    REQUIRE(compiled.decode(tokens) == text);
+    REQUIRE(compiled.detokenize(tokens) == from_json.detokenize(tokens));
+
+    // every token can be found by its bytes, and decodes back to them
+    for (int id = 0; id < compiled.get_vocab_size(); ++id) {
+        std::string bytes = compiled.decode({id});
+        REQUIRE(compiled.token_id(bytes) == id);
+    }
+    REQUIRE(compiled.token_id("not a single token") == -1);
+    REQUIRE(compiled.detokenize(compiled.get_vocab_size()) == "");
+    REQUIRE_THROWS(compiled.decode({-1}));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Compiled tokenizer rejects files it can't use", "[tokenizer_file]")
+{
+    string_t path = (std::filesystem::temp_directory_path() / "test_corrupt.tokenizer").string();
+    tokenizer_t("gpt2/vocab.json", "gpt2/merges.txt").save_compiled(path);
+
+    std::string image;
+    {
+        std::ifstream file(path, std::ios::binary);
+        image.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    auto write = [&path](const std::string& bytes) { std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes; };
+
+    // a newer version
+    std::string changed = image;
+    changed[offsetof(tokenizer_file_format::header_t, version)] = 2;
+    write(changed);
+    REQUIRE_THROWS(tokenizer_t{path});
+
+    // the version as a machine with the other byte order writes it
+    changed = image;
+    uint32_t swapped_version = __builtin_bswap32(tokenizer_file_format::version);
+    std::memcpy(changed.data() + offsetof(tokenizer_file_format::header_t, version), &swapped_version, sizeof(swapped_version));
+    write(changed);
+    REQUIRE_THROWS(tokenizer_t{path});
+
+    // cut short, the merge table runs off the end
+    write(image.substr(0, image.size() - 64));
+    REQUIRE_THROWS(tokenizer_t{path});
+
+    // too short to even hold the header
+    write(image.substr(0, 16));
+    REQUIRE_THROWS(tokenizer_t{path});
+
+    REQUIRE_THROWS(tokenizer_t("gpt2/does_not_exist.bin"));
+
+    std::filesystem::remove(path);
+}
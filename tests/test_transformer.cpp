@@ -29,8 +29,8 @@ TEST_CASE("Transformer Forward Pass", "[transformer]")
     transformer.set_layer_weights(i, gpt_weights.layers[i].attn_c_attn_weight, gpt_weights.layers[i].attn_c_attn_bias,
                 gpt_weights.layers[i].attn_c_proj_weight, gpt_weights.layers[i].attn_c_proj_bias,
                 gpt_weights.layers[i].ln_1_weight, gpt_weights.layers[i].ln_1_bias,
-                gpt_weights.layers[i].mlp_c_fc_weight.transpose(), gpt_weights.layers[i].mlp_c_fc_bias,
-                gpt_weights.layers[i].mlp_c_proj_weight.transpose(), gpt_weights.layers[i].mlp_c_proj_bias,
+                gpt_weights.layers[i].mlp_c_fc_weight, gpt_weights.layers[i].mlp_c_fc_bias,
+                gpt_weights.layers[i].mlp_c_proj_weight, gpt_weights.layers[i].mlp_c_proj_bias,
                 gpt_weights.layers[i].ln_2_weight, gpt_weights.layers[i].ln_2_bias);
     }
 
@@ -1,8 +1,63 @@
 #include "test_utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <new>
 #include "../src/utils.h"
 
+namespace {
+std::atomic<long> new_calls{0};
+}
+
+// the test binary replaces the global operator new, the array and nothrow forms call these two
+void* operator new(size_t size)
+{
+    new_calls.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    new_calls.fetch_add(1, std::memory_order_relaxed);
+    // aligned_alloc wants a size that's a multiple of the alignment
+    size_t align = static_cast<size_t>(alignment);
+    size_t rounded = (std::max<size_t>(size, 1) + align - 1) / align * align;
+    if (void* p = std::aligned_alloc(align, rounded)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+long new_count()
+{
+    return new_calls.load(std::memory_order_relaxed);
+}
+
 bool matrices_approx_equal(const Eigen::MatrixXf& m1, const Eigen::MatrixXf& m2, float epsilon)
 {
     return (m1 - m2).cwiseAbs().maxCoeff() < epsilon;
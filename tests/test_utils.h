@@ -6,4 +6,7 @@ bool matrices_approx_equal(const Eigen::MatrixXf& m1, const Eigen::MatrixXf& m2,
 
 Eigen::MatrixXf readMatrixFromFile(const std::string& filename, int rows, int cols);
 
-Eigen::VectorXf readVectorFromFile(const std::string& filename);
\ No newline at end of file
+Eigen::VectorXf readVectorFromFile(const std::string& filename);
+// number of calls to the global operator new so far in this process, from any thread
+// Eigen allocates with malloc rather than new, so this misses its matrices, see scratch_buffer_t::growths for those
+long new_count();
@@ -0,0 +1,172 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "../src/gpt2.h"
+#include "../src/weight_file.h"
+#include "test_utils.h"
+
+TEST_CASE("Weight file round trip", "[weight_file]")
+{
+    string_t path = (std::filesystem::temp_directory_path() / "test_round_trip.weights").string();
+
+    MatrixXf matrix = MatrixXf::Random(7, 5);
+    VectorXf vector = VectorXf::Random(13);
+    {
+        weight_file_writer_t writer(path);
+        writer.add("matrix", matrix);
+        writer.add("vector", vector);
+        // a transposed block, which doesn't have the plain column-major layout the file stores
+        writer.add("block", matrix.block(1, 1, 4, 3).transpose());
+        writer.finish();
+    }
+
+    REQUIRE(weight_file_t::is_weight_file(path));
+    REQUIRE_FALSE(weight_file_t::is_weight_file("gpt2/vocab.json"));
+
+    weight_file_t file(path);
+    REQUIRE(file.contains("matrix"));
+    REQUIRE_FALSE(file.contains("missing"));
+
+    REQUIRE(file.matrix("matrix") == matrix);
+    REQUIRE(file.vector("vector") == vector);
+    REQUIRE(file.matrix("block") == MatrixXf(matrix.block(1, 1, 4, 3).transpose()));
+
+    // every tensor starts on a 64 byte boundary
+    for (const char* name : {"matrix", "vector", "block"}) {
+        REQUIRE(reinterpret_cast<uintptr_t>(file.matrix(name).data()) % 64 == 0);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Weight file rejects corrupt files without leaking the mapping", "[weight_file]")
+{
+    using namespace weight_file_format;
+    string_t path = (std::filesystem::temp_directory_path() / "test_corrupt.weights").string();
+    {
+        weight_file_writer_t writer(path);
+        writer.add("matrix", MatrixXf::Random(7, 5));
+        writer.finish();
+    }
+
+    std::string image;
+    {
+        std::ifstream file(path, std::ios::binary);
+        image.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    header_t header;
+    std::memcpy(&header, image.data(), sizeof(header));
+
+    // true if the file is still mapped somewhere in this process
+    auto is_mapped = [&path]() {
+        std::ifstream maps("/proc/self/maps");
+        std::string line;
+        while (std::getline(maps, line)) {
+            if (line.find(path) != std::string::npos) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // each change is written over a fresh copy of the good file
+    auto reject = [&](size_t offset, const void* value, size_t bytes) {
+        std::string changed = image;
+        std::memcpy(changed.data() + offset, value, bytes);
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << changed;
+        REQUIRE_THROWS(weight_file_t{path});
+        REQUIRE_FALSE(is_mapped());
+    };
+
+    reject(offsetof(header_t, version), "\x07", 1);
+
+    // the version as a machine with the other byte order writes it
+    uint32_t swapped_version = __builtin_bswap32(version);
+    reject(offsetof(header_t, version), &swapped_version, sizeof(swapped_version));
+
+    // a table offset so large that adding the table's size wraps around to something small
+    uint64_t wrapping_offset = ~uint64_t(0) - alignment + 1;
+    reject(offsetof(header_t, table_offset), &wrapping_offset, sizeof(wrapping_offset));
+
+    // 2^62 rows of 5 floats is 5 * 2^64 bytes, which wraps around to 0 and used to pass as in bounds
+    uint64_t huge_rows = uint64_t(1) << 62;
+    reject(header.table_offset + offsetof(table_entry_t, rows), &huge_rows, sizeof(huge_rows));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Native weights give the same logits as the checkpoint", "[weight_file]")
+{
+    string_t path = (std::filesystem::temp_directory_path() / "test_gpt2.weights").string();
+    convert_gpt2_weights(gpt2_t::h5_weights_path, path);
+
+    gpt2_t from_h5;
+    from_h5.init(gpt2_t::h5_weights_path);
+    gpt2_t from_native;
+    from_native.init(path);
+
+    std::vector<int> tokens = from_h5.tokenize("GPT2 is a model developed by OpenAI");
+    REQUIRE(matrices_approx_equal(from_native.forward(tokens), from_h5.forward(tokens), 1e-5f));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Native weights with the wrong shapes are rejected", "[weight_file]")
+{
+    using namespace weight_file_format;
+    string_t path = (std::filesystem::temp_directory_path() / "test_shapes.weights").string();
+    convert_gpt2_weights(gpt2_t::h5_weights_path, path);
+
+    std::string image;
+    {
+        std::ifstream file(path, std::ios::binary);
+        image.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    header_t header;
+    std::memcpy(&header, image.data(), sizeof(header));
+
+    // each change gives one tensor a shape that still fits in the file, but not in the model
+    auto reject = [&](const std::string& name, uint64_t rows, uint64_t cols) {
+        std::string changed = image;
+        for (uint32_t i = 0; i < header.num_tensors; ++i) {
+            size_t entry = header.table_offset + i * sizeof(table_entry_t);
+            if (name == changed.data() + entry + offsetof(table_entry_t, name)) {
+                std::memcpy(changed.data() + entry + offsetof(table_entry_t, rows), &rows, sizeof(rows));
+                std::memcpy(changed.data() + entry + offsetof(table_entry_t, cols), &cols, sizeof(cols));
+            }
+        }
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << changed;
+        gpt2_t gpt2;
+        REQUIRE_THROWS(gpt2.init(path));
+    };
+
+    // fewer positions than the model's context
+    reject("wpe", 1000, 768);
+    // the QKV projection transposed, which has the right number of floats
+    reject("h.3.attn.c_attn.weight", 3 * 768, 768);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Weight handles share their storage", "[weight_file]")
+{
+    MatrixXf matrix = MatrixXf::Random(4, 3);
+    weight_matrix_t handle = matrix;
+    weight_matrix_t copy = handle;
+    REQUIRE((*copy).data() == (*handle).data());
+    REQUIRE(*copy == matrix);
+
+    // the storage outlives the handle it came from
+    handle = weight_matrix_t();
+    REQUIRE_FALSE(handle);
+    REQUIRE(*copy == matrix);
+
+    gpt2_t gpt2;
+    gpt2.init();
+    gpt2_weights_t weights = gpt2.get_weights();
+    REQUIRE((*weights.token_embedding).data() == (*gpt2.get_weights().token_embedding).data());
+    REQUIRE((*weights.layers[0].mlp_c_fc_weight).data() == (*gpt2.get_weights().layers[0].mlp_c_fc_weight).data());
+}
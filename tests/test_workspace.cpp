@@ -0,0 +1,94 @@
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+#include "../src/eigen_config.h"
+#include "../src/transformer/kv_block_pool.h"
+#include "../src/transformer/kv_cache.h"
+#include "../src/transformer/scratch_buffer.h"
+#include "../src/transformer/transformer.h"
+#include "../src/transformer/workspace.h"
+#include "test_utils.h"
+
+TEST_CASE("Scratch buffers only grow when they have to", "[workspace]")
+{
+    scratch_buffer_t buffer;
+
+    auto first = buffer.matrix(3, 5);
+    REQUIRE(first.rows() == 3);
+    REQUIRE(first.cols() == 5);
+    const float* storage = first.data();
+
+    // anything that fits reuses the same memory, whatever its shape
+    REQUIRE(buffer.matrix(5, 3).data() == storage);
+    REQUIRE(buffer.vector(10).data() == storage);
+
+    // growing rounds up, so creeping up a little at a time doesn't reallocate every time
+    buffer.matrix(10, 10);
+    size_t grown = buffer.bytes();
+    REQUIRE(grown >= 100 * sizeof(float));
+    buffer.matrix(10, 11);
+    REQUIRE(buffer.bytes() == grown);
+
+    // the counters the decode step check below relies on see allocations
+    long growths = scratch_buffer_t::growths();
+    buffer.matrix(100, 100);
+    REQUIRE(scratch_buffer_t::growths() == growths + 1);
+    long news = new_count();
+    std::vector<int> allocated(10);
+    REQUIRE(new_count() > news);
+}
+
+TEST_CASE("Decode steps don't allocate once the workspace is warm", "[workspace]")
+{
+    int d_model = 64;
+    int num_heads = 4;
+    int d_ff = 256;
+    int num_layers = 2;
+    int prompt_length = 5;
+    int steps = 8;
+
+    std::vector<decoder_layer_weights_t> layer_weights;
+    for (int i = 0; i < num_layers; ++i) {
+        layer_weights.push_back({MatrixXf::Random(d_model, 3 * d_model), VectorXf::Random(3 * d_model), MatrixXf::Random(d_model, d_model),
+                                 VectorXf::Random(d_model), VectorXf::Random(d_model), VectorXf::Random(d_model), MatrixXf::Random(d_ff, d_model),
+                                 VectorXf::Random(d_ff), MatrixXf::Random(d_model, d_ff), VectorXf::Random(d_model), VectorXf::Random(d_model),
+                                 VectorXf::Random(d_model)});
+    }
+    MatrixXf inputs = MatrixXf::Random(prompt_length + steps, d_model);
+
+    for (bool int8 : {false, true}) {
+        transformer_t transformer(num_heads, layer_weights);
+        if (int8) {
+            transformer.quantize_int8();
+        }
+
+        // blocks big enough that none of the steps needs a new one
+        kv_block_pool_t pool(num_layers, d_model, 32);
+        kv_cache_t cache(pool);
+        std::vector<kv_cache_t*> caches = {&cache};
+        workspace_t workspace;
+
+        activation_matrix_t prompt = inputs.topRows(prompt_length);
+        transformer.forward_in_place(prompt, sequence_batch_t({prompt_length}), caches, num_layers, workspace);
+
+        sequence_batch_t step_batch({1});
+        activation_matrix_t hidden(1, d_model);
+        long allocations = 0;
+        for (int step = 0; step < steps; ++step) {
+            hidden = inputs.row(prompt_length + step);
+
+            // the layers' matrices all live in scratch buffers, anything else they allocate goes through new
+            long news_before = new_count();
+            long growths_before = scratch_buffer_t::growths();
+            transformer.forward_in_place(hidden, step_batch, caches, num_layers, workspace);
+            // the first step after the prefill is allowed to set up the single row buffers
+            if (step > 0) {
+                allocations += new_count() - news_before + scratch_buffer_t::growths() - growths_before;
+            }
+        }
+        REQUIRE(allocations == 0);
+
+        // and the steps still add up to running the whole sequence at once
+        MatrixXf full = transformer.forward(inputs);
+        REQUIRE(matrices_approx_equal(hidden, full.bottomRows(1), 1e-3f));
+    }
+}